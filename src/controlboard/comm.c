@@ -14,27 +14,66 @@
 #include <errno.h>   /* Error number definitions */
 #include <termios.h> /* POSIX terminal control definitions */
 #include <stdarg.h>
+#include <pthread.h>
 #include <wiicarutility/timestamp.h>
 #include <wiicarutility/error_message.h>
 
 #include "control_board.h"
 
-int32_t fd; // file descriptor for the port
-
 bool comm_trace = false;
 bool diagnostic_mode = false;
 
-char tx_buffer[256];
-char rx_buffer[256];
+static control_board_session_t default_session =
+{ .lock = PTHREAD_MUTEX_INITIALIZER, .priority_done = PTHREAD_COND_INITIALIZER,
+		.fd = 0 };
+
+static pthread_key_t session_key;
+static pthread_once_t session_key_once = PTHREAD_ONCE_INIT;
+
+static int32_t comm_writeline(control_board_session_t *session, char *buffer);
+static int32_t comm_readline(control_board_session_t *session, char *bfr,
+		int32_t count);
+static int32_t comm_validate_response(control_board_session_t *session,
+		char *response, char *cmd, char *parameters);
+
+static void create_session_key(void)
+{
+	pthread_key_create(&session_key, NULL);
+}
+
+void comm_session_init(control_board_session_t *session)
+{
+	memset(session, 0, sizeof(*session));
+	pthread_mutex_init(&session->lock, NULL);
+	pthread_cond_init(&session->priority_done, NULL);
+}
+
+/*!
+ \brief Make session the control board used by all commands issued from the calling thread.
+ */
+void comm_bind_session(control_board_session_t *session)
+{
+	pthread_once(&session_key_once, create_session_key);
+	pthread_setspecific(session_key, session);
+}
 
-static int32_t comm_writeline(char *buffer);
-static int32_t comm_readline(char *bfr, int32_t count);
-static int32_t comm_validate_response(char *response, char *cmd,
-		char *parameters);
+control_board_session_t *comm_get_session(void)
+{
+	control_board_session_t *session;
+
+	pthread_once(&session_key_once, create_session_key);
+	session = pthread_getspecific(session_key);
+	return session ? session : &default_session;
+}
+
+const comm_latency_stats_t *get_comm_latency(void)
+{
+	return &comm_get_session()->latency;
+}
 
 int open_port(char *name)
 {
-	fd = open(name, O_RDWR | O_NOCTTY | O_NDELAY);
+	int fd = open(name, O_RDWR | O_NOCTTY | O_NDELAY);
 	if (fd == -1)
 	{
 		/*
@@ -83,13 +122,15 @@ int initport(int fd)
 
 int32_t comm_init(char *port_name)
 {
+	control_board_session_t *session = comm_get_session();
+
 	if (diagnostic_mode)
 		return 0;
 
-	fd = open_port(port_name);
-	if (0 < fd)
-		initport(fd);
-	return fd;
+	session->fd = open_port(port_name);
+	if (0 < session->fd)
+		initport(session->fd);
+	return session->fd;
 }
 
 int32_t comm_close(void)
@@ -97,10 +138,11 @@ int32_t comm_close(void)
 	if (diagnostic_mode)
 		return 0;
 	else
-		return close(fd);
+		return close(comm_get_session()->fd);
 }
 
-int32_t comm_readline(char *bfr, int32_t count)
+int32_t comm_readline(control_board_session_t *session, char *bfr,
+		int32_t count)
 {
 	int32_t bytes_read = 0;
 	int32_t rx_count = 0;
@@ -108,7 +150,7 @@ int32_t comm_readline(char *bfr, int32_t count)
 
 	do
 	{
-		bytes_read = read(fd, bfr + rx_count, count - rx_count);
+		bytes_read = read(session->fd, bfr + rx_count, count - rx_count);
 		rx_count += bytes_read;
 		if (0 < rx_count)
 			last_byte = bfr[rx_count - 1];
@@ -129,20 +171,20 @@ int32_t comm_readline(char *bfr, int32_t count)
 		return rx_count;
 }
 
-int32_t comm_writeline(char *bfr)
+int32_t comm_writeline(control_board_session_t *session, char *bfr)
 {
 	int32_t ret_val;
-	ret_val = write(fd, bfr, strlen(bfr));
+	ret_val = write(session->fd, bfr, strlen(bfr));
 	if (0 <= ret_val)
-		ret_val = write(fd, "\n", strlen("\n"));
+		ret_val = write(session->fd, "\n", strlen("\n"));
 	return ret_val;
 }
 
-char temp_buffer[256] =
-{ 0 };
-
-int32_t comm_validate_response(char *response, char *send, char *parameters)
+int32_t comm_validate_response(control_board_session_t *session,
+		char *response, char *send, char *parameters)
 {
+	char *temp_buffer = session->temp_buffer;
+
 	if (!strlen(send))
 		return ERR_NONE;
 
@@ -167,14 +209,37 @@ int32_t comm_validate_response(char *response, char *send, char *parameters)
 	return ERR_NONE;
 }
 
-int32_t comm_query(char *parameters, const char *fmt, ...)
+/*!
+ \brief Have observer called after every command sent on session, e.g. to record the traffic.
+
+ The observer runs on the thread that sent the command, with the session locked.
+ */
+void comm_set_observer(control_board_session_t *session,
+		comm_observer_t observer, void *arg)
+{
+	session->observer_arg = arg;
+	session->observer = observer;
+}
+
+static void record_latency(control_board_session_t *session,
+		uint64_t start_time)
+{
+	uint32_t latency = get_tick_count_us() - start_time;
+
+	session->latency.count++;
+	session->latency.last_us = latency;
+	session->latency.total_us += latency;
+	if (latency > session->latency.worst_us)
+		session->latency.worst_us = latency;
+}
+
+static int32_t comm_exchange(control_board_session_t *session,
+		char *parameters)
 {
 	int32_t ret_val;
-	va_list args;
-	va_start(args, fmt);
-	ret_val = vsprintf(tx_buffer, fmt, args);
-	if (0 > ret_val)
-		return ERR_UNKN;
+	uint64_t start_time;
+	char *tx_buffer = session->tx_buffer;
+	char *rx_buffer = session->rx_buffer;
 
 	if (comm_trace)
 		printf("@%u: << %s\n", get_tick_count(), tx_buffer);
@@ -182,11 +247,14 @@ int32_t comm_query(char *parameters, const char *fmt, ...)
 	if (diagnostic_mode)
 		return ERR_NONE;
 
-	ret_val = comm_writeline(tx_buffer);
+	start_time = get_tick_count_us();
+
+	ret_val = comm_writeline(session, tx_buffer);
 	if (0 >= ret_val)
 		return ERR_WRITE;
 
-	ret_val = comm_readline(rx_buffer, sizeof(rx_buffer));
+	ret_val = comm_readline(session, rx_buffer, COMM_BUFFER_SIZE - 1);
+	record_latency(session, start_time);
 	if (0 >= ret_val)
 	{
 		if (comm_trace)
@@ -197,7 +265,76 @@ int32_t comm_query(char *parameters, const char *fmt, ...)
 	if (comm_trace)
 		printf("@%u: >> %s", get_tick_count(), rx_buffer);
 
-	return comm_validate_response(rx_buffer, tx_buffer, parameters);
+	return comm_validate_response(session, rx_buffer, tx_buffer, parameters);
+}
+
+static int32_t comm_transact(control_board_session_t *session,
+		char *parameters)
+{
+	uint32_t count = session->latency.count;
+	int32_t ret_val = comm_exchange(session, parameters);
+
+	if (session->observer)
+		session->observer(session, session->tx_buffer, ret_val,
+				(count != session->latency.count) ?
+						session->latency.last_us : 0);
+	return ret_val;
+}
+
+int32_t comm_query(char *parameters, const char *fmt, ...)
+{
+	control_board_session_t *session = comm_get_session();
+	int32_t ret_val;
+	va_list args;
+
+	pthread_mutex_lock(&session->lock);
+	while (session->priority_waiters)
+		pthread_cond_wait(&session->priority_done, &session->lock);
+
+	va_start(args, fmt);
+	ret_val = vsprintf(session->tx_buffer, fmt, args);
+	va_end(args);
+
+	if (0 > ret_val)
+		ret_val = ERR_UNKN;
+	else
+		ret_val = comm_transact(session, parameters);
+
+	pthread_mutex_unlock(&session->lock);
+	return ret_val;
+}
+
+/*!
+ \brief Send a command to a session ahead of any queued normal command.
+
+ For use from a thread other than the one driving the board, e.g. to stop a car whose control thread
+ has stalled.  A transaction already in progress is completed first, then this command is sent before
+ the owning thread can send another.
+
+ \param parameters receives the parameters of the response, must not be the session's own buffers.
+ */
+int32_t comm_query_priority(control_board_session_t *session, char *parameters,
+		const char *fmt, ...)
+{
+	int32_t ret_val;
+	va_list args;
+
+	__sync_fetch_and_add(&session->priority_waiters, 1);
+	pthread_mutex_lock(&session->lock);
+
+	va_start(args, fmt);
+	ret_val = vsprintf(session->tx_buffer, fmt, args);
+	va_end(args);
+
+	if (0 > ret_val)
+		ret_val = ERR_UNKN;
+	else
+		ret_val = comm_transact(session, parameters);
+
+	if (0 == __sync_sub_and_fetch(&session->priority_waiters, 1))
+		pthread_cond_broadcast(&session->priority_done);
+	pthread_mutex_unlock(&session->lock);
+	return ret_val;
 }
 
 bool get_comm_trace(void)
@@ -8,6 +8,10 @@
 #ifndef COMM_H_
 #define COMM_H_
 
+#include "control_board.h"
+
 int32_t comm_query(char *parameters, const char *fmt, ...);
+int32_t comm_query_priority(control_board_session_t *session, char *parameters,
+		const char *fmt, ...);
 
 #endif /* COMM_H_ */
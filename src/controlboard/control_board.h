@@ -10,9 +10,12 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
 
 #include "hardware.h"
 
+#define COMM_BUFFER_SIZE 256
+
 typedef struct led_flash_status_t
 {
 	StatusLedFlashState_t state;
@@ -25,8 +28,67 @@ typedef struct error_info_t
 	uint32_t timestamp;
 } error_info_t;
 
+typedef struct comm_latency_stats_t
+{
+	uint32_t count;
+	uint32_t last_us;
+	uint32_t worst_us;
+	uint64_t total_us;
+} comm_latency_stats_t;
+
+struct control_board_session_t;
+
+/*!
+ \brief Called after every command sent on a session.
+
+ \param command the command as sent.
+ \param result result of the command, ERR_NONE or an ErrorID_t.
+ \param latency_us round trip of the command, 0 if nothing was received.
+ */
+typedef void (*comm_observer_t)(struct control_board_session_t *session,
+		const char *command, int32_t result, uint32_t latency_us);
+
+/*!
+ \brief State of the connection to one control board.
+
+ Every command operates on the session bound to the calling thread with comm_bind_session(), or on a
+ default session if none was bound.  A process driving several cars binds one session per car thread.
+ */
+typedef struct control_board_session_t
+{
+	pthread_mutex_t lock;
+	pthread_cond_t priority_done; ///< signalled when the last priority query releases the lock
+	volatile int32_t priority_waiters; ///< priority queries waiting for the lock
+	int32_t fd;
+	char tx_buffer[COMM_BUFFER_SIZE];
+	char rx_buffer[COMM_BUFFER_SIZE];
+	char temp_buffer[COMM_BUFFER_SIZE];
+	char params[COMM_BUFFER_SIZE];
+	comm_latency_stats_t latency;
+	comm_observer_t observer;
+	void *observer_arg;
+
+	char lcd_line_text[LCD_TEXT_LINES][COMM_BUFFER_SIZE];
+	int32_t motor_level[NUMBER_OF_MOTOR_CHANNELS];
+	int32_t sensor_values[NUMBER_OF_SENSOR_CHANNELS];
+	bool ir_led_value;
+	led_flash_status_t status_led_status;
+	led_flash_status_t error_led_status;
+	int32_t motor_timeout;
+	uint32_t timestamp;
+	error_info_t last_error;
+	char pgm_info[COMM_BUFFER_SIZE];
+} control_board_session_t;
+
 extern volatile bool timer_flag;
 
+void comm_session_init(control_board_session_t *session);
+void comm_bind_session(control_board_session_t *session);
+control_board_session_t *comm_get_session(void);
+const comm_latency_stats_t *get_comm_latency(void);
+void comm_set_observer(control_board_session_t *session,
+		comm_observer_t observer, void *arg);
+
 char *get_rx_buffer(void);
 char *get_tx_buffer(void);
 
@@ -34,6 +96,8 @@ int32_t comm_init(char *port_name);
 int32_t comm_close(void);
 
 int32_t write_motor_levels(int32_t channel1, int32_t channel2);
+int32_t write_motor_levels_priority(control_board_session_t *session,
+		int32_t channel1, int32_t channel2);
 int32_t read_motor_levels();
 const int32_t *get_motor_levels();
 
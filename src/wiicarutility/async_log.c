@@ -0,0 +1,210 @@
+/*!
+ \file
+
+ \brief Asynchronous logger: records are queued by the caller and formatted on a log thread.
+
+ debug_print() formats and writes on the calling thread, so in _DEBUG builds every print inside the
+ control loop shifts the timing being diagnosed.  debug_log() only copies the format pointer and the
+ integer arguments into a ring owned by the calling thread.  The log thread takes the records out of
+ every ring, formats them and writes them to stdout.
+
+ Each ring has a single producer, its thread, and a single consumer, whoever holds the writer lock, so
+ the producer never takes a lock.  A record that does not fit into a full ring is dropped and counted;
+ the count is reported in the log once the ring has room again.
+
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "timestamp.h"
+#include "async_log.h"
+
+typedef struct async_log_record_t
+{
+	const char *fmt;
+	int32_t args[ASYNC_LOG_MAX_ARGS];
+} async_log_record_t;
+
+typedef struct async_log_ring_t
+{
+	async_log_record_t records[ASYNC_LOG_RING_SIZE];
+	volatile uint32_t head; ///< next record to write, owned by the producer
+	volatile uint32_t tail; ///< next record to read, owned by the consumer
+	volatile uint32_t dropped; ///< written by the producer only
+	uint32_t dropped_reported; ///< owned by the consumer
+	struct async_log_ring_t *next;
+} async_log_ring_t;
+
+/// \brief List of all rings, new rings are pushed at the front.
+static async_log_ring_t * volatile rings = NULL;
+
+/// \brief Held by whoever writes out records.
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#if _DEBUG
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static void create_ring_key(void)
+{
+	pthread_key_create(&ring_key, NULL);
+}
+
+static async_log_ring_t *get_ring(void)
+{
+	async_log_ring_t *ring;
+
+	pthread_once(&ring_key_once, create_ring_key);
+	ring = pthread_getspecific(ring_key);
+	if (NULL != ring)
+		return ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (NULL == ring)
+		return NULL;
+
+	do
+	{
+		ring->next = rings;
+	} while (!__sync_bool_compare_and_swap(&rings, ring->next, ring));
+
+	pthread_setspecific(ring_key, ring);
+	return ring;
+}
+#endif
+
+/*!
+ \brief Queue a record, use debug_log() rather than calling this directly.
+
+ Expects at least ASYNC_LOG_MAX_ARGS integer arguments after fmt, debug_log() pads them with zeros.
+ */
+void async_log_push(const char *fmt, ...)
+{
+#if _DEBUG
+	async_log_ring_t *ring = get_ring();
+	async_log_record_t *record;
+	uint32_t head;
+	va_list args;
+	uint8_t i;
+
+	if (NULL == ring)
+		return;
+
+	head = ring->head;
+	if (head - ring->tail >= ASYNC_LOG_RING_SIZE)
+	{
+		ring->dropped++;
+		return;
+	}
+
+	record = &ring->records[head % ASYNC_LOG_RING_SIZE];
+	record->fmt = fmt;
+	va_start(args, fmt);
+	for (i = 0; i < ASYNC_LOG_MAX_ARGS; i++)
+		record->args[i] = va_arg(args, int32_t);
+	va_end(args);
+
+	// the record must be complete before the consumer can see it
+	__sync_synchronize();
+	ring->head = head + 1;
+#endif
+}
+
+static void write_ring(async_log_ring_t *ring)
+{
+	async_log_record_t *record;
+	uint32_t tail = ring->tail;
+	uint32_t head = ring->head;
+	uint32_t dropped;
+
+	// read the records only after the head that publishes them
+	__sync_synchronize();
+
+	for (; tail != head; tail++)
+	{
+		record = &ring->records[tail % ASYNC_LOG_RING_SIZE];
+		printf(record->fmt, record->args[0], record->args[1], record->args[2],
+				record->args[3], record->args[4], record->args[5]);
+	}
+
+	// the slots may only be reused once they have been read
+	__sync_synchronize();
+	ring->tail = tail;
+
+	dropped = ring->dropped;
+	if (dropped != ring->dropped_reported)
+	{
+		printf("@%u: %u log records dropped\n", get_tick_count(),
+				dropped - ring->dropped_reported);
+		ring->dropped_reported = dropped;
+	}
+}
+
+/*!
+ \brief Write out every queued record, from the calling thread.
+
+ Used at shutdown, so the last records are not lost with the log thread.
+ */
+void async_log_flush(void)
+{
+	async_log_ring_t *ring;
+
+	pthread_mutex_lock(&writer_lock);
+	for (ring = rings; NULL != ring; ring = ring->next)
+		write_ring(ring);
+	fflush(stdout);
+	pthread_mutex_unlock(&writer_lock);
+}
+
+#if _DEBUG
+static void *async_log_thread(void *arg)
+{
+	for (;;)
+	{
+		usleep(ASYNC_LOG_WRITE_PERIOD_US);
+		async_log_flush();
+	}
+	return NULL;
+}
+#endif
+
+/*!
+ \brief Start the log thread.
+
+ Does nothing unless built with _DEBUG, since debug_log() queues nothing then.
+
+ \return int32_t 0 on success, otherwise the error from pthread_create.
+ */
+int32_t async_log_start(void)
+{
+#if _DEBUG
+	pthread_t thread;
+	int32_t ret_val;
+
+	ret_val = pthread_create(&thread, NULL, async_log_thread, NULL);
+	if (0 == ret_val)
+		pthread_detach(thread);
+	return ret_val;
+#else
+	return 0;
+#endif
+}
+
+/*!
+ \brief Total number of records dropped because a ring was full.
+ */
+uint32_t async_log_get_dropped(void)
+{
+	async_log_ring_t *ring;
+	uint32_t dropped = 0;
+
+	for (ring = rings; NULL != ring; ring = ring->next)
+		dropped += ring->dropped;
+	return dropped;
+}
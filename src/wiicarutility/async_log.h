@@ -0,0 +1,36 @@
+/*!
+ \file
+
+ \brief Logging that does not block the calling thread.
+
+ */
+
+#ifndef ASYNC_LOG_H_
+#define ASYNC_LOG_H_
+
+#include <stdint.h>
+
+/// \brief Most arguments one record can carry.
+#define ASYNC_LOG_MAX_ARGS 6
+
+/// \brief Records each thread can queue before further records are dropped.
+#define ASYNC_LOG_RING_SIZE 256
+
+/// \brief Period at which the log thread writes out the queued records.
+#define ASYNC_LOG_WRITE_PERIOD_US (20 * 1000)
+
+/*!
+ \brief Queue a log record, like debug_print() but without formatting or writing on the calling thread.
+
+ The format must be a string literal and may only convert integers (%d, %u, %x, %c...), at most
+ ASYNC_LOG_MAX_ARGS of them.
+ */
+#define debug_log(...) async_log_push(__VA_ARGS__, 0, 0, 0, 0, 0, 0)
+
+void async_log_push(const char *fmt, ...);
+
+int32_t async_log_start(void);
+void async_log_flush(void);
+uint32_t async_log_get_dropped(void);
+
+#endif /* ASYNC_LOG_H_ */
@@ -79,6 +79,12 @@ void format_error_string(ErrorID_t error_code, char *error_string)
 	case ERR_PORT_INIT:
 		strcpy(error_string, "Could not open comm port");
 		break;
+	case WII_ERROR_DISCONNECTED:
+		strcpy(error_string, "Wiimote disconnected");
+		break;
+	case WII_ERROR_CONTROL_STALL:
+		strcpy(error_string, "Control loop stalled");
+		break;
 	default:
 		strcpy(error_string, "Unknown error");
 		break;
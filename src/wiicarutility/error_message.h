@@ -35,6 +35,8 @@ typedef enum ErrorID_t {
 	WII_ERROR_MOTOR_COMMAND_ERROR = -5004,
 	WII_ERROR_SENSOR_ERROR = -5005,
 	WII_ERROR_QUEUE_ERROR = -5006,
+	WII_ERROR_DISCONNECTED = -5007,
+	WII_ERROR_CONTROL_STALL = -5008,
 } ErrorID_t;
 
 int32_t decode_error_response(char *response);
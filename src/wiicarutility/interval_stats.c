@@ -0,0 +1,86 @@
+/*!
+ \file
+
+ \brief Mean, jitter and worst of a stream of intervals, accumulated in integers.
+
+ Adding an interval is two additions and a multiplication in 64 bits, there is no floating point
+ in it for the targets without an FPU.  The jitter is the standard deviation, worked out from the
+ sums only when it is asked for.
+
+ An interval longer than INTERVAL_STATS_MAX_US, a stall rather than jitter, is taken as that long in
+ the sums.  That keeps the sum of the squares within 64 bits for any count of ordinary intervals and
+ for 65536 of the longest.
+
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "interval_stats.h"
+
+void interval_stats_reset(interval_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+
+void interval_stats_add(interval_stats_t *stats, uint32_t interval_us)
+{
+	uint64_t capped = (interval_us > INTERVAL_STATS_MAX_US) ?
+			INTERVAL_STATS_MAX_US : interval_us;
+
+	stats->count++;
+	stats->total_us += capped;
+	stats->square_total += capped * capped;
+	if (interval_us > stats->worst_us)
+		stats->worst_us = interval_us;
+}
+
+/*!
+ \brief Square root rounded down, bit by bit.
+ */
+static uint32_t interval_stats_sqrt(uint64_t x)
+{
+	uint64_t root = 0;
+	uint64_t bit = 1ULL << 62;
+
+	while (bit > x)
+		bit >>= 2;
+
+	while (bit)
+	{
+		if (x >= root + bit)
+		{
+			x -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+			root >>= 1;
+		bit >>= 2;
+	}
+	return root;
+}
+
+/*!
+ \brief The mean and the jitter of the intervals added, both rounded down, 0 if there are none.
+
+ With total = q * count + r, the sum of the squared deviations from the mean is
+ square_total - q * q * count - 2 * q * r - r * r / count, none of which can exceed square_total.
+ */
+void interval_stats_summary(const interval_stats_t *stats, uint32_t *mean_us,
+		uint32_t *jitter_us)
+{
+	uint64_t q, r, deviation;
+
+	*mean_us = 0;
+	*jitter_us = 0;
+	if (0 == stats->count)
+		return;
+
+	q = stats->total_us / stats->count;
+	r = stats->total_us % stats->count;
+	deviation = stats->square_total - q * q * stats->count - 2 * q * r - r * r
+			/ stats->count;
+
+	*mean_us = q;
+	*jitter_us = interval_stats_sqrt(deviation / stats->count);
+}
@@ -0,0 +1,29 @@
+/*!
+ \file
+
+ \brief Mean, jitter and worst of a stream of intervals, accumulated in integers.
+
+ */
+
+#ifndef INTERVAL_STATS_H_
+#define INTERVAL_STATS_H_
+
+#include <stdint.h>
+
+/// \brief Longest interval taken into the mean and jitter, about 16 s; the worst is kept exact.
+#define INTERVAL_STATS_MAX_US (1UL << 24)
+
+typedef struct interval_stats_t
+{
+	uint32_t count; ///< number of intervals added
+	uint64_t total_us; ///< sum of the intervals, each at most INTERVAL_STATS_MAX_US
+	uint64_t square_total; ///< sum of the squared intervals, in us^2
+	uint32_t worst_us;
+} interval_stats_t;
+
+void interval_stats_reset(interval_stats_t *stats);
+void interval_stats_add(interval_stats_t *stats, uint32_t interval_us);
+void interval_stats_summary(const interval_stats_t *stats, uint32_t *mean_us,
+		uint32_t *jitter_us);
+
+#endif /* INTERVAL_STATS_H_ */
@@ -0,0 +1,175 @@
+/*!
+ \file
+
+ \brief Jerk limited motion profile of a motor level, stepped at the time of each command.
+
+ Instead of jumping to the commanded target the level moves towards it at no more than the rate
+ limit, and the rate itself changes by no more than the rate change limit.  Coming up to the target
+ the rate is brought down so the level stops on the target rather than past it: from a distance d
+ the rate can be at most sqrt(2 * rate_change * d).
+
+ The profile is stepped by the time between commands rather than per command, so the trajectory of
+ the level does not depend on how often the commands come.  Time is counted in 2^MOTION_TIME_BITS
+ us, which makes a step multiplications and shifts; the limits are converted once, at
+ motion_axis_init().
+
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "motion_profile.h"
+
+/*!
+ \brief Set up an axis at a level, e.g. the level the motor is at.
+
+ \param limits converted and kept, motion_axis_init() again to change them.
+ */
+void motion_axis_init(motion_axis_t *axis, const motion_limits_t *limits,
+		int32_t level)
+{
+	const double per_second = (double) (1 << MOTION_TIME_BITS) / 1000000;
+
+	axis->rate_limit = limits->rate * per_second * (1 << MOTION_LEVEL_BITS);
+	axis->rate_change_limit = limits->rate_change * per_second * per_second
+			* (1 << MOTION_LEVEL_BITS);
+	motion_axis_reset(axis, level);
+}
+
+/*!
+ \brief Put the axis at a level at rest, e.g. when the motor has been stopped without it.
+ */
+void motion_axis_reset(motion_axis_t *axis, int32_t level)
+{
+	axis->started = false;
+	axis->time_us = 0;
+	axis->level = (int64_t) level << MOTION_LEVEL_BITS;
+	axis->rate = 0;
+}
+
+/*!
+ \brief Integer square root, rounded down, as fixed_sqrt() of the car but of 64 bits.
+ */
+static uint64_t motion_isqrt(uint64_t x)
+{
+	uint64_t root = 0;
+	uint64_t bit, trial, mask;
+
+	if (0 == x)
+		return 0;
+
+	// highest even bit position not above the top bit of x
+	bit = (uint64_t) 1 << ((63 - __builtin_clzll(x)) & ~1);
+
+	while (bit)
+	{
+		trial = root + bit;
+		mask = -(uint64_t) (x >= trial);
+		x -= trial & mask;
+		root = (root >> 1) + (bit & mask);
+		bit >>= 2;
+	}
+	return root;
+}
+
+/*!
+ \brief Step the axis to the time of a command towards its target.
+
+ The first step after motion_axis_init() or motion_axis_reset() only takes the time, the level does
+ not move yet.
+
+ \param time_us time of the command.
+ \return int32_t level to command.
+ */
+int32_t motion_axis_step(motion_axis_t *axis, uint64_t time_us,
+		int32_t target)
+{
+	const int64_t goal = (int64_t) target << MOTION_LEVEL_BITS;
+	int64_t error = goal - axis->level;
+	int64_t desired, step, rate = axis->rate;
+	uint32_t dt = 0;
+
+	if (axis->started && (time_us > axis->time_us))
+		dt = (time_us - axis->time_us > MOTION_MAX_DT_US) ? MOTION_MAX_DT_US
+				: time_us - axis->time_us;
+	axis->started = true;
+	axis->time_us = time_us;
+
+	if (((0 == axis->rate_limit) && (0 == axis->rate_change_limit)) || ((0
+			== error) && (0 == axis->rate)))
+	{
+		axis->level = goal;
+		axis->rate = 0;
+		return target;
+	}
+
+	// the fastest rate that still stops on the target, the square root only taken below the limit
+	desired = axis->rate_limit ? axis->rate_limit : INT64_MAX;
+	if (axis->rate_change_limit)
+	{
+		step = 2 * (uint64_t) axis->rate_change_limit * (uint64_t) llabs(error);
+		if ((0 == axis->rate_limit) || ((uint64_t) step < (uint64_t) desired
+				* (uint64_t) desired))
+			desired = motion_isqrt(step);
+	}
+	if (error < 0)
+		desired = -desired;
+	else if (0 == error)
+		desired = 0;
+
+	if (axis->rate_change_limit)
+	{
+		step = (axis->rate_change_limit * dt) >> MOTION_TIME_BITS;
+		if (desired > axis->rate + step)
+			axis->rate += step;
+		else if (desired < axis->rate - step)
+			axis->rate -= step;
+		else
+			axis->rate = desired;
+	}
+	else
+		axis->rate = desired;
+
+	// the rate changed evenly over the step
+	axis->level += ((rate + axis->rate) * dt) >> (MOTION_TIME_BITS + 1);
+	if (((error > 0) && (axis->level >= goal)) || ((error < 0)
+			&& (axis->level <= goal)))
+	{
+		axis->level = goal;
+		axis->rate = 0;
+	}
+
+	return (axis->level + (1 << (MOTION_LEVEL_BITS - 1))) >> MOTION_LEVEL_BITS;
+}
+
+/*!
+ \brief Parse limits given as "rate,rate_change", e.g. "1024,8192", rate_change may be left out.
+
+ \return bool false if the text is not valid.
+ */
+bool motion_parse_limits(const char *text, motion_limits_t *limits)
+{
+	int32_t *limit[2] =
+	{ &limits->rate, &limits->rate_change };
+	const char *next = text;
+	char *end;
+	long value;
+	uint8_t i;
+
+	limits->rate = limits->rate_change = 0;
+	for (i = 0; i < 2; i++)
+	{
+		value = strtol(next, &end, 10);
+		if ((end == next) || (value < 0) || (value > MOTION_MAX_LIMIT))
+			return false;
+		*limit[i] = value;
+
+		if ('\0' == *end)
+			return true;
+		if (',' != *end)
+			return false;
+		next = end + 1;
+	}
+	return false;
+}
@@ -0,0 +1,55 @@
+/*!
+ \file
+
+ \brief Jerk limited motion profile of a motor level, stepped at the time of each command.
+
+ */
+
+#ifndef MOTION_PROFILE_H_
+#define MOTION_PROFILE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// \brief Fraction bits of the level and of its rate.
+#define MOTION_LEVEL_BITS 16
+
+/// \brief Rates are per 2^MOTION_TIME_BITS us, about a second, so a step needs no division.
+#define MOTION_TIME_BITS 20
+
+/// \brief Longest step taken, a longer gap between commands is taken as this long.
+#define MOTION_MAX_DT_US 250000
+
+/// \brief Largest limit, keeps the products of a step within 64 bits.
+#define MOTION_MAX_LIMIT 32767
+
+/*!
+ \brief Limits of a level, 0 leaves that limit off.
+
+ For a speed level these are its acceleration, in levels per second, and its jerk, in levels per
+ second squared.
+ */
+typedef struct motion_limits_t
+{
+	int32_t rate; ///< largest change of the level, per second
+	int32_t rate_change; ///< largest change of the rate, per second
+} motion_limits_t;
+
+typedef struct motion_axis_t
+{
+	int64_t rate_limit; ///< MOTION_LEVEL_BITS fraction bits, per 2^MOTION_TIME_BITS us
+	int64_t rate_change_limit; ///< per 2^MOTION_TIME_BITS us squared
+	bool started; ///< time_us is set
+	uint64_t time_us; ///< time of the last step
+	int64_t level; ///< MOTION_LEVEL_BITS fraction bits
+	int64_t rate; ///< MOTION_LEVEL_BITS fraction bits, per 2^MOTION_TIME_BITS us
+} motion_axis_t;
+
+void motion_axis_init(motion_axis_t *axis, const motion_limits_t *limits,
+		int32_t level);
+void motion_axis_reset(motion_axis_t *axis, int32_t level);
+int32_t motion_axis_step(motion_axis_t *axis, uint64_t time_us,
+		int32_t target);
+bool motion_parse_limits(const char *text, motion_limits_t *limits);
+
+#endif /* MOTION_PROFILE_H_ */
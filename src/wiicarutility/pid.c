@@ -0,0 +1,131 @@
+/*!
+ \file
+
+ \brief Fixed point PID controller, stepped at the time of each measurement.
+
+ The controller is time based: the integral grows with the time between measurements and the
+ derivative is the change over that time, so a dropped frame does not change the gains.  Time is
+ counted in 2^PID_TIME_BITS us, which makes the integral a multiplication and a shift; only the
+ derivative divides.
+
+ The derivative is taken of the measurement rather than of the error, so a step of the setpoint does
+ not kick the output.  Against windup the integral is kept within the output range, and it does not
+ grow while the output is saturated in the direction of the error.
+
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "pid.h"
+
+/*!
+ \brief Set up a controller, it starts from the next measurement.
+
+ \param gains copied, pid_init() again to change them.
+ */
+void pid_init(pid_controller_t *pid, const pid_gains_t *gains,
+		int32_t output_min, int32_t output_max)
+{
+	pid->gains = *gains;
+	pid->output_min = output_min;
+	pid->output_max = output_max;
+	pid_reset(pid);
+}
+
+/*!
+ \brief Forget the integral and the last measurement.
+ */
+void pid_reset(pid_controller_t *pid)
+{
+	pid->primed = false;
+	pid->time_us = 0;
+	pid->last_measurement = 0;
+	pid->integral = 0;
+}
+
+static int64_t pid_clamp(int64_t x, int64_t min, int64_t max)
+{
+	if (x < min)
+		return min;
+	if (x > max)
+		return max;
+	return x;
+}
+
+/*!
+ \brief Step the controller to a new measurement.
+
+ The first measurement after pid_init() or pid_reset() has no derivative and adds nothing to the
+ integral, there is no time step yet.
+
+ \param time_us time of the measurement, e.g. of the frame it was taken from.
+ \return int32_t output, within the output range.
+ */
+int32_t pid_update(pid_controller_t *pid, uint64_t time_us, int32_t setpoint,
+		int32_t measurement)
+{
+	const int64_t min = (int64_t) pid->output_min << PID_GAIN_BITS;
+	const int64_t max = (int64_t) pid->output_max << PID_GAIN_BITS;
+	int32_t error = setpoint - measurement;
+	int64_t proportional, derivative = 0, output;
+	uint32_t dt = 0;
+
+	if (pid->primed && (time_us > pid->time_us))
+		dt = (time_us - pid->time_us > PID_MAX_DT_US) ? PID_MAX_DT_US
+				: time_us - pid->time_us;
+
+	proportional = (int64_t) pid->gains.kp * error;
+	if (pid->primed && pid->gains.kd)
+		derivative = -(((int64_t) pid->gains.kd * (measurement
+				- pid->last_measurement)) << PID_TIME_BITS) / ((dt
+				< PID_MIN_DT_US) ? PID_MIN_DT_US : dt);
+
+	// conditional integration: not further into a saturated output
+	output = proportional + pid->integral + derivative;
+	if (pid->gains.ki && !((output >= max) && (error > 0)) && !((output <= min)
+			&& (error < 0)))
+		pid->integral = pid_clamp(pid->integral + (((int64_t) pid->gains.ki
+				* error * dt) >> PID_TIME_BITS), min, max);
+
+	output = proportional + pid->integral + derivative;
+
+	pid->primed = true;
+	pid->time_us = time_us;
+	pid->last_measurement = measurement;
+
+	return pid_clamp((output + (1 << (PID_GAIN_BITS - 1))) >> PID_GAIN_BITS,
+			pid->output_min, pid->output_max);
+}
+
+/*!
+ \brief Parse gains given as "kp,ki,kd", e.g. "1.5,0,0.2", ki and kd may be left out.
+
+ \return bool false if the text is not valid.
+ */
+bool pid_parse_gains(const char *text, pid_gains_t *gains)
+{
+	int32_t *gain[3] =
+	{ &gains->kp, &gains->ki, &gains->kd };
+	const char *next = text;
+	char *end;
+	double value;
+	uint8_t i;
+
+	gains->kp = gains->ki = gains->kd = 0;
+	for (i = 0; i < 3; i++)
+	{
+		value = strtod(next, &end);
+		if ((end == next) || (value < 0) || (value > PID_MAX_GAIN))
+			return false;
+		*gain[i] = value * (1 << PID_GAIN_BITS) + 0.5;
+
+		if ('\0' == *end)
+			return true;
+		if (',' != *end)
+			return false;
+		next = end + 1;
+	}
+	return false;
+}
@@ -0,0 +1,60 @@
+/*!
+ \file
+
+ \brief Fixed point PID controller, stepped at the time of each measurement.
+
+ */
+
+#ifndef PID_H_
+#define PID_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// \brief Fraction bits of the gains and of the integral.
+#define PID_GAIN_BITS 8
+
+/// \brief Rates are per 2^PID_TIME_BITS us, about a second, so the integral needs no division.
+#define PID_TIME_BITS 20
+
+/// \brief Largest gain, keeps the products of the controller within 64 bits.
+#define PID_MAX_GAIN 4096
+
+/// \brief Steps closer than this are taken as this far apart for the derivative.
+#define PID_MIN_DT_US 1000
+
+/// \brief Longest step integrated, a longer gap is taken as this long.
+#define PID_MAX_DT_US 250000
+
+/*!
+ \brief Gains, with PID_GAIN_BITS fraction bits.
+
+ kp is output per unit of error, ki output per unit of error and 2^PID_TIME_BITS us, kd output per
+ unit of change of the measurement in 2^PID_TIME_BITS us.
+ */
+typedef struct pid_gains_t
+{
+	int32_t kp;
+	int32_t ki;
+	int32_t kd;
+} pid_gains_t;
+
+typedef struct pid_controller_t
+{
+	pid_gains_t gains;
+	int32_t output_min;
+	int32_t output_max;
+	bool primed; ///< time_us and last_measurement are set
+	uint64_t time_us; ///< time of the last update
+	int32_t last_measurement;
+	int64_t integral; ///< in output units, PID_GAIN_BITS fraction bits
+} pid_controller_t;
+
+void pid_init(pid_controller_t *pid, const pid_gains_t *gains,
+		int32_t output_min, int32_t output_max);
+void pid_reset(pid_controller_t *pid);
+int32_t pid_update(pid_controller_t *pid, uint64_t time_us, int32_t setpoint,
+		int32_t measurement);
+bool pid_parse_gains(const char *text, pid_gains_t *gains);
+
+#endif /* PID_H_ */
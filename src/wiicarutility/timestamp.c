@@ -9,8 +9,10 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <sys/time.h>
+#include <time.h>
 
 uint64_t start_time = 0;
+uint64_t start_time_us = 0;
 
 static uint64_t timeval_to_ms(struct timeval *tv)
 {
@@ -24,9 +26,17 @@ static uint64_t get_raw_ms(void)
 	return timeval_to_ms(&tv);
 }
 
+static uint64_t get_raw_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 void init_tick_count(void)
 {
 	start_time = get_raw_ms();
+	start_time_us = get_raw_us();
 }
 
 uint32_t get_tick_count(void)
@@ -34,6 +44,16 @@ uint32_t get_tick_count(void)
 	return get_raw_ms() - start_time;
 }
 
+/*!
+ \brief Monotonic microsecond tick count, for measuring latencies.
+
+ Unlike get_tick_count() this is not affected by changes to the wall clock.
+ */
+uint64_t get_tick_count_us(void)
+{
+	return get_raw_us() - start_time_us;
+}
+
 bool check_for_timeout(uint32_t current_time, uint32_t start_time, int32_t timeout)
 {
 	if (timeout < 0)
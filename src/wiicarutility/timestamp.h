@@ -13,6 +13,7 @@
 
 void init_tick_count(void);
 uint32_t get_tick_count(void);
+uint64_t get_tick_count_us(void);
 
 bool check_for_timeout(uint32_t current_time, uint32_t start_time, int32_t timeout);
 
@@ -9,6 +9,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <cwiid.h>
 #include <unistd.h>
 #if _MUTEX_ENABLE
@@ -21,6 +22,7 @@
 #include <wiicarutility/timestamp.h>
 #include <wiicarutility/error_message.h>
 #include <wiicarutility/utility.h>
+#include <wiicarutility/async_log.h>
 #include <controlboard/control_board.h>
 #if HAVE_GTK
 #include <wiicargui/wiicargui.h>
@@ -29,25 +31,29 @@
 #include <config.h>
 
 #include "wiicar.h"
+#include "wiicar_math.h"
+#include "wiicar_realtime.h"
+#include "wiimote_frame.h"
+#include "flight_recorder.h"
+#include "control_law.h"
+#include "wiicar_obstacle.h"
 #include "ControlTasks.h"
 
 
 cwiid_mesg_callback_t cwiid_callback;
 
-cwiid_wiimote_t *wiimote = NULL;
+/// \brief One context per car, indexed by the order of the ports on the command line.
+static WiiCarContext_t cars[WIICAR_MAX_CARS];
+static int32_t car_count = 0;
 
-WiimoteStatusDataType wiimote_status_data =
-{ 0 };
+/// \brief Serialises inquiries, so two cars searching at once do not race for the same wiimote.
+static pthread_mutex_t discovery_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-/// \bug Mutexes cause segmentation fault in OpenWRT
-#if _MUTEX_ENABLE
-pthread_cond_t cond =
-PTHREAD_COND_INITIALIZER;
-pthread_mutex_t mutex =
-PTHREAD_MUTEX_INITIALIZER;
-#else
-volatile bool wiimote_data_ready = false;
-#endif
+/// \brief The thread running control_tasks(), the one that joins the car threads and exits.
+static pthread_t main_thread;
+
+/// \brief Exit status requested by shutdown_application().
+static volatile int32_t exit_status = 0;
 
 const struct acc_cal DefaultAccelCalData =
 { //
@@ -62,6 +68,9 @@ const struct acc_cal DefaultAccelCalData =
 
 #define INFINITE_TIMEOUT -1
 
+/// \brief Period at which wait_for_wiimotedata() polls for new data.
+#define WIIMOTE_DATA_POLL_PERIOD_US (25 * 1000)
+
 volatile bool debug_active = false;
 
 #define MENU \
@@ -84,23 +93,34 @@ const char *lcd_menu_strings[MENU_ENTRIES] =
 		"hm - restart", //
 		};
 
-static ErrorID_t shutdown_all(cwiid_wiimote_t *wiimote);
-static ErrorID_t main_menu(cwiid_wiimote_t *wiimote,
-		volatile WiimoteStatusDataType *wiimote_status);
-static ErrorID_t infrared_mode(cwiid_wiimote_t *wiimote,
-		volatile WiimoteStatusDataType *wiimote_status);
-static ErrorID_t acceleration_mode(cwiid_wiimote_t *wiimote,
-		volatile WiimoteStatusDataType *wiimote_status);
-static ErrorID_t button_mode(cwiid_wiimote_t *wiimote,
-		volatile WiimoteStatusDataType *wiimote_status);
-ErrorID_t error_mode(cwiid_wiimote_t *wiimote,
-		volatile WiimoteStatusDataType *wiimote_status);
-static ErrorID_t wait_for_wiimotedata(
-		volatile WiimoteStatusDataType *wiimote_status, int32_t timeout);
-static ErrorID_t signal_wiimote_data_ready(
-		volatile WiimoteStatusDataType *wiimote_status, int32_t timeout);
-
-int32_t sensor_cutoff_fwd, sensor_cutoff_rev;
+static ErrorID_t shutdown_all(WiiCarContext_t *car);
+static void release_wiimote(WiiCarContext_t *car);
+static void finish_application(void);
+static ErrorID_t main_menu(WiiCarContext_t *car);
+static ErrorID_t infrared_mode(WiiCarContext_t *car);
+static ErrorID_t acceleration_mode(WiiCarContext_t *car);
+static ErrorID_t button_mode(WiiCarContext_t *car);
+ErrorID_t error_mode(WiiCarContext_t *car, ErrorID_t error);
+
+/*!
+ \brief A mode of the main menu, entered when any of its buttons is pressed.
+ */
+typedef struct WiicarDriveMode_t
+{
+	uint16_t buttons;
+	ErrorID_t (*run)(WiiCarContext_t *car);
+} WiicarDriveMode_t;
+
+/// \brief The modes main_menu() offers, a new mode only needs its entry here.
+static const WiicarDriveMode_t drive_modes[] =
+{
+{ CWIID_BTN_A, acceleration_mode },
+{ CWIID_BTN_B, infrared_mode },
+{ CWIID_BTN_2 | CWIID_BTN_1, button_mode } };
+
+#define DRIVE_MODE_COUNT (sizeof(drive_modes) / sizeof(drive_modes[0]))
+static ErrorID_t wait_for_wiimotedata(WiiCarContext_t *car, int32_t timeout);
+static ErrorID_t signal_wiimote_data_ready(WiiCarContext_t *car);
 
 cwiid_err_t err;
 
@@ -117,42 +137,78 @@ void err(cwiid_wiimote_t *wiimote, const char *s, va_list ap)
 }
 
 /*!
- @brief High level task for wiimote.
+ \brief Open a connection to the car's wiimote.
 
- Handles initializing wiimote.
+ The first connection of a car searches for any wiimote in discoverable mode, later connections go
+ straight back to the same wiimote.  The address is kept only once the connection is open, a wiimote
+ found but not connected may be taken by another car.  After WIICAR_RECONNECT_ATTEMPTS failed
+ connections to the same wiimote the car searches again, so another wiimote can take its place.
  */
-void control_tasks(char *dev_name)
+static cwiid_wiimote_t *connect_wiimote(WiiCarContext_t *car)
 {
-	WiimoteState_t WiimoteState = WII_PROMPT;
-	bdaddr_t bdaddr = *BDADDR_ANY; /* bluetooth device address */
+	cwiid_wiimote_t *wiimote;
+	bdaddr_t bdaddr = car->bdaddr;
+	bool discover = (0 == bacmp(&bdaddr, BDADDR_ANY));
 
-	init_tick_count();
+	if (discover)
+		pthread_mutex_lock(&discovery_mutex);
+	wiimote = cwiid_open(&bdaddr, 0);
+	if (discover)
+		pthread_mutex_unlock(&discovery_mutex);
 
-#if _MUTEX_ENABLE
-	pthread_mutex_lock(&mutex);
-#endif
+	if (wiimote)
+	{
+		car->bdaddr = bdaddr;
+		car->reconnect_failures = 0;
+	}
+	else if (!discover && (++car->reconnect_failures
+			>= WIICAR_RECONNECT_ATTEMPTS))
+	{
+		fprintf(stderr,
+				"@%u: Car %d: last wiimote not found, searching for any wiimote\n",
+				get_tick_count(), car->index);
+		car->bdaddr = *BDADDR_ANY;
+		car->reconnect_failures = 0;
+	}
 
-#if HAVE_GTK
-	int argc_dummy = 0;
-	char **argv_dummy = NULL;
-	init_gui(argc_dummy, argv_dummy);
+	return wiimote;
+}
 
-	set_comm_trace(true);
-	set_diagnostic_mode(true);
-#else
-	if (0 >= comm_init(dev_name))
+/*!
+ @brief High level task for one car.
+
+ Handles initializing the car's control board and wiimote.  Runs on its own thread, real-time when
+ real-time mode has been enabled with realtime_configure().
+
+ Whatever happens to one car stays with it: if its control board cannot be opened its thread ends,
+ if its wiimote fails or its user presses Home the car is stopped, its wiimote released and it goes
+ back to the prompt.  Only shutdown_application() ends every car, the thread returns once its stop
+ flag is set, leaving the wiimote and the board to shutdown_application().
+ */
+static void *car_thread(void *arg)
+{
+	WiiCarContext_t *car = arg;
+	cwiid_wiimote_t *wiimote;
+	ErrorID_t error;
+
+	comm_bind_session(&car->session);
+
+#if !HAVE_GTK
+	if (0 >= comm_init(car->dev_name))
 	{
-		debug_print("@%u: Cannot initialize %s\n", get_tick_count(), dev_name);
-		exit(4);
+		fprintf(stderr, "@%u: Car %d: cannot initialize %s\n",
+				get_tick_count(), car->index, car->dev_name);
+		car->exit_code = 4;
+		return NULL;
 	}
 	else
 	{
-		debug_print("@%u: %s initialized.\n", get_tick_count(), dev_name);
+		debug_print("@%u: %s initialized.\n", get_tick_count(), car->dev_name);
 	}
 
 	do
 	{
-		debug_print("Connecting to controller board... ");
+		debug_print("Connecting to controller board %s... ", car->dev_name);
 		if (0 > send_password("WIFIBOT123"))
 		{
 			debug_print("Error\n");
@@ -162,9 +218,16 @@ void control_tasks(char *dev_name)
 			debug_print("Done\n");
 			break;
 		}
-	}while (1);
+	}while (!car->stop);
 
 #endif
+	car->board_open = true;
+	if (car->stop)
+		return NULL;
+
+	if (obstacle_guard_start(&car->obstacles, car->index))
+		fprintf(stderr, "Unable to start sensor poller for %s\n",
+				car->dev_name);
 
 	set_lcd(0, "%s", PACKAGE_NAME);
 	set_lcd(1, "Rev: %s", PACKAGE_VERSION);
@@ -172,56 +235,207 @@ void control_tasks(char *dev_name)
 	// display startup for 1 s
 	sleep(1);
 
-	cwiid_set_err(err);
-
-	for (;;)
+	while (!car->stop)
 	{
 
-		switch (WiimoteState)
+		switch (car->state)
 		{
 		case WII_PROMPT:
 			/* Connect to the wiimote */
 			debug_print(
-					"Put Wiimote in discoverable mode now (press 1+2)...\n");
+					"Car %d: put Wiimote in discoverable mode now (press 1+2)...\n",
+					car->index);
 
 			set_lcd(0, "Connecting...");
 			set_lcd(1, "Press 1+2 now");
-			WiimoteState = WII_WAIT_FOR_CONNECTION;
+			car->state = WII_WAIT_FOR_CONNECTION;
 			break;
 		case WII_WAIT_FOR_CONNECTION:
-			if (!(wiimote = cwiid_open(&bdaddr, 0)))
+			if (!(wiimote = connect_wiimote(car)))
 			{
 				fprintf(stderr, "Unable to connect to wiimote, retrying...\n");
-				WiimoteState = WII_PROMPT;
+				car->state = WII_PROMPT;
+				break;
 			}
-			else if (cwiid_set_mesg_callback(wiimote, cwiid_callback))
+
+			// the dispatcher must find the car before the first message arrives
+			car->wiimote_id = cwiid_get_id(wiimote);
+			car->wiimote = wiimote;
+			wiimote_output_init(&car->output, wiimote);
+			if (cwiid_set_mesg_callback(wiimote, cwiid_callback))
 			{
 				fprintf(stderr,
 						"Unable to set message callback, retrying...\n");
-				WiimoteState = WII_PROMPT;
+				cwiid_close(wiimote);
+				car->wiimote = NULL;
+				car->wiimote_id = -1;
+				car->state = WII_PROMPT;
 			}
 			else
 			{
-				WiimoteState = WII_OPERATE;
+				if (car->disconnected)
+				{
+					fprintf(stderr,
+							"@%u: Car %d: wiimote reconnected after %u ms\n",
+							get_tick_count(), car->index,
+							(uint32_t) ((get_tick_count_us()
+									- car->disconnect_time) / 1000));
+					car->disconnected = false;
+				}
+				car->state = WII_OPERATE;
 			}
 			break;
 		case WII_OPERATE:
 		default:
-			main_menu(wiimote, &wiimote_status_data);
-			debug_print("exiting.\n");
-			shutdown_application(0);
+			error = main_menu(car);
+			if (car->stop)
+				break;
+			if (car->disconnected)
+			{
+				// keep the board session, calibration and bdaddr, go straight back to the same wiimote
+				release_wiimote(car);
+				fprintf(stderr,
+						"@%u: Car %d: wiimote disconnected, reconnecting...\n",
+						get_tick_count(), car->index);
+				set_lcd(0, "Reconnecting...");
+				set_lcd(1, "Press 1+2 now");
+				car->state = WII_WAIT_FOR_CONNECTION;
+				break;
+			}
+			release_wiimote(car);
+			if (WII_ERROR_ABORT_PRESSED == error)
+			{
+				// restart: any wiimote may connect, not only the last one
+				fprintf(stderr, "@%u: Car %d: restarting\n", get_tick_count(),
+						car->index);
+				car->bdaddr = *BDADDR_ANY;
+			}
+			else
+				fprintf(stderr, "@%u: Car %d: wiimote error %d, reconnecting\n",
+						get_tick_count(), car->index, error);
+			car->state = WII_PROMPT;
 			break;
 		}
 	}
+	return NULL;
+}
+
+/*!
+ \brief Called by the watchdog when the car's control loop has stalled.
+ */
+static void safe_stop_car(void *arg)
+{
+	WiiCarContext_t *car = arg;
+
+	flight_record_error(car->index, WII_ERROR_CONTROL_STALL);
+	// the control loop resets its motion profile when it resumes
+	car->safe_stops++;
+	if (ERR_NONE != stop_motors_priority(&car->session))
+		fprintf(stderr, "@%u: Car %d: safe stop failed\n", get_tick_count(),
+				car->index);
+}
+
+/*!
+ \brief Records every control board command of a car in the flight recorder.
+ */
+static void record_command(control_board_session_t *session,
+		const char *command, int32_t result, uint32_t latency_us)
+{
+	WiiCarContext_t *car = session->observer_arg;
+
+	flight_record_command(car->index, command, result, latency_us);
+}
+
+static void init_car(WiiCarContext_t *car, int32_t index, char *dev_name)
+{
+	memset(car, 0, sizeof(*car));
+	car->index = index;
+	car->dev_name = dev_name;
+	car->wiimote = NULL;
+	car->wiimote_id = -1;
+	car->bdaddr = *BDADDR_ANY;
+	car->state = WII_PROMPT;
+	wiimote_frame_init(&car->frames);
+	wiimote_profile_init(&car->profile);
+	comm_session_init(&car->session);
+	comm_set_observer(&car->session, record_command, car);
+	watchdog_register(&car->watchdog, safe_stop_car, car);
+	obstacle_guard_init(&car->obstacles, &car->session);
+#if _MUTEX_ENABLE
+	pthread_cond_init(&car->cond, NULL);
+	pthread_mutex_init(&car->mutex, NULL);
+#endif
+}
+
+/*!
+ @brief Start one control thread per car, wait for them and exit.
+
+ A car thread only ends on its own if its control board cannot be opened, the others go on.
+
+ \param dev_names serial port of each car's control board.
+ \param count number of cars, at most WIICAR_MAX_CARS.
+ */
+void control_tasks(char **dev_names, int32_t count)
+{
+	int32_t i;
+
+	main_thread = pthread_self();
+	init_tick_count();
+
+	if (flight_recorder_start())
+		perror("Unable to open the flight recorder");
+
+	if (async_log_start())
+		fprintf(stderr, "Unable to start log thread\n");
+
+#if HAVE_GTK
+	int argc_dummy = 0;
+	char **argv_dummy = NULL;
+	init_gui(argc_dummy, argv_dummy);
+
+	set_comm_trace(true);
+	set_diagnostic_mode(true);
+#endif
+
+	cwiid_set_err(err);
+
+	if (count > WIICAR_MAX_CARS)
+	{
+		fprintf(stderr, "At most %d cars are supported\n", WIICAR_MAX_CARS);
+		count = WIICAR_MAX_CARS;
+	}
+
+	for (i = 0; i < count; i++)
+		init_car(&cars[i], i, dev_names[i]);
+	car_count = count;
+
+	if (watchdog_start())
+	{
+		fprintf(stderr, "Unable to start watchdog\n");
+		shutdown_application(5);
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if (realtime_create_thread(&cars[i].thread, car_thread, &cars[i], i))
+		{
+			fprintf(stderr, "Unable to start control thread for %s\n",
+					dev_names[i]);
+			shutdown_application(5);
+		}
+		cars[i].thread_started = true;
+	}
+
+	for (i = 0; i < count; i++)
+		pthread_join(cars[i].thread, NULL);
+	finish_application();
 }
 
 typedef enum WII_OPERATE_STATE
 {
 	WII_OPERATE_INIT_MENU,
 	WII_OPERATE_WAIT_FOR_BUTTON_PRESS,
-	WII_OPERATE_DISPLAY_ACCELEROMETER_INFO,
-	WII_OPERATE_DISPLAY_IR_STATUS,
-	WII_OPERATE_DISPLAY_BUTTON_STATUS,
+	WII_OPERATE_RUN_MODE,
 	WII_OPERATE_ERROR_STATE
 } WII_OPERATE_STATE;
 
@@ -230,14 +444,19 @@ typedef enum WII_OPERATE_STATE
 
  Handles parsing wiimote input to determine correct operating mode.
 
- This function will never exit once entered.
+ \return WII_ERROR_DISCONNECTED if the wiimote was lost or the car told to stop,
+ WII_ERROR_ABORT_PRESSED when Home is pressed, any other error when the wiimote fails.
  */
-ErrorID_t main_menu(cwiid_wiimote_t *wiimote,
-		volatile WiimoteStatusDataType *wiimote_status)
+ErrorID_t main_menu(WiiCarContext_t *car)
 {
+	cwiid_wiimote_t *wiimote = car->wiimote;
+	WiimoteStatusDataType *wiimote_status = &car->status;
+	WiicarObstacleGuard_t *obstacles = &car->obstacles;
 	ErrorID_t error;
 	uint8_t menu_count;
 	uint16_t last_button_state = 0;
+	const WiicarDriveMode_t *mode = NULL;
+	uint8_t i;
 	WII_OPERATE_STATE wii_operate_state = WII_OPERATE_INIT_MENU;
 
 	write_status_led(STATUS_LED_OFF, 0);
@@ -252,11 +471,12 @@ ErrorID_t main_menu(cwiid_wiimote_t *wiimote,
 			wii_operate_state = WII_OPERATE_WAIT_FOR_BUTTON_PRESS;
 			write_status_led(STATUS_LED_FLASH, 500);
 
-			if (0 > cwiid_set_led(wiimote, CWIID_LED1_ON))
+			if (0 > wiimote_output_set_led(&car->output, CWIID_LED1_ON))
 				return WII_ERROR_TRANSMIT;
 			if (0 > cwiid_enable(wiimote, CWIID_FLAG_MESG_IFC))
 				return WII_ERROR_TRANSMIT;
-			if (0 > cwiid_set_rpt_mode(wiimote, CWIID_RPT_BTN))
+			if (0 > wiimote_profile_select(&car->profile, &car->output,
+					WIIMOTE_PROFILE_BUTTONS))
 				return WII_ERROR_TRANSMIT;
 
 			/* Menu */
@@ -266,7 +486,7 @@ ErrorID_t main_menu(cwiid_wiimote_t *wiimote,
 			break;
 
 		case WII_OPERATE_WAIT_FOR_BUTTON_PRESS:
-			error = wait_for_wiimotedata(wiimote_status, 2000);
+			error = wait_for_wiimotedata(car, 2000);
 			if (error == ERR_WII_DATA_TIMEOUT)
 			{
 				set_lcd(0, "Select Mode");
@@ -274,78 +494,74 @@ ErrorID_t main_menu(cwiid_wiimote_t *wiimote,
 				if (++menu_count >= MENU_ENTRIES)
 					menu_count = 0;
 			}
-			else if (0 < error)
+			else if (WII_ERROR_DISCONNECTED == error)
 			{
-				shutdown_application(error);
+				return error;
+			}
+			else if (ERR_NONE != error)
+			{
+				return error;
 			}
 			else if (wiimote_status->button_data != last_button_state)
 			{
 				last_button_state = wiimote_status->button_data;
-				if (last_button_state & CWIID_BTN_A) // collect acceleration data
+				for (i = 0; i < DRIVE_MODE_COUNT; i++)
 				{
-					wii_operate_state = WII_OPERATE_DISPLAY_ACCELEROMETER_INFO;
+					if (last_button_state & drive_modes[i].buttons)
+						break;
 				}
-				else if (last_button_state & CWIID_BTN_B) // collect IR data
+
+				if (i < DRIVE_MODE_COUNT)
 				{
-					wii_operate_state = WII_OPERATE_DISPLAY_IR_STATUS;
+					mode = &drive_modes[i];
+					wii_operate_state = WII_OPERATE_RUN_MODE;
 				}
 				else if (last_button_state & CWIID_BTN_HOME) // reset
 				{
-					shutdown_application(0);
+					return WII_ERROR_ABORT_PRESSED;
 				}
 				else if (last_button_state & CWIID_BTN_PLUS)
 				{
-					sensor_cutoff_fwd += 5;
-					if (sensor_cutoff_fwd > 100)
-						sensor_cutoff_fwd = 100;
+					obstacles->sensor_cutoff_fwd += 5;
+					if (obstacles->sensor_cutoff_fwd > MAX_SENSOR_LEVEL)
+						obstacles->sensor_cutoff_fwd = MAX_SENSOR_LEVEL;
 #if REVERSE_SENSOR_PRESENT
-					sensor_cutoff_rev += 5;
-					if (sensor_cutoff_rev > 100)
-					sensor_cutoff_rev = 100;
+					obstacles->sensor_cutoff_rev += 5;
+					if (obstacles->sensor_cutoff_rev > MAX_SENSOR_LEVEL)
+					obstacles->sensor_cutoff_rev = MAX_SENSOR_LEVEL;
 #endif
+					set_lcd(1, "Cutoff %d", obstacles->sensor_cutoff_fwd);
 
 				}
 				else if (last_button_state & CWIID_BTN_MINUS)
 				{
-					sensor_cutoff_fwd -= 5;
-					if (sensor_cutoff_fwd < 0)
-						sensor_cutoff_fwd = 0;
+					obstacles->sensor_cutoff_fwd -= 5;
+					if (obstacles->sensor_cutoff_fwd < 0)
+						obstacles->sensor_cutoff_fwd = 0;
 #if REVERSE_SENSOR_PRESENT
-					sensor_cutoff_rev -= 5;
-					if (sensor_cutoff_rev < 0)
-					sensor_cutoff_rev = 0;
+					obstacles->sensor_cutoff_rev -= 5;
+					if (obstacles->sensor_cutoff_rev < 0)
+					obstacles->sensor_cutoff_rev = 0;
 #endif
-				}
-				else if (last_button_state & (CWIID_BTN_2 | CWIID_BTN_1))
-				{
-					wii_operate_state = WII_OPERATE_DISPLAY_BUTTON_STATUS;
+					set_lcd(1, "Cutoff %d", obstacles->sensor_cutoff_fwd);
 				}
 			}
 			break;
 
-		case WII_OPERATE_DISPLAY_ACCELEROMETER_INFO:
-			if (ERR_NONE != acceleration_mode(wiimote, wiimote_status))
-				wii_operate_state = WII_OPERATE_ERROR_STATE;
-			else
-				wii_operate_state = WII_OPERATE_INIT_MENU;
-			break;
-
-		case WII_OPERATE_DISPLAY_IR_STATUS:
-			if (ERR_NONE != infrared_mode(wiimote, wiimote_status))
-				wii_operate_state = WII_OPERATE_ERROR_STATE;
-			else
-				wii_operate_state = WII_OPERATE_INIT_MENU;
-			break;
-
-		case WII_OPERATE_DISPLAY_BUTTON_STATUS:
-			if (ERR_NONE != button_mode(wiimote, wiimote_status))
+		case WII_OPERATE_RUN_MODE:
+			error = mode->run(car);
+			if (ERR_NONE != error)
+				flight_record_error(car->index, error);
+			if (WII_ERROR_DISCONNECTED == error)
+				return error;
+			else if (ERR_NONE != error)
 				wii_operate_state = WII_OPERATE_ERROR_STATE;
 			else
 				wii_operate_state = WII_OPERATE_INIT_MENU;
 			break;
 
 		case WII_OPERATE_ERROR_STATE:
-			if (ERR_NONE == error_mode(wiimote, wiimote_status))
+			if (ERR_NONE == error_mode(car, error))
 				wii_operate_state = WII_OPERATE_INIT_MENU;
 			break;
 		}
@@ -356,9 +572,9 @@ ErrorID_t main_menu(cwiid_wiimote_t *wiimote,
 /*!
  @brief Determines motor parameters from IR data.
  */
-ErrorID_t infrared_mode(cwiid_wiimote_t *wiimote,
-		volatile WiimoteStatusDataType *wiimote_status)
+ErrorID_t infrared_mode(WiiCarContext_t *car)
 {
+	WiimoteStatusDataType *wiimote_status = &car->status;
 
 	typedef enum WiimoteInfraredStateType
 	{
@@ -370,12 +586,19 @@ ErrorID_t infrared_mode(cwiid_wiimote_t *wiimote,
 	} WiimoteInfraredStateType;
 
 	ErrorID_t error_flag = ERR_NONE;
+	ErrorID_t wait_error;
 
 	bool last_valid = false;
 	bool valid_points = false;
+	bool driving;
+	WiicarControlState_t law_state;
+	WiicarMotionProfile_t profile;
 
 	WiimoteInfraredStateType state = WIIMOTE_INFRARED_WAIT_FOR_START;
 
+	control_law_infrared.start(&law_state);
+	motors_profile_start(&profile);
+
 	write_status_led(STATUS_LED_OFF, 0);
 
 	for (;;)
@@ -383,7 +606,13 @@ ErrorID_t infrared_mode(cwiid_wiimote_t *wiimote,
 		switch (state)
 		{
 		case WIIMOTE_INFRARED_WAIT_FOR_START:
-			if (0 < wait_for_wiimotedata(wiimote_status, 500))
+			wait_error = wait_for_wiimotedata(car, 500);
+			if (WII_ERROR_DISCONNECTED == wait_error)
+			{
+				error_flag = wait_error;
+				state = WIIMOTE_INFRARED_EXIT;
+			}
+			else if (ERR_NONE != wait_error)
 			{
 				error_flag = WII_ERROR_DATA_TIMEOUT;
 				state = WIIMOTE_INFRARED_EXIT;
@@ -399,7 +628,8 @@ ErrorID_t infrared_mode(cwiid_wiimote_t *wiimote,
 
 			debug_print("Setting IR Report\n");
 
-			if (0 < cwiid_set_rpt_mode(wiimote, CWIID_RPT_IR | CWIID_RPT_BTN))
+			if (0 > wiimote_profile_select(&car->profile, &car->output,
+					WIIMOTE_PROFILE_INFRARED))
 			{
 				debug_print("Cannot set report mode to IR\n");
 				return false;
@@ -410,11 +640,18 @@ ErrorID_t infrared_mode(cwiid_wiimote_t *wiimote,
 
 			write_status_led(STATUS_LED_ON, 0);
 
+			watchdog_arm(&car->watchdog);
 			state = WIIMOTE_INFRARED_READ_DATA;
 			break;
 
 		case WIIMOTE_INFRARED_READ_DATA:
-			if (0 < wait_for_wiimotedata(wiimote_status, 500))
+			wait_error = wait_for_wiimotedata(car, 500);
+			if (WII_ERROR_DISCONNECTED == wait_error)
+			{
+				error_flag = wait_error;
+				state = WIIMOTE_INFRARED_EXIT;
+			}
+			else if (ERR_NONE != wait_error)
 			{
 				error_flag = WII_ERROR_DATA_TIMEOUT;
 				state = WIIMOTE_INFRARED_EXIT;
@@ -425,8 +662,16 @@ ErrorID_t infrared_mode(cwiid_wiimote_t *wiimote,
 			}
 			else
 			{
-				error_flag = WiiComputeMotorLevelsInfrared(wiimote_status,
-						&valid_points);
+				error_flag = control_law_drive(&control_law_infrared,
+						&law_state, &profile, &car->obstacles,
+						wiimote_status, car->safe_stops, &driving);
+				valid_points = (wiimote_status->ir_computed_data.count
+						>= WIICAR_IR_NUMBER_OF_POINTS);
+				if (valid_points)
+					flight_record_ir(car->index,
+							wiimote_status->ir_computed_data.theta,
+							wiimote_status->ir_computed_data.phi,
+							wiimote_status->ir_computed_data.distance);
 				if (valid_points != last_valid)
 				{
 					write_status_led(
@@ -439,10 +684,10 @@ ErrorID_t infrared_mode(cwiid_wiimote_t *wiimote,
 
 				last_valid = valid_points;
 				if (ERR_EXEC == error_flag)
-					cwiid_set_rumble(wiimote, true);
+					wiimote_output_set_rumble(&car->output, true);
 				else
 				{
-					cwiid_set_rumble(wiimote, false);
+					wiimote_output_set_rumble(&car->output, false);
 					if (error_flag < 0)
 						state = WIIMOTE_INFRARED_EXIT;
 				}
@@ -450,7 +695,13 @@ ErrorID_t infrared_mode(cwiid_wiimote_t *wiimote,
 			break;
 
 		case WIIMOTE_INFRARED_WAIT_FOR_EXIT:
-			if (0 < wait_for_wiimotedata(wiimote_status, 500))
+			wait_error = wait_for_wiimotedata(car, 500);
+			if (WII_ERROR_DISCONNECTED == wait_error)
+			{
+				error_flag = wait_error;
+				state = WIIMOTE_INFRARED_EXIT;
+			}
+			else if (ERR_NONE != wait_error)
 			{
 				state = WIIMOTE_INFRARED_EXIT;
 			}
@@ -460,7 +711,10 @@ ErrorID_t infrared_mode(cwiid_wiimote_t *wiimote,
 			}
 			break;
 		case WIIMOTE_INFRARED_EXIT:
+			watchdog_disarm(&car->watchdog);
 			stop_motors();
+			wiimote_output_set_rumble(&car->output, false);
+			wiimote_output_sync(&car->output);
 			write_status_led(STATUS_LED_OFF, 0);
 			set_ir_led(false);
 			return error_flag;
@@ -476,9 +730,10 @@ ErrorID_t infrared_mode(cwiid_wiimote_t *wiimote,
  @brief Computes motor parameters from Accel Data.
  */
 
-ErrorID_t acceleration_mode(cwiid_wiimote_t *wiimote,
-		volatile WiimoteStatusDataType *wiimote_status)
+ErrorID_t acceleration_mode(WiiCarContext_t *car)
 {
+	cwiid_wiimote_t *wiimote = car->wiimote;
+	WiimoteStatusDataType *wiimote_status = &car->status;
 	typedef enum WiimoteAccelStateType
 	{
 		WIIMOTE_ACCEL_WAIT_FOR_START,
@@ -491,18 +746,30 @@ ErrorID_t acceleration_mode(cwiid_wiimote_t *wiimote,
 	const uint8_t RETRY_VALUE = 2;
 	uint8_t retry_count = 0;
 	ErrorID_t error_flag = ERR_NONE;
+	ErrorID_t wait_error;
+	bool driving;
+	WiicarControlState_t law_state;
+	WiicarMotionProfile_t profile;
 
 	WiimoteAccelStateType state = WIIMOTE_ACCEL_WAIT_FOR_START;
 
 	debug_print("Entering acceleration mode...\n");
 	write_status_led(STATUS_LED_OFF, 0);
+	control_law_accel.start(&law_state);
+	motors_profile_start(&profile);
 
 	for (;;)
 	{
 		switch (state)
 		{
 		case WIIMOTE_ACCEL_WAIT_FOR_START:
-			if (0 > wait_for_wiimotedata(wiimote_status, INFINITE_TIMEOUT))
+			wait_error = wait_for_wiimotedata(car, INFINITE_TIMEOUT);
+			if (WII_ERROR_DISCONNECTED == wait_error)
+			{
+				error_flag = wait_error;
+				state = WIIMOTE_ACCEL_EXIT;
+			}
+			else if (ERR_NONE != wait_error)
 			{
 				debug_print("No start signal received\n");
 				error_flag = WII_ERROR_DATA_TIMEOUT;
@@ -515,8 +782,17 @@ ErrorID_t acceleration_mode(cwiid_wiimote_t *wiimote,
 			break;
 
 		case WIIMOTE_ACCEL_READ_CAL_DATA:
-			error_flag = WII_ERROR_ACCEL_CAL;
-			do
+			if (wiimote_status->accel_cal_valid)
+			{
+				// calibration cached from before a reconnect to the same wiimote
+				error_flag = ERR_NONE;
+			}
+			else
+			{
+				error_flag = WII_ERROR_ACCEL_CAL;
+			}
+
+			while ((error_flag != ERR_NONE) && (retry_count++ <= RETRY_VALUE))
 			{
 				if (0
 						== cwiid_get_acc_cal(
@@ -525,17 +801,21 @@ ErrorID_t acceleration_mode(cwiid_wiimote_t *wiimote,
 								(struct acc_cal *) &wiimote_status->accel_cal_data))
 				{
 					error_flag = ERR_NONE;
-					break;
+					wiimote_status->accel_cal_valid = true;
 				}
-			} while (retry_count++ < RETRY_VALUE);
+			}
 
 			if (error_flag != ERR_NONE)
 			{
 				debug_print("Cannot read cal data\n");
 				return error_flag;
 			}
+			build_accel_table(wiimote_status);
+			flight_record_calibration(car->index,
+					&wiimote_status->accel_cal_data);
 
-			if (0 > cwiid_set_rpt_mode(wiimote, CWIID_RPT_ACC | CWIID_RPT_BTN))
+			if (0 > wiimote_profile_select(&car->profile, &car->output,
+					WIIMOTE_PROFILE_ACCEL))
 			{
 				debug_print("Cannot set report mode to ACCEL\n");
 				return false;
@@ -543,13 +823,20 @@ ErrorID_t acceleration_mode(cwiid_wiimote_t *wiimote,
 
 			set_lcd(0, "Accel Mode...");
 			set_lcd(1, "P = %4d R = %4d", 0, 0);
+			watchdog_arm(&car->watchdog);
 			state = WIIMOTE_ACCEL_READ_DATA;
 			break;
 
 		case WIIMOTE_ACCEL_READ_DATA:
-			if (0 > wait_for_wiimotedata(wiimote_status, INFINITE_TIMEOUT))
+			wait_error = wait_for_wiimotedata(car, INFINITE_TIMEOUT);
+			if (WII_ERROR_DISCONNECTED == wait_error)
+			{
+				error_flag = wait_error;
+				state = WIIMOTE_ACCEL_EXIT;
+			}
+			else if (ERR_NONE != wait_error)
 			{
-				debug_print("@%u: WII_ERROR_DATA_TIMEOUT\n", get_tick_count());
+				debug_log("@%u: WII_ERROR_DATA_TIMEOUT\n", get_tick_count());
 				error_flag = WII_ERROR_DATA_TIMEOUT;
 				state = WIIMOTE_ACCEL_EXIT;
 			}
@@ -561,19 +848,25 @@ ErrorID_t acceleration_mode(cwiid_wiimote_t *wiimote,
 				}
 				else
 				{
-					error_flag = computer_motor_levels_accel(wiimote_status);
+					error_flag = control_law_drive(&control_law_accel,
+							&law_state, &profile, &car->obstacles,
+							wiimote_status, car->safe_stops, &driving);
+					flight_record_accel(car->index,
+							wiimote_status->accel_computed_data.pitch,
+							wiimote_status->accel_computed_data.roll,
+							wiimote_status->accel_computed_data.yaw);
 					set_lcd(1, "P = %4d R = %4d",
 							wiimote_status->accel_computed_data.pitch / 100,
 							wiimote_status->accel_computed_data.roll / 100);
 
 					if (ERR_EXEC == error_flag)
-						cwiid_set_rumble(wiimote, true);
+						wiimote_output_set_rumble(&car->output, true);
 					else
 					{
-						cwiid_set_rumble(wiimote, false);
+						wiimote_output_set_rumble(&car->output, false);
 						if (error_flag < 0)
 						{
-							debug_print("@%u: CONTROL CAR COMM ERROR: %d\n",
+							debug_log("@%u: CONTROL CAR COMM ERROR: %d\n",
 									get_tick_count(), error_flag);
 							state = WIIMOTE_ACCEL_EXIT;
 						}
@@ -584,9 +877,15 @@ ErrorID_t acceleration_mode(cwiid_wiimote_t *wiimote,
 			break;
 
 		case WIIMOTE_ACCEL_WAIT_FOR_EXIT:
-			stop_motors();
+			stop_motors_profiled(&profile);
 
-			if (0 < wait_for_wiimotedata(wiimote_status, INFINITE_TIMEOUT))
+			wait_error = wait_for_wiimotedata(car, INFINITE_TIMEOUT);
+			if (WII_ERROR_DISCONNECTED == wait_error)
+			{
+				error_flag = wait_error;
+				state = WIIMOTE_ACCEL_EXIT;
+			}
+			else if (ERR_NONE != wait_error)
 			{
 				error_flag = WII_ERROR_DATA_TIMEOUT;
 				state = WIIMOTE_ACCEL_EXIT;
@@ -597,6 +896,10 @@ ErrorID_t acceleration_mode(cwiid_wiimote_t *wiimote,
 			}
 			break;
 		case WIIMOTE_ACCEL_EXIT:
+			watchdog_disarm(&car->watchdog);
+			stop_motors();
+			wiimote_output_set_rumble(&car->output, false);
+			wiimote_output_sync(&car->output);
 			debug_print("Exiting acceleration mode.\n\n");
 			return error_flag;
 		}
@@ -604,14 +907,18 @@ ErrorID_t acceleration_mode(cwiid_wiimote_t *wiimote,
 	return ERR_NONE;
 }
 
-ErrorID_t button_mode(cwiid_wiimote_t *wiimote,
-		volatile WiimoteStatusDataType *wiimote_status)
+/*!
+ @brief Drives the car with the buttons, ramping speed and direction up through the motion profile.
+ */
+ErrorID_t button_mode(WiiCarContext_t *car)
 {
-	int32_t speed = SPEED_NULL_VALUE;
-	int32_t direction = 0;
+	WiimoteStatusDataType *wiimote_status = &car->status;
 	bool run = true;
+	WiicarControlState_t law_state;
+	WiicarMotionProfile_t profile;
 
-	cwiid_set_rpt_mode(wiimote, CWIID_RPT_BTN);
+	wiimote_profile_select(&car->profile, &car->output,
+			WIIMOTE_PROFILE_BUTTONS);
 
 	debug_print("Entering button mode:\n");
 	write_status_led(STATUS_LED_OFF, 0);
@@ -619,74 +926,86 @@ ErrorID_t button_mode(cwiid_wiimote_t *wiimote,
 	set_lcd(0, "Button Mode");
 	set_lcd(1, "2-fwd,1-back,dpad-steer");
 
+	control_law_buttons.start(&law_state);
+	motors_profile_start(&profile);
+	watchdog_arm(&car->watchdog);
 	do
 	{
-		wait_for_wiimotedata(wiimote_status, 25);
-
-		if ((wiimote_status->button_data & CWIID_BTN_2)
-				&& (wiimote_status->button_data & CWIID_BTN_1))
-		{
-			if (speed > 0)
-			{
-				speed -= MAX_FORWARD_SPEED / 10;
-				if (speed < 0)
-					speed = 0;
-			}
-			else if (speed < 0)
-			{
-				speed -= MAX_REVERSE_SPEED / 10;
-				if (speed > 0)
-					speed = 0;
-			}
-		}
-		else if (wiimote_status->button_data & CWIID_BTN_2)
-		{
-			speed += MAX_FORWARD_SPEED / 10;
-			if (speed > MAX_FORWARD_SPEED)
-				speed = MAX_FORWARD_SPEED;
-		}
-		else if (wiimote_status->button_data & CWIID_BTN_1)
-		{
-			speed += MAX_REVERSE_SPEED / 10;
-			if (speed < MAX_REVERSE_SPEED)
-				speed = MAX_REVERSE_SPEED;
-		}
-		else
-		{
-			speed = 0;
-			direction = 0;
-			run = false;
-		}
-
-		if (wiimote_status->button_data & CWIID_BTN_UP)
-		{
-			direction -= (MAX_LEFT_DIRECTION / 10);
-			if (direction < -MAX_LEFT_DIRECTION)
-				direction = -MAX_LEFT_DIRECTION;
-		}
-		else if (wiimote_status->button_data & CWIID_BTN_DOWN)
+		if (WII_ERROR_DISCONNECTED == wait_for_wiimotedata(car, 25))
 		{
-			direction += (MAX_RIGHT_DIRECTION / 10);
-			if (direction > MAX_RIGHT_DIRECTION)
-				direction = MAX_RIGHT_DIRECTION;
+			watchdog_disarm(&car->watchdog);
+			stop_motors();
+			return WII_ERROR_DISCONNECTED;
 		}
-		else
-			direction = 0;
-
-		debug_print("@%u: Button (speed, heading) = %d %d\n", get_tick_count(),
-				speed, direction);
 
-		write_motor_levels(speed, ComputeDirectionMotor(direction));
+		// releasing the buttons stops the car at once
+		control_law_drive(&control_law_buttons, &law_state, &profile,
+				&car->obstacles, wiimote_status, car->safe_stops, &run);
+		debug_log("@%u: Button (buttons, driving) = %04x %d\n",
+				get_tick_count(), wiimote_status->button_data, run);
 	} while (run);
+	watchdog_disarm(&car->watchdog);
 	return ERR_NONE;
 }
 
-int32_t shutdown_all(cwiid_wiimote_t *wiimote)
+/*!
+ \brief Stop a car and close its wiimote, once the car's thread has ended.
+
+ The car's session is bound to the calling thread for the duration.
+ */
+int32_t shutdown_all(WiiCarContext_t *car)
+{
+	control_board_session_t *caller_session = comm_get_session();
+
+	if (car->board_open)
+	{
+		comm_bind_session(&car->session);
+		stop_motors();
+		set_ir_led(false);
+		write_status_led(STATUS_LED_OFF, 0);
+		comm_bind_session(caller_session);
+	}
+
+	if (NULL == car->wiimote)
+		return ERR_NONE;
+	return cwiid_close(car->wiimote);
+}
+
+/*!
+ \brief Drop a wiimote whose connection was lost, leaving the car stopped.
+
+ The control board session is kept open, so a reconnect does not repeat the board handshake.
+ */
+void release_wiimote(WiiCarContext_t *car)
 {
 	stop_motors();
 	set_ir_led(false);
-	write_status_led(STATUS_LED_OFF, 0);
-	return cwiid_close(wiimote);
+	write_status_led(STATUS_LED_FLASH, 100);
+
+	if (cwiid_close(car->wiimote))
+		fprintf(stderr, "@%u: Error on wiimote disconnect\n", get_tick_count());
+	car->wiimote = NULL;
+	car->wiimote_id = -1;
+
+	wiimote_frame_discard(&car->frames);
+}
+
+/*!
+ \brief Find the car a wiimote belongs to.
+
+ \return WiiCarContext_t* the car, or NULL if the wiimote is not connected to any car.
+ */
+static WiiCarContext_t *find_car(cwiid_wiimote_t *wiimote)
+{
+	int id = cwiid_get_id(wiimote);
+	int32_t i;
+
+	for (i = 0; i < car_count; i++)
+	{
+		if (cars[i].wiimote_id == id)
+			return &cars[i];
+	}
+	return NULL;
 }
 
 /* Prototype cwiid_callback with cwiid_callback_t, define it with the actual
@@ -699,14 +1018,22 @@ int32_t shutdown_all(cwiid_wiimote_t *wiimote)
  * pass an array of messages, all of which were received at the same time.
  * The id is to distinguish between multiple wiimotes using the same callback.
  * */
+/* All cars share this callback, the report is routed to the car whose
+ * wiimote has the id of the sender. */
 void cwiid_callback(cwiid_wiimote_t *wiimote, int mesg_count,
 		union cwiid_mesg mesg[], struct timespec *timestamp)
 {
 	int i, j;
 	int valid_source;
+	WiiCarContext_t *car = find_car(wiimote);
+	WiimoteFrame_t *frame;
+
+	if (NULL == car)
+		return;
+	frame = wiimote_frame_current(&car->frames);
 
 #if _DEBUG >= 2
-	debug_print("@%u: msg received\n",get_tick_count());
+	debug_log("@%u: msg received\n",get_tick_count());
 #endif
 
 	for (i = 0; i < mesg_count; i++)
@@ -718,7 +1045,7 @@ void cwiid_callback(cwiid_wiimote_t *wiimote, int mesg_count,
 			debug_print("@%u: Status Report: battery=%d extension=", get_tick_count(),
 					mesg[i].status_mesg.battery);
 #endif
-			wiimote_status_data.battery_level = mesg[i].status_mesg.battery;
+			frame->battery_level = mesg[i].status_mesg.battery;
 			switch (mesg[i].status_mesg.ext_type)
 			{
 			case CWIID_EXT_NONE:
@@ -745,26 +1072,26 @@ void cwiid_callback(cwiid_wiimote_t *wiimote, int mesg_count,
 			break;
 		case CWIID_MESG_BTN:
 #if _DEBUG >= 2
-			debug_print("@%u: Button Report: %.4X\n", get_tick_count(), mesg[i].btn_mesg.buttons);
+			debug_log("@%u: Button Report: %.4X\n", get_tick_count(), mesg[i].btn_mesg.buttons);
 #endif
-			wiimote_status_data.button_data = mesg[i].btn_mesg.buttons;
+			frame->button_data = mesg[i].btn_mesg.buttons;
 
 			break;
 		case CWIID_MESG_ACC:
 #if _DEBUG >= 2
-			debug_print("@%u: Acc Report: x=%d, y=%d, z=%d\n", get_tick_count(),
+			debug_log("@%u: Acc Report: x=%d, y=%d, z=%d\n", get_tick_count(),
 					mesg[i].acc_mesg.acc[CWIID_X],
 					mesg[i].acc_mesg.acc[CWIID_Y],
 					mesg[i].acc_mesg.acc[CWIID_Z]);
 #endif
 			for (j = 0; j < 3; j++)
 			{
-				wiimote_status_data.accel_raw_data[j] = mesg[i].acc_mesg.acc[j];
+				frame->accel_raw_data[j] = mesg[i].acc_mesg.acc[j];
 			}
 			break;
 		case CWIID_MESG_IR:
 #if _DEBUG >= 2
-			debug_print("@%u: IR Report: ", get_tick_count());
+			debug_log("@%u: IR Report: ", get_tick_count());
 #endif
 			valid_source = 0;
 			for (j = 0; j < CWIID_IR_SRC_COUNT; j++)
@@ -773,26 +1100,26 @@ void cwiid_callback(cwiid_wiimote_t *wiimote, int mesg_count,
 				if (mesg[i].ir_mesg.src[j].valid)
 				{
 					valid_source = 1;
-					debug_print("(%d,%d) ", mesg[i].ir_mesg.src[j].pos[CWIID_X],
+					debug_log("(%d,%d) ", mesg[i].ir_mesg.src[j].pos[CWIID_X],
 							mesg[i].ir_mesg.src[j].pos[CWIID_Y]);
 
 				}
 #endif
-				wiimote_status_data.ir_raw_data.WiimoteIRPoint[j].valid =
+				frame->ir_raw_data.WiimoteIRPoint[j].valid =
 						mesg[i].ir_mesg.src[j].valid;
-				wiimote_status_data.ir_raw_data.WiimoteIRPoint[j].size =
+				frame->ir_raw_data.WiimoteIRPoint[j].size =
 						mesg[i].ir_mesg.src[j].size;
-				wiimote_status_data.ir_raw_data.WiimoteIRPoint[j].pos[0] =
+				frame->ir_raw_data.WiimoteIRPoint[j].pos[0] =
 						mesg[i].ir_mesg.src[j].pos[CWIID_X];
-				wiimote_status_data.ir_raw_data.WiimoteIRPoint[j].pos[1] =
+				frame->ir_raw_data.WiimoteIRPoint[j].pos[1] =
 						mesg[i].ir_mesg.src[j].pos[CWIID_Y];
 			}
 #if _DEBUG >= 2
 			if (!valid_source)
 			{
-				debug_print("@%u: no sources detected", get_tick_count());
+				debug_log("@%u: no sources detected", get_tick_count());
 			}
-			printf("\n");
+			debug_log("\n");
 #endif
 			break;
 		case CWIID_MESG_NUNCHUK:
@@ -818,24 +1145,23 @@ void cwiid_callback(cwiid_wiimote_t *wiimote, int mesg_count,
 #endif
 			break;
 		case CWIID_MESG_ERROR:
-			if (cwiid_close(wiimote))
+			// the control loop stops the car and reconnects, cwiid_close cannot be called from here
+			if (!car->disconnected)
 			{
-				fprintf(stderr, "@%u: Error on wiimote disconnect\n",
-						get_tick_count());
-				shutdown_application(-1);
-
+				car->disconnect_time = get_tick_count_us();
+				car->disconnected = true;
 			}
-
-			shutdown_application(0);
 			break;
 		default:
 #if _DEBUG > 2
-			debug_print("@%u: Unknown Report", get_tick_count());
+			debug_log("@%u: Unknown Report", get_tick_count());
 #endif
 			break;
 		}
 	}
-	signal_wiimote_data_ready(&wiimote_status_data, 100);
+	wiimote_profile_record_report(&car->profile);
+	flight_record_frame(car->index, frame);
+	signal_wiimote_data_ready(car);
 }
 
 #if _MUTEX_ENABLE
@@ -856,92 +1182,248 @@ void update_timeout_value(struct timespec *ts, int32_t timeout)
 }
 #endif
 
-ErrorID_t wait_for_wiimotedata(volatile WiimoteStatusDataType *wiimote_status,
-		int32_t timeout)
+/*!
+ \brief Copy a frame taken from the mailbox into the status snapshot used by the modes.
+
+ The snapshot sees the folded button state, so a press within a skipped frame still registers.  This
+ is the only point where data shared with the cwiid callback is read: the snapshot belongs to the
+ control loop alone, so the modes and wiicar_math.c work on it as plain, non-volatile data.
+ */
+static void apply_wiimote_frame(WiimoteStatusDataType *wiimote_status,
+		const WiimoteFrame_t *frame)
+{
+	uint8_t i;
+
+	wiimote_status->battery_level = frame->battery_level;
+	wiimote_status->button_data = frame->button_folded;
+	wiimote_status->timestamp_us = frame->timestamp_us;
+	for (i = 0; i < 3; i++)
+		wiimote_status->accel_raw_data[i] = frame->accel_raw_data[i];
+	for (i = 0; i < WIICAR_NUMBER_OF_MAX_IR_POINTS; i++)
+		wiimote_status->ir_raw_data.WiimoteIRPoint[i]
+				= frame->ir_raw_data.WiimoteIRPoint[i];
+}
+
+/*!
+ \brief Wait for the newest frame of the car's wiimote and copy it into the car's status.
+
+ Returns at once if a frame arrived since the last call.  Frames that arrived while the control loop
+ was busy are skipped, see wiimote_frame.c.  With _MUTEX_ENABLE the mailbox is checked and waited on
+ under the car's mutex, which signal_wiimote_data_ready() holds to publish, so a frame published
+ between the check and the wait is not missed; a wakeup without a frame waits again.
+
+ A stop requested by shutdown_application() is reported as a disconnection, so every mode leaves
+ through the path it already has for a lost wiimote.
+ */
+ErrorID_t wait_for_wiimotedata(WiiCarContext_t *car, int32_t timeout)
 {
 	ErrorID_t ret_val = ERR_NONE;
+	const WiimoteFrame_t *frame;
+
+	watchdog_heartbeat(&car->watchdog);
+	wiimote_output_flush(&car->output);
 
 #if _MUTEX_ENABLE
-	static struct timespec abstime;
+	struct timespec abstime;
+	bool waited = false;
+	int wait_result = 0;
+
+	if (car->disconnected || car->stop)
+		return WII_ERROR_DISCONNECTED;
+
 	if (0 < timeout)
-	{
 		update_timeout_value(&abstime, timeout);
-		ret_val = pthread_cond_timedwait(&cond, &mutex, &abstime);
-		if (ETIMEDOUT == ret_val)
-		{
-			fprintf(stderr, "@%u: Wiimote data timeout.\n", get_tick_count());
-		}
 
-	}
-	else
+	pthread_mutex_lock(&car->mutex);
+	while ((NULL == (frame = wiimote_frame_take(&car->frames))) && (0
+			== wait_result) && !car->disconnected && !car->stop)
 	{
-		ret_val = pthread_cond_wait(&cond, &mutex);
+		if (0 < timeout)
+			wait_result = pthread_cond_timedwait(&car->cond, &car->mutex,
+					&abstime);
+		else
+			wait_result = pthread_cond_wait(&car->cond, &car->mutex);
+		waited = true;
 	}
+	pthread_mutex_unlock(&car->mutex);
 
-	if (0 <= ret_val)
+	// the same errors as the polling wait, pthread's are positive errno values
+	if (NULL == frame)
 	{
+		if (car->disconnected || car->stop)
+			return WII_ERROR_DISCONNECTED;
+		if (ETIMEDOUT == wait_result)
+		{
+			debug_log("%u: wiimote data timeout, timeout = %d\n",
+					get_tick_count(), timeout);
+			return ERR_WII_DATA_TIMEOUT;
+		}
+		fprintf(stderr, "@%u: Wiimote data wait failed: %s\n",
+				get_tick_count(), strerror(wait_result));
+		return ERR_UNKN;
+	}
+
+	if (waited)
+		realtime_record_wakeup(&car->wakeup_stats, car->data_signal_time);
+	apply_wiimote_frame(&car->status, frame);
 #if (_DEBUG >= 2)
-		fprintf(stderr, "@%u: Wiimote data received.\n", get_tick_count());
+	debug_log("@%u: Wiimote data received.\n", get_tick_count());
 #endif
-	}
 #else
 	uint32_t start_time = get_tick_count();
-	wiimote_data_ready = false;
-	while (!wiimote_data_ready)
+	uint64_t sleep_start;
+	while (NULL == (frame = wiimote_frame_take(&car->frames)))
 	{
+		if (car->disconnected || car->stop)
+			return WII_ERROR_DISCONNECTED;
+
 		if (check_for_timeout(get_tick_count(), start_time, timeout))
 		{
-			debug_print("%u: wiimote data timeout, timeout = %d\n",
+			debug_log("%u: wiimote data timeout, timeout = %d\n",
 					get_tick_count(), timeout);
 			return ERR_WII_DATA_TIMEOUT;
 		}
 
-		usleep(25 * 1000);
+		sleep_start = get_tick_count_us();
+		usleep(WIIMOTE_DATA_POLL_PERIOD_US);
+		realtime_record_wakeup(&car->wakeup_stats,
+				sleep_start + WIIMOTE_DATA_POLL_PERIOD_US);
 	}
+	apply_wiimote_frame(&car->status, frame);
 #endif
 	return ret_val;
 }
 
-int32_t signal_wiimote_data_ready(
-		volatile WiimoteStatusDataType *wiimote_status, int32_t timeout)
+/*!
+ \brief Publish the current frame to the control loop and wake it.
+ */
+int32_t signal_wiimote_data_ready(WiiCarContext_t *car)
 {
 #if _MUTEX_ENABLE
 	int32_t ret_val;
-	ret_val = pthread_cond_broadcast(&cond);
-	if (0 > ret_val)
-	return ret_val;
-	return pthread_mutex_unlock(&mutex);
+
+	pthread_mutex_lock(&car->mutex);
+	car->data_signal_time = get_tick_count_us();
+	wiimote_frame_publish(&car->frames);
+	ret_val = pthread_cond_broadcast(&car->cond);
+	pthread_mutex_unlock(&car->mutex);
 #if _DEBUG >= 2
 	debug_print("@%u: Wiimote data received\n", get_tick_count());
 #endif
 	return ret_val;
 #else
-	wiimote_data_ready = true;
+	car->data_signal_time = get_tick_count_us();
+	wiimote_frame_publish(&car->frames);
 	return ERR_NONE;
 #endif
 }
 
-ErrorID_t error_mode(cwiid_wiimote_t *wiimote,
-		volatile WiimoteStatusDataType *wiimote_status)
+/*!
+ \brief Stop a car whose mode failed, the menu is shown again.
+ */
+ErrorID_t error_mode(WiiCarContext_t *car, ErrorID_t error)
+{
+	stop_motors();
+	fprintf(stderr, "@%u: Car %d: error %d, car stopped\n", get_tick_count(),
+			car->index, error);
+	set_lcd(0, "Error %d", error);
+	set_lcd(1, "Car stopped.");
+	return ERR_NONE;
+}
+
+static void report_comm_latency(const char *name,
+		const comm_latency_stats_t *latency)
 {
-	debug_print("@%u: An error has occurred\n", get_tick_count());
-	shutdown_application(-1);
-	return ERR_UNKN;
+	if (0 == latency->count)
+		return;
+
+	fprintf(stderr, "%s: %u board queries, worst round trip %u us, mean %u us\n",
+			name, latency->count, latency->worst_us,
+			(uint32_t) (latency->total_us / latency->count));
 }
 
-void shutdown_application(int32_t exit_code)
+/*!
+ \brief Tell every car thread to stop, waking the ones waiting for wiimote data.
+ */
+static void request_stop(int32_t exit_code)
 {
-	shutdown_all(wiimote);
+	int32_t i;
+
+	if (0 == exit_status)
+		exit_status = exit_code;
+	for (i = 0; i < car_count; i++)
+	{
+		cars[i].stop = true;
+#if _MUTEX_ENABLE
+		pthread_mutex_lock(&cars[i].mutex);
+		pthread_cond_broadcast(&cars[i].cond);
+		pthread_mutex_unlock(&cars[i].mutex);
+#endif
+	}
+}
+
+/*!
+ \brief Once every car thread has ended, stop every car, print the statistics of each one and exit.
+
+ The exit status is the one asked of shutdown_application(), else the first error a car ended on.
+ */
+static void finish_application(void)
+{
+	int32_t i;
+	char name[32];
+
+	for (i = 0; i < car_count; i++)
+	{
+		shutdown_all(&cars[i]);
+		if (0 == exit_status)
+			exit_status = cars[i].exit_code;
+	}
+	async_log_flush();
+
+	for (i = 0; i < car_count; i++)
+	{
+		snprintf(name, sizeof(name), "Car %d (%s)", cars[i].index,
+				cars[i].dev_name);
+		realtime_report(name, &cars[i].wakeup_stats);
+		wiimote_frame_report(&cars[i].frames);
+		wiimote_output_report(&cars[i].output);
+		wiimote_profile_report(&cars[i].profile);
+		watchdog_report(&cars[i].watchdog);
+		obstacle_report(&cars[i].obstacles);
+		report_comm_latency(name, &cars[i].session.latency);
+	}
 #if HAVE_GTK
 	shutdown_gui();
 #endif
-	exit(exit_code);
+	exit(exit_status);
+}
+
+/*!
+ \brief Stop every car and exit the process.
+
+ Every car thread is told to stop and joined before any wiimote or board is closed.  Called from
+ another thread than control_tasks(), it only asks for the stop, control_tasks() then joins the
+ cars and exits.
+ */
+void shutdown_application(int32_t exit_code)
+{
+	int32_t i;
+
+	request_stop(exit_code);
+	if (!pthread_equal(pthread_self(), main_thread))
+		return;
+
+	for (i = 0; i < car_count; i++)
+		if (cars[i].thread_started)
+			pthread_join(cars[i].thread, NULL);
+	finish_application();
 }
 
 #if HAVE_GTK
 void on_window_destroy(GtkObject *object, gpointer user_data)
 {
 	shutdown_application(0);
+	gtk_main_quit();
 }
 #endif
 
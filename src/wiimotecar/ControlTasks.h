@@ -1,9 +1,70 @@
 #ifndef CONTROL_TASKS_H
 #define CONTROL_TASKS_H
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
 #include <cwiid.h>
+#include <controlboard/control_board.h>
 
-void control_tasks(char *dev_name);
+#include "wiicar.h"
+#include "wiicar_realtime.h"
+#include "wiicar_watchdog.h"
+#include "wiicar_obstacle.h"
+#include "wiimote_frame.h"
+#include "wiimote_output.h"
+#include "wiimote_profile.h"
+
+/// \brief Maximum number of cars driven by one process.
+#define WIICAR_MAX_CARS 8
+
+/// \brief Failed connections to the last wiimote of a car before it searches for any wiimote again.
+#define WIICAR_RECONNECT_ATTEMPTS 5
+
+/*!
+ \brief Everything needed to drive one car: its wiimote, its control board and its state machine.
+
+ Each car runs on its own thread, only the callback dispatcher and the shutdown path touch another
+ car's context, the shutdown path only once the car's thread has ended.
+ */
+typedef struct WiiCarContext_t
+{
+	int32_t index;
+	char *dev_name;
+	pthread_t thread;
+	bool thread_started;
+	volatile bool stop; ///< set by shutdown_application(), the car thread returns when it sees it
+	int32_t exit_code; ///< nonzero if the car thread ended on an error of its own
+	bool board_open; ///< the control board handshake is done
+
+	cwiid_wiimote_t *wiimote;
+	volatile int wiimote_id; ///< cwiid id of the connected wiimote, -1 if none
+	bdaddr_t bdaddr; ///< address of the last connected wiimote, BDADDR_ANY to search
+	uint32_t reconnect_failures; ///< failed connections to bdaddr in a row
+	WiimoteState_t state;
+
+	WiimoteStatusDataType status; ///< snapshot of the newest frame, only touched by the car thread
+	WiimoteFrameMailbox_t frames;
+	WiimoteOutput_t output; ///< shadow of the wiimote outputs, only touched by the car thread
+	WiimoteProfileState_t profile;
+	control_board_session_t session;
+
+	volatile uint64_t data_signal_time; ///< tick count (us) at which the last frame was signalled
+	volatile bool disconnected; ///< set by the callback when the wiimote connection is lost
+	volatile uint64_t disconnect_time; ///< tick count (us) at which the connection was lost
+#if _MUTEX_ENABLE
+	pthread_cond_t cond;
+	pthread_mutex_t mutex;
+#endif
+
+	WiicarObstacleGuard_t obstacles; ///< range sensors, their cutoffs are set from the menu
+
+	WiicarWakeupStats_t wakeup_stats;
+	WiicarWatchdog_t watchdog;
+	volatile uint32_t safe_stops; ///< stops issued by the watchdog, counted by safe_stop_car()
+} WiiCarContext_t;
+
+void control_tasks(char **dev_names, int32_t car_count);
 void shutdown_application(int32_t exit_code);
 
 
@@ -2,11 +2,18 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <controlboard/control_board.h>
 #include <controlboard/hardware.h>
 #include <wiicarutility/timestamp.h>
 #include <wiicarutility/utility.h>
+#include <wiicarutility/async_log.h>
+#include <wiicarutility/error_message.h>
+#include <wiicarutility/pid.h>
+#include <wiicarutility/motion_profile.h>
 #include "wiicar_math.h"
+#include "control_law.h"
+#include "wiicar_obstacle.h"
 
 #define MAX_FORWARD_PITCH (45 * DEGREE_SCALING)
 #define MAX_REVERSE_PITCH (45 * DEGREE_SCALING)
@@ -16,24 +23,244 @@
 
 #define MAX_IR_DISTANCE (768 / 4)
 
+/// \brief Gains of infrared mode, WIICAR_INFRARED_DEFAULT_GAINS.
+static pid_gains_t speed_gains =
+{ (MAX_FORWARD_SPEED << PID_GAIN_BITS) / MAX_IR_DISTANCE, 0, 0 };
+static pid_gains_t heading_gains =
+{ 1 << PID_GAIN_BITS, 0, 0 };
+
+/// \brief Latency not measured, of the camera and the bluetooth link, in us.  Negative disables prediction.
+static int32_t prediction_lead_us = WIICAR_PREDICTION_DEFAULT_LEAD_MS * 1000;
+
+/*!
+ \brief Set the latency added to the measured one when predicting the car's pose in infrared mode.
+
+ \param lead_ms latency of the camera and the bluetooth link, negative disables prediction.
+ */
+void infrared_configure_prediction(int32_t lead_ms)
+{
+	prediction_lead_us = (lead_ms < 0) ? -1 : lead_ms * 1000;
+}
+
+/*!
+ \brief Set the gains infrared_pid_start() sets up, of the distance to speed and of phi to steering.
+ */
+void infrared_configure_pid(const pid_gains_t *speed,
+		const pid_gains_t *heading)
+{
+	speed_gains = *speed;
+	heading_gains = *heading;
+}
+
+/*!
+ \brief Parse the gains of infrared mode, "kp,ki,kd/kp,ki,kd" of speed and of heading.
+
+ \return bool false if the text is not valid.
+ */
+bool infrared_parse_pid(const char *text, pid_gains_t *speed,
+		pid_gains_t *heading)
+{
+	const char *separator = strchr(text, '/');
+	char speed_text[64];
+
+	if ((NULL == separator) || ((size_t) (separator - text)
+			>= sizeof(speed_text)))
+		return false;
+	memcpy(speed_text, text, separator - text);
+	speed_text[separator - text] = '\0';
+
+	return pid_parse_gains(speed_text, speed) && pid_parse_gains(separator + 1,
+			heading);
+}
+
+/*!
+ \brief Set up the controllers of infrared mode with the configured gains, when entering the mode.
+ */
+void infrared_pid_start(WiicarInfraredPid_t *pid)
+{
+	pid_init(&pid->speed, &speed_gains, MAX_REVERSE_SPEED, MAX_FORWARD_SPEED);
+	pid_init(&pid->heading, &heading_gains, -MAX_LEFT_DIRECTION,
+			MAX_RIGHT_DIRECTION);
+	pid->reverse = false;
+}
+
+/*!
+ \brief How far past a frame the motor command computed from it takes effect.
+
+ The time the frame took to get here, half the mean round trip of the control board commands, and the
+ configured latency of the camera and the bluetooth link.
+
+ \return int32_t the latency in us, negative if prediction is disabled.
+ */
+int32_t infrared_prediction_time_us(uint64_t frame_time_us)
+{
+	const comm_latency_stats_t *latency = get_comm_latency();
+	uint64_t now = get_tick_count_us();
+	int32_t lead_us = prediction_lead_us;
+
+	if (lead_us < 0)
+		return -1;
+
+	if (now > frame_time_us)
+		lead_us += now - frame_time_us;
+	if (latency->count)
+		lead_us += latency->total_us / latency->count / 2;
+	return lead_us;
+}
+
 int32_t stop_motors(void)
 {
 	return write_motor_levels(SPEED_NULL_VALUE, DIRECTION_NULL_VALUE);
 }
 
+/// \brief Limits of the motor levels, WIICAR_MOTION_DEFAULT_LIMITS.
+static motion_limits_t speed_limits =
+{ 1024, 8192 };
+static motion_limits_t direction_limits =
+{ 4096, 32767 };
+
 /*!
- @brief Compute motor levels based on accelerometer data.
+ \brief Parse the limits of the motor levels, "rate,rate_change/rate,rate_change" of speed and of
+ direction.
+
+ \return bool false if the text is not valid.
+ */
+bool motors_parse_limits(const char *text, motion_limits_t *speed,
+		motion_limits_t *direction)
+{
+	const char *separator = strchr(text, '/');
+	char speed_text[64];
+
+	if ((NULL == separator) || ((size_t) (separator - text)
+			>= sizeof(speed_text)))
+		return false;
+	memcpy(speed_text, text, separator - text);
+	speed_text[separator - text] = '\0';
+
+	return motion_parse_limits(speed_text, speed) && motion_parse_limits(
+			separator + 1, direction);
+}
+
+/*!
+ \brief Set the limits motors_profile_start() sets up.
+ */
+void motors_configure_limits(const motion_limits_t *speed,
+		const motion_limits_t *direction)
+{
+	speed_limits = *speed;
+	direction_limits = *direction;
+}
+
+/*!
+ \brief Set up the motion profile of the motor levels with the configured limits, when entering a
+ mode with the motors stopped.
+ */
+void motors_profile_start(WiicarMotionProfile_t *profile)
+{
+	motion_axis_init(&profile->speed, &speed_limits, SPEED_NULL_VALUE);
+	motion_axis_init(&profile->direction, &direction_limits,
+			DIRECTION_NULL_VALUE);
+	profile->safe_stops = 0;
+}
+
+/*!
+ \brief Move the motor levels along their profile towards the levels a mode computed.
+
+ \param time_us time the levels are sent.
+ */
+void motors_profile_step(WiicarMotionProfile_t *profile, uint64_t time_us,
+		int32_t *speed_level, int32_t *direction_level)
+{
+	*speed_level = motion_axis_step(&profile->speed, time_us, *speed_level);
+	*direction_level = motion_axis_step(&profile->direction, time_us,
+			*direction_level);
+}
+
+/*!
+ @brief Send motor levels through the motion profile and the obstacle guard, the last stages of every
+ mode.
+
+ The levels move towards the ones given within the acceleration and jerk limits, over the time
+ since the last command.  The speed is then capped towards an object the range sensors see, at once
+ rather than along the profile.
+ */
+int32_t write_motor_levels_profiled(WiicarMotionProfile_t *profile,
+		struct WiicarObstacleGuard_t *obstacles, int32_t speed_level,
+		int32_t direction_level)
+{
+	const uint64_t now = get_tick_count_us();
+	WiicarSensorSample_t sample;
+	int32_t ret_val;
+
+	motors_profile_step(profile, now, &speed_level, &direction_level);
+	if (!obstacle_guard_limit(obstacles, now, &speed_level, &sample))
+		return write_motor_levels(speed_level, direction_level);
+
+	// once clear the speed ramps up again from the cap
+	motion_axis_reset(&profile->speed, speed_level);
+	ret_val = write_motor_levels(speed_level, direction_level);
+	if (ERR_NONE == ret_val)
+		obstacle_record_reaction(obstacles, &sample);
+	return ret_val;
+}
+
+/*!
+ @brief Stop the motors at once, and the profile with them.
+ */
+int32_t stop_motors_profiled(WiicarMotionProfile_t *profile)
+{
+	motion_axis_reset(&profile->speed, SPEED_NULL_VALUE);
+	motion_axis_reset(&profile->direction, DIRECTION_NULL_VALUE);
+	return stop_motors();
+}
+
+/*!
+ @brief Stop the car of another thread, ahead of any command that thread is about to send.
+ */
+int32_t stop_motors_priority(control_board_session_t *session)
+{
+	return write_motor_levels_priority(session, SPEED_NULL_VALUE,
+			DIRECTION_NULL_VALUE);
+}
 
- The pitch forward and back controls the speed, the roll left-right controls the direction.
+/// \brief Accelerometer filter of acceleration mode.
+static WiicarAccelFilterType_t accel_filter_type = WIICAR_ACCEL_FILTER_IIR;
+static uint8_t accel_filter_shift = WIICAR_ACCEL_FILTER_DEFAULT_SHIFT;
 
+/*!
+ \brief Set the filter accel_filter_start() sets up for acceleration mode.
+ */
+void accel_configure_filter(WiicarAccelFilterType_t type, uint8_t shift)
+{
+	accel_filter_type = type;
+	accel_filter_shift = shift;
+}
+
+/*!
+ \brief Set up the configured filter, when entering acceleration mode.
  */
-int32_t computer_motor_levels_accel(
-		volatile struct WiimoteStatusDataType *wiimote_status)
+void accel_filter_start(struct WiicarAccelFilter_t *filter)
+{
+	accel_filter_init(filter, accel_filter_type, accel_filter_shift);
+}
+
+/*!
+ @brief Compute motor levels based on accelerometer data.
+
+ The pitch forward and back controls the speed, the roll left-right controls the direction.  The
+ normalized acceleration is filtered before it is scaled, so the levels do not change by a few
+ counts on every report.
+ */
+void compute_motor_levels_accel(
+		struct WiimoteStatusDataType *wiimote_status,
+		struct WiicarAccelFilter_t *filter, int32_t *speed_level,
+		int32_t *direction_level)
 {
 	int32_t speed;
 	int32_t direction;
 
 	normalize_accel(wiimote_status);
+	accel_filter_apply(filter, &wiimote_status->accel_computed_data);
 
 	speed = -wiimote_status->accel_computed_data.accel_normalized[Y_AXIS];
 	speed *= 3;
@@ -54,10 +281,8 @@ int32_t computer_motor_levels_accel(
 	wiimote_status->accel_computed_data.yaw = determine_yaw(
 			&wiimote_status->accel_computed_data);
 
-#if _DEBUG
-	printf("%u: Accel (p,r,y): %d %d %d\n", get_tick_count(), wiimote_status->accel_computed_data.pitch / 100,
+	debug_log("%u: Accel (p,r,y): %d %d %d\n", get_tick_count(), wiimote_status->accel_computed_data.pitch / 100,
 			wiimote_status->accel_computed_data.roll / 100, wiimote_status->accel_computed_data.yaw / 100 );
-#endif
 
 	direction *= 3;
 	direction /= 2;
@@ -66,7 +291,8 @@ int32_t computer_motor_levels_accel(
 			WIICAR_ACCEL_SCALING_VALUE, DIRECTION_NULL_VALUE,
 			MIN_DIRECTION_MOTOR, MAX_DIRECTION_MOTOR);
 
-	return write_motor_levels(speed, direction);
+	*speed_level = speed;
+	*direction_level = direction;
 }
 
 /*!
@@ -81,33 +307,42 @@ int32_t computer_motor_levels_accel(
  orientation as the wiimote.  This means that for distances far from the center, phi will be
  the dominant control variable, while for points near the center, theta will dominate.
 
+ The control uses the pose of the tracker rather than the raw values of each frame, so jitter is
+ smoothed and the car keeps going through a dropout of up to WIICAR_POSE_COAST_US.  The motors are
+ only stopped once the tracker has lost the car.  Unless disabled, the pose is predicted ahead to
+ when the command takes effect, see infrared_prediction_time_us().
+
+ Speed and steering come from PID controllers on the distance and on phi, stepped at the time of
+ each frame.  With the default, proportional only gains this is the original control law.
+
 
  \param WiimoteIrRawData pointer to data containing wiimote ir status.  Must contain distance, theta,
  phi and WiimoteIrStatus.
 
  \param WiimoteIrComputedData Will contain calculated IR values.
 
- \param LedData a pointer to the LedData, this function uses the Leds to inform the user if invalid
- infrared data is present (the camera is unable to see all three leds).
+ \param tracker pose tracker of the car, reset when entering infrared mode.
 
- \return bool returns true if the function succeeds in sending motor command, false if it fails.
+ \param pid controllers of the car, set up with infrared_pid_start() when entering infrared mode.
+
+ \param valid_points set if the camera sees the three leds in this frame, with or without a fourth point.
+
+ \return bool false if the car is lost and the motors are to be stopped.
  */
-int32_t WiiComputeMotorLevelsInfrared(
-		volatile struct WiimoteStatusDataType *wiimote_status,
-		bool *valid_points)
+bool compute_motor_levels_infrared(struct WiimoteStatusDataType *wiimote_status,
+		struct WiicarPoseTracker_t *tracker, WiicarInfraredPid_t *pid,
+		bool *valid_points, int32_t *speed_level, int32_t *direction_level)
 {
 	uint32_t distance;
 	int32_t direction;
 	int32_t speed;
+	int32_t lead_us;
+	bool reverse;
 
-	// compute derived data
-
-	count_ir_points(&wiimote_status->ir_computed_data,
-			&wiimote_status->ir_raw_data);
-
-	/// @todo MED: change this function to be able to use 3 or 4 IR points. May have to sort data by spot size first
-	if (wiimote_status->ir_computed_data.count == 3) // currently all IR calculations are only valid if exactly three IR points are seen.
+	// compute derived data, the three largest of up to four points are the leds
 
+	if (pose_tracker_update(tracker, wiimote_status->timestamp_us,
+			&wiimote_status->ir_raw_data, &wiimote_status->ir_computed_data))
 	{
 		wiimote_status->ir_computed_data.WiimoteIRStatus =
 				WII_IR_STATUS_VALID_DATA;
@@ -118,15 +353,20 @@ int32_t WiiComputeMotorLevelsInfrared(
 				WII_IR_STATUS_INVALID_DATA;
 	}
 
+	*valid_points = (wiimote_status->ir_computed_data.count
+			>= WIICAR_IR_NUMBER_OF_POINTS);
+
 	if (wiimote_status->ir_computed_data.WiimoteIRStatus
 			== WII_IR_STATUS_INVALID_DATA)
 	{
-		return stop_motors();
+		return false;
 	}
 	else
 	{
-		compute_ir_data(&wiimote_status->ir_raw_data,
-				&wiimote_status->ir_computed_data);
+		lead_us = infrared_prediction_time_us(wiimote_status->timestamp_us);
+		if (lead_us >= 0)
+			pose_tracker_output_at(tracker, wiimote_status->timestamp_us
+					+ lead_us, &wiimote_status->ir_computed_data);
 
 		distance = wiimote_status->ir_computed_data.distance;
 		direction = wiimote_status->ir_computed_data.phi;
@@ -136,20 +376,28 @@ int32_t WiiComputeMotorLevelsInfrared(
 			distance = MAX_IR_DISTANCE;
 		}
 
-		if ((direction < (-90 * WIICAR_DEGREE_SCALING))
-				|| (direction > (90 * WIICAR_DEGREE_SCALING))) // needs to be run in reverse
-
+		reverse = (direction < (-90 * WIICAR_DEGREE_SCALING))
+				|| (direction > (90 * WIICAR_DEGREE_SCALING)); // needs to be run in reverse
+		if (reverse)
 		{
-			speed = (distance * MAX_REVERSE_SPEED) / MAX_IR_DISTANCE;
 			direction += (180 * WIICAR_DEGREE_SCALING);
-			direction = cap_angle(direction, 180, 360, WIICAR_DEGREE_SCALING);
+			direction = wrap_angle(direction);
 		}
-		else
-		{
-			speed = (distance * MAX_FORWARD_SPEED) / MAX_IR_DISTANCE;
-		}
-		direction = ComputeDirectionMotor(direction);
-		return write_motor_levels(speed, direction);
+
+		// the heading error jumps by 180 degrees when the car changes direction
+		if (reverse != pid->reverse)
+			pid_reset(&pid->heading);
+		pid->reverse = reverse;
+
+		// the distance is to come down to 0, phi is the steering the car needs
+		speed = pid_update(&pid->speed, wiimote_status->timestamp_us, 0,
+				-(int32_t) distance);
+		direction = pid_update(&pid->heading, wiimote_status->timestamp_us, 0,
+				-direction);
+
+		*speed_level = reverse ? -speed : speed;
+		*direction_level = ComputeDirectionMotor(direction);
+		return true;
 	}
 }
 
@@ -159,3 +407,127 @@ int32_t ComputeDirectionMotor(int32_t Direction)
 			DIRECTION_NULL_VALUE, MIN_DIRECTION_MOTOR, MAX_DIRECTION_MOTOR);
 }
 
+/*!
+ @brief Compute motor levels from the buttons: 2 forward, 1 reverse, both brake, the pad steers.
+
+ The buttons pick full speed and full lock, the motion profile ramps the motors towards them.
+
+ \return bool false if no drive button is held and the car is to be stopped.
+ */
+bool compute_motor_levels_buttons(
+		const struct WiimoteStatusDataType *wiimote_status,
+		int32_t *speed_level, int32_t *direction_level)
+{
+	const uint16_t buttons = wiimote_status->button_data;
+	int32_t direction = 0;
+
+	if ((buttons & CWIID_BTN_2) && (buttons & CWIID_BTN_1))
+		*speed_level = SPEED_NULL_VALUE;
+	else if (buttons & CWIID_BTN_2)
+		*speed_level = MAX_FORWARD_SPEED;
+	else if (buttons & CWIID_BTN_1)
+		*speed_level = MAX_REVERSE_SPEED;
+	else
+	{
+		*speed_level = SPEED_NULL_VALUE;
+		*direction_level = DIRECTION_NULL_VALUE;
+		return false;
+	}
+
+	if (buttons & CWIID_BTN_UP)
+		direction = -MAX_LEFT_DIRECTION;
+	else if (buttons & CWIID_BTN_DOWN)
+		direction = MAX_RIGHT_DIRECTION;
+
+	*direction_level = ComputeDirectionMotor(direction);
+	return true;
+}
+
+/*
+ * The laws as control_law_drive() runs them.  Each calls its computation directly, with the limits
+ * of the car compiled in; only the call into the law goes through a pointer.
+ */
+
+static void control_accel_start(WiicarControlState_t *state)
+{
+	accel_filter_start(&state->accel);
+}
+
+static bool control_accel_compute(WiicarControlState_t *state,
+		WiimoteStatusDataType *snapshot, int32_t *speed_level,
+		int32_t *direction_level)
+{
+	compute_motor_levels_accel(snapshot, &state->accel, speed_level,
+			direction_level);
+	return true;
+}
+
+static void control_infrared_start(WiicarControlState_t *state)
+{
+	pose_tracker_reset(&state->infrared.tracker);
+	infrared_pid_start(&state->infrared.pid);
+}
+
+static bool control_infrared_compute(WiicarControlState_t *state,
+		WiimoteStatusDataType *snapshot, int32_t *speed_level,
+		int32_t *direction_level)
+{
+	bool valid_points;
+
+	return compute_motor_levels_infrared(snapshot, &state->infrared.tracker,
+			&state->infrared.pid, &valid_points, speed_level, direction_level);
+}
+
+static void control_buttons_start(WiicarControlState_t *state)
+{
+	(void) state;
+}
+
+static bool control_buttons_compute(WiicarControlState_t *state,
+		WiimoteStatusDataType *snapshot, int32_t *speed_level,
+		int32_t *direction_level)
+{
+	(void) state;
+	return compute_motor_levels_buttons(snapshot, speed_level, direction_level);
+}
+
+const WiicarControlLaw_t control_law_accel =
+{ "accel", control_accel_start, control_accel_compute };
+
+const WiicarControlLaw_t control_law_infrared =
+{ "infrared", control_infrared_start, control_infrared_compute };
+
+const WiicarControlLaw_t control_law_buttons =
+{ "buttons", control_buttons_start, control_buttons_compute };
+
+/*!
+ @brief Run a control law on the newest frame and send its levels through the motion profile and the
+ obstacle guard.
+
+ \param safe_stops number of stops the watchdog issued to the car so far.  If it changed since the
+ last command the motors were stopped behind the profile's back, the profile then starts again from
+ standstill rather than from the levels before the stall.
+ \param driving cleared if the law stopped the car, the motors are then stopped at once.
+ \return int32_t result of the control board command.
+ */
+int32_t control_law_drive(const WiicarControlLaw_t *law,
+		WiicarControlState_t *state, WiicarMotionProfile_t *profile,
+		WiicarObstacleGuard_t *obstacles, WiimoteStatusDataType *snapshot,
+		uint32_t safe_stops, bool *driving)
+{
+	int32_t speed;
+	int32_t direction;
+
+	if (safe_stops != profile->safe_stops)
+	{
+		motion_axis_reset(&profile->speed, SPEED_NULL_VALUE);
+		motion_axis_reset(&profile->direction, DIRECTION_NULL_VALUE);
+		profile->safe_stops = safe_stops;
+	}
+
+	*driving = law->compute(state, snapshot, &speed, &direction);
+	if (!*driving)
+		return stop_motors_profiled(profile);
+	return write_motor_levels_profiled(profile, obstacles, speed, direction);
+}
+
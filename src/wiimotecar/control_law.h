@@ -0,0 +1,55 @@
+/*!
+ \file
+
+ \brief Control laws: how each mode turns the snapshot of the newest frame into motor levels.
+
+ */
+
+#ifndef CONTROL_LAW_H_
+#define CONTROL_LAW_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wiicar.h"
+#include "wiicar_math.h"
+#include "wiicar_obstacle.h"
+
+/*!
+ \brief What a control law keeps from frame to frame, set up by its start().
+ */
+typedef union WiicarControlState_t
+{
+	WiicarAccelFilter_t accel; ///< acceleration mode
+	struct
+	{
+		WiicarPoseTracker_t tracker;
+		WiicarInfraredPid_t pid;
+	} infrared; ///< infrared mode
+} WiicarControlState_t;
+
+/*!
+ \brief A control law, from the snapshot of a frame to the speed level and the direction motor level.
+
+ The time of the frame is in the snapshot, laws that work over time step by it.  compute() returns
+ false when the car is to be stopped at once.
+ */
+typedef struct WiicarControlLaw_t
+{
+	const char *name;
+	void (*start)(WiicarControlState_t *state);
+	bool (*compute)(WiicarControlState_t *state,
+			WiimoteStatusDataType *snapshot, int32_t *speed_level,
+			int32_t *direction_level);
+} WiicarControlLaw_t;
+
+extern const WiicarControlLaw_t control_law_accel;
+extern const WiicarControlLaw_t control_law_infrared;
+extern const WiicarControlLaw_t control_law_buttons;
+
+int32_t control_law_drive(const WiicarControlLaw_t *law,
+		WiicarControlState_t *state, WiicarMotionProfile_t *profile,
+		WiicarObstacleGuard_t *obstacles, WiimoteStatusDataType *snapshot,
+		uint32_t safe_stops, bool *driving);
+
+#endif /* CONTROL_LAW_H_ */
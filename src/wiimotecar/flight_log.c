@@ -0,0 +1,811 @@
+/*!
+ \file
+
+ \brief wiicarflightlog: prints the last seconds of a flight recorder file.
+
+ The file may come from a host of the other byte order, e.g. copied off the router, the header tells.
+
+ With -r the IR frames of the window are replayed through the batch IR kernel instead, printing the
+ distance, theta and phi the control loop would have computed for each.  With -t as well, they are
+ also run through the pose tracker as infrared mode does, and the steering of the raw and tracked
+ values is compared.
+
+ With -a the accelerometer frames of the window are replayed through acceleration mode's filter
+ settings instead, comparing how often and how far the motor command changes.
+
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <byteswap.h>
+#include <wiicarutility/error_message.h>
+
+#include "flight_recorder.h"
+#include "wiicar_math.h"
+#include "wiicar_ir_batch.h"
+#include "wiicar.h"
+
+#define DEFAULT_SECONDS 10
+
+static bool swapped = false;
+
+static uint16_t file16(uint16_t x)
+{
+	return swapped ? bswap_16(x) : x;
+}
+
+static uint32_t file32(uint32_t x)
+{
+	return swapped ? bswap_32(x) : x;
+}
+
+static uint64_t file64(uint64_t x)
+{
+	return swapped ? bswap_64(x) : x;
+}
+
+static void print_time(const FlightRecorderHeader_t *header,
+		uint64_t timestamp_us)
+{
+	uint64_t wall_us = file64(header->start_time_us) + timestamp_us;
+	time_t seconds = wall_us / 1000000;
+	struct tm *local = localtime(&seconds);
+	char text[32];
+
+	strftime(text, sizeof(text), "%H:%M:%S", local);
+	printf("%s.%06u", text, (uint32_t) (wall_us % 1000000));
+}
+
+static void print_record(const FlightRecorderHeader_t *header,
+		const FlightRecord_t *record)
+{
+	char error_string[64];
+	char text[FLIGHT_RECORD_TEXT_SIZE + 1];
+	int32_t error;
+	uint8_t i;
+
+	print_time(header, file64(record->timestamp_us));
+	printf(" car %d ", record->car);
+
+	switch (record->type)
+	{
+	case FLIGHT_RECORD_FRAME:
+		printf("frame buttons=%.4X acc=%u,%u,%u ir=",
+				file16(record->data.frame.buttons), record->data.frame.accel[0],
+				record->data.frame.accel[1], record->data.frame.accel[2]);
+		for (i = 0; i < 4; i++)
+		{
+			if (record->data.frame.ir_valid & (1 << i))
+				printf("(%u,%u,%d)", file16(record->data.frame.ir_pos[i][0]),
+						file16(record->data.frame.ir_pos[i][1]),
+						record->data.frame.ir_size[i]);
+		}
+		printf("\n");
+		break;
+	case FLIGHT_RECORD_ACCEL:
+		printf("accel pitch=%d roll=%d yaw=%d\n",
+				(int32_t) file32(record->data.accel.pitch),
+				(int32_t) file32(record->data.accel.roll),
+				(int32_t) file32(record->data.accel.yaw));
+		break;
+	case FLIGHT_RECORD_IR:
+		printf("ir theta=%d phi=%d distance=%u\n",
+				(int32_t) file32(record->data.ir.theta),
+				(int32_t) file32(record->data.ir.phi),
+				file32(record->data.ir.distance));
+		break;
+	case FLIGHT_RECORD_COMMAND:
+		memcpy(text, record->data.command.text, FLIGHT_RECORD_TEXT_SIZE);
+		text[FLIGHT_RECORD_TEXT_SIZE] = '\0';
+		printf("command \"%s\" result=%d latency=%uus\n", text,
+				(int32_t) file32(record->data.command.result),
+				file32(record->data.command.latency_us));
+		break;
+	case FLIGHT_RECORD_ERROR:
+		error = file32(record->data.error.error);
+		format_error_string(error, error_string);
+		printf("error %d: %s\n", error, error_string);
+		break;
+	case FLIGHT_RECORD_CALIBRATION:
+		printf("calibration zero=%u,%u,%u one=%u,%u,%u\n",
+				record->data.calibration.zero[0],
+				record->data.calibration.zero[1],
+				record->data.calibration.zero[2],
+				record->data.calibration.one[0],
+				record->data.calibration.one[1],
+				record->data.calibration.one[2]);
+		break;
+	default:
+		printf("unknown record type %u\n", record->type);
+		break;
+	}
+}
+
+/// \brief ir_valid of a frame compute_ir_data() accepts: exactly the first three points.
+#define REPLAY_IR_VALID 0x07
+
+static void frame_ir_points(const FlightRecord_t *frame,
+		struct WiimoteIrRawData_t *raw)
+{
+	uint8_t i;
+
+	for (i = 0; i < WIICAR_NUMBER_OF_MAX_IR_POINTS; i++)
+	{
+		raw->WiimoteIRPoint[i].valid = (frame->data.frame.ir_valid >> i) & 1;
+		raw->WiimoteIRPoint[i].pos[0] = file16(frame->data.frame.ir_pos[i][0]);
+		raw->WiimoteIRPoint[i].pos[1] = file16(frame->data.frame.ir_pos[i][1]);
+		raw->WiimoteIRPoint[i].size = frame->data.frame.ir_size[i];
+	}
+}
+
+/*!
+ \brief Feeds one frame to the pose tracker as infrared mode does.
+
+ \return bool whether the pose is tracked, and computed filled in.
+ */
+static bool track_frame(WiicarPoseTracker_t *tracker,
+		const FlightRecord_t *frame, struct WiimoteIRComputedData_t *computed)
+{
+	struct WiimoteIrRawData_t raw;
+
+	frame_ir_points(frame, &raw);
+	return pose_tracker_update(tracker, file64(frame->timestamp_us), &raw,
+			computed);
+}
+
+/*!
+ \brief Computes the raw, untracked IR values of one frame.
+
+ \return bool whether the frame shows three points or more, and computed filled in.
+ */
+static bool measure_frame(const FlightRecord_t *frame,
+		struct WiimoteIRComputedData_t *computed)
+{
+	struct WiimoteIrRawData_t raw, selected;
+
+	frame_ir_points(frame, &raw);
+	if (select_ir_points(&raw, &selected) < WIICAR_IR_NUMBER_OF_POINTS)
+		return false;
+	compute_ir_data(&selected, computed);
+	return true;
+}
+
+/// \brief Pose tracker and steering history of one car.
+typedef struct ReplayTrack_t
+{
+	WiicarPoseTracker_t tracker;
+	int32_t last_raw;
+	int32_t last_tracked;
+	bool last_raw_valid;
+	bool last_tracked_valid;
+} ReplayTrack_t;
+
+/*!
+ \brief Runs the frames through the pose tracker of their car and prints the tracked values.
+
+ Steering jitter is the mean change of phi from one frame to the next, over the frames where the
+ control loop steers, with the raw phi of the frames that show exactly three points and with the
+ tracked phi.  The tracker also uses the frames with a fourth point.
+
+ \param frames every frame of the window.
+ \param output batch kernel output of the frames that see all three leds, in order.
+ */
+static void replay_tracker(const FlightRecorderHeader_t *header,
+		const FlightRecord_t **frames, uint32_t count,
+		const WiicarIrBatchOutput_t *output)
+{
+	static ReplayTrack_t tracks[256];
+	ReplayTrack_t *track;
+	struct WiimoteIRComputedData_t computed;
+	struct timespec start, end;
+	uint64_t raw_jitter = 0, tracked_jitter = 0;
+	uint32_t i, measured = 0, carried = 0, raw_steps = 0, tracked_steps = 0;
+	bool seen, valid;
+
+	// timed on its own, without the printing
+	for (i = 0; i < 256; i++)
+		pose_tracker_reset(&tracks[i].tracker);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < count; i++)
+		track_frame(&tracks[(uint8_t) frames[i]->car].tracker, frames[i],
+				&computed);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	memset(tracks, 0, sizeof(tracks));
+	for (i = 0; i < 256; i++)
+		pose_tracker_reset(&tracks[i].tracker);
+	for (i = 0; i < count; i++)
+	{
+		track = &tracks[(uint8_t) frames[i]->car];
+		seen = (REPLAY_IR_VALID == frames[i]->data.frame.ir_valid);
+
+		if (seen)
+		{
+			if (track->last_raw_valid)
+			{
+				raw_jitter += abs(wrap_angle(output->phi[measured]
+						- track->last_raw));
+				raw_steps++;
+			}
+			track->last_raw = output->phi[measured++];
+		}
+		track->last_raw_valid = seen;
+
+		valid = track_frame(&track->tracker, frames[i], &computed);
+		print_time(header, file64(frames[i]->timestamp_us));
+		if (valid)
+		{
+			printf(" car %d track distance=%u theta=%d phi=%d\n", frames[i]->car,
+					computed.distance, computed.theta, computed.phi);
+			if (track->last_tracked_valid)
+			{
+				tracked_jitter += abs(wrap_angle(computed.phi
+						- track->last_tracked));
+				tracked_steps++;
+			}
+			track->last_tracked = computed.phi;
+			if (computed.count < WIICAR_IR_NUMBER_OF_POINTS)
+				carried++;
+		}
+		else
+			printf(" car %d track lost\n", frames[i]->car);
+		track->last_tracked_valid = valid;
+	}
+
+	fprintf(stderr, "%u frames, %u carried through dropouts, %.1f ns per update\n",
+			count, carried, count ? ((end.tv_sec - start.tv_sec) * 1e9
+					+ (end.tv_nsec - start.tv_nsec)) / count : 0.0);
+	fprintf(stderr, "steering jitter: raw %.2f, tracked %.2f degrees per frame\n",
+			raw_steps ? raw_jitter / (100.0 * raw_steps) : 0.0,
+			tracked_steps ? tracked_jitter / (100.0 * tracked_steps) : 0.0);
+}
+
+/// \brief Steering of one frame, as measured, as tracked and as predicted ahead.
+typedef struct ReplaySteering_t
+{
+	uint64_t time_us;
+	int32_t measured_phi;
+	int32_t phi;
+	int32_t predicted_phi;
+	bool measured;
+	bool valid;
+} ReplaySteering_t;
+
+/*!
+ \brief Compares the steering of the tracked and of the predicted pose with where the car was when the command took effect.
+
+ A command computed from a frame takes effect lead_us later.  Its steering error is the difference
+ between its phi and the measured phi of the car's first frame at or after that time.  The
+ measurement noise adds to both errors alike, the lag of the command makes the difference.
+
+ \return int 0, or 4 if out of memory.
+ */
+static int replay_prediction(const FlightRecord_t **frames, uint32_t count,
+		uint32_t lead_us)
+{
+	static WiicarPoseTracker_t trackers[256];
+	ReplaySteering_t *steering = calloc(count + 1, sizeof(*steering));
+	struct WiimoteIRComputedData_t computed, predicted;
+	uint64_t tracked_error = 0, predicted_error = 0;
+	uint32_t i, j, samples = 0, tracked_worst = 0, predicted_worst = 0, error;
+
+	if (NULL == steering)
+	{
+		fprintf(stderr, "out of memory\n");
+		return 4;
+	}
+
+	for (i = 0; i < 256; i++)
+		pose_tracker_reset(&trackers[i]);
+	for (i = 0; i < count; i++)
+	{
+		WiicarPoseTracker_t *tracker = &trackers[(uint8_t) frames[i]->car];
+
+		steering[i].time_us = file64(frames[i]->timestamp_us);
+		steering[i].measured = measure_frame(frames[i], &computed);
+		steering[i].measured_phi = computed.phi;
+		steering[i].valid = track_frame(tracker, frames[i], &computed);
+		if (!steering[i].valid)
+			continue;
+		pose_tracker_output_at(tracker, steering[i].time_us + lead_us,
+				&predicted);
+		steering[i].phi = computed.phi;
+		steering[i].predicted_phi = predicted.phi;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if (!steering[i].valid)
+			continue;
+
+		for (j = i + 1; (j < count) && ((frames[j]->car != frames[i]->car)
+				|| (steering[j].time_us < steering[i].time_us + lead_us)); j++)
+			;
+		if ((j == count) || !steering[j].measured)
+			continue;
+
+		error = abs(wrap_angle(steering[i].phi - steering[j].measured_phi));
+		tracked_error += error;
+		if (error > tracked_worst)
+			tracked_worst = error;
+
+		error = abs(wrap_angle(steering[i].predicted_phi
+				- steering[j].measured_phi));
+		predicted_error += error;
+		if (error > predicted_worst)
+			predicted_worst = error;
+		samples++;
+	}
+
+	fprintf(stderr, "steering error %u ms later, mean/worst: tracked %.2f/%.2f, "
+		"predicted %.2f/%.2f degrees\n", lead_us / 1000, samples ? tracked_error
+			/ (100.0 * samples) : 0.0, tracked_worst / 100.0,
+			samples ? predicted_error / (100.0 * samples) : 0.0,
+			predicted_worst / 100.0);
+
+	free(steering);
+	return 0;
+}
+
+/*!
+ \brief Replays the IR frames among the given frame records through the batch IR kernel.
+
+ \param verify also run the scalar kernel and count the frames that differ.
+ \param track run the frames through the pose tracker as well, see replay_tracker().
+ \param lead_ms if not negative, evaluate predicting this far ahead, see replay_prediction().
+ \return int 0, or 4 if the kernel is not available or a frame differs.
+ */
+static int replay_ir(const FlightRecorderHeader_t *header,
+		const FlightRecord_t **records, uint32_t record_count,
+		WiicarIrBatchKernel_t kernel, bool verify, bool track, int32_t lead_ms)
+{
+	const FlightRecord_t **frames = calloc(record_count + 1, sizeof(*frames));
+	uint32_t count = 0;
+	// 6 input and 2 x 7 output arrays of coordinates, 2 x 3 of angles, each count long
+	uint16_t *coordinates = calloc(20 * (size_t) record_count + 1,
+			sizeof(uint16_t));
+	int32_t *angles = calloc(6 * (size_t) record_count + 1, sizeof(int32_t));
+	WiicarIrBatchInput_t input;
+	WiicarIrBatchOutput_t output[2];
+	struct timespec start, end;
+	uint32_t i, mismatches = 0;
+	uint8_t j, k;
+	int ret_val = 0;
+
+	if ((NULL == frames) || (NULL == coordinates) || (NULL == angles))
+	{
+		fprintf(stderr, "out of memory\n");
+		ret_val = 4;
+		goto done;
+	}
+
+	for (i = 0; i < record_count; i++)
+	{
+		if (REPLAY_IR_VALID == records[i]->data.frame.ir_valid)
+			frames[count++] = records[i];
+	}
+
+	for (j = 0; j < 3; j++)
+	{
+		uint16_t *x = &coordinates[(2 * j) * count];
+		uint16_t *y = &coordinates[(2 * j + 1) * count];
+
+		for (i = 0; i < count; i++)
+		{
+			x[i] = file16(frames[i]->data.frame.ir_pos[j][0]);
+			y[i] = file16(frames[i]->data.frame.ir_pos[j][1]);
+		}
+		input.x[j] = x;
+		input.y[j] = y;
+	}
+
+	for (k = 0; k < 2; k++)
+	{
+		output[k].front_x = &coordinates[(6 + 7 * k) * count];
+		output[k].front_y = output[k].front_x + count;
+		output[k].back_x = output[k].front_y + count;
+		output[k].back_y = output[k].back_x + count;
+		output[k].center_x = output[k].back_y + count;
+		output[k].center_y = output[k].center_x + count;
+		output[k].distance = output[k].center_y + count;
+		output[k].theta = &angles[(3 * k) * count];
+		output[k].temp_phi = output[k].theta + count;
+		output[k].phi = output[k].temp_phi + count;
+	}
+
+	if (IR_BATCH_KERNEL_AUTO == kernel)
+		kernel = ir_batch_best_kernel();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (ERR_NONE != ir_batch_compute(kernel, &input, &output[0], count))
+	{
+		fprintf(stderr, "%s kernel not available\n", ir_batch_kernel_name(
+				kernel));
+		ret_val = 4;
+		goto done;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (track)
+		replay_tracker(header, records, record_count, &output[0]);
+	else
+	{
+		for (i = 0; i < count; i++)
+		{
+			print_time(header, file64(frames[i]->timestamp_us));
+			printf(" car %d ir distance=%u theta=%d phi=%d\n", frames[i]->car,
+					output[0].distance[i], output[0].theta[i], output[0].phi[i]);
+		}
+	}
+
+	if ((lead_ms >= 0) && replay_prediction(records, record_count, lead_ms
+			* 1000))
+		ret_val = 4;
+
+	fprintf(stderr, "%u IR frames, %s kernel, %.1f ns per frame\n", count,
+			ir_batch_kernel_name(kernel), count ? ((end.tv_sec - start.tv_sec)
+					* 1e9 + (end.tv_nsec - start.tv_nsec)) / count : 0.0);
+
+	if (verify)
+	{
+		ir_batch_compute(IR_BATCH_KERNEL_SCALAR, &input, &output[1], count);
+		for (i = 0; i < count; i++)
+		{
+			if ((output[0].distance[i] != output[1].distance[i])
+					|| (output[0].theta[i] != output[1].theta[i])
+					|| (output[0].temp_phi[i] != output[1].temp_phi[i])
+					|| (output[0].phi[i] != output[1].phi[i]))
+				mismatches++;
+		}
+		fprintf(stderr, "%u frames differ from the scalar kernel\n",
+				mismatches);
+		if (mismatches)
+			ret_val = 4;
+	}
+
+	done: free(frames);
+	free(coordinates);
+	free(angles);
+	return ret_val;
+}
+
+/// \brief Filter settings compared by replay_accel(), the first is the unfiltered reference.
+static const struct
+{
+	WiicarAccelFilterType_t type;
+	uint8_t shift;
+	const char *name;
+} replay_filters[] =
+{
+{ WIICAR_ACCEL_FILTER_NONE, 0, "off" },
+{ WIICAR_ACCEL_FILTER_IIR, 1, "iir:2" },
+{ WIICAR_ACCEL_FILTER_IIR, 2, "iir:4" },
+{ WIICAR_ACCEL_FILTER_IIR, 3, "iir:8" },
+{ WIICAR_ACCEL_FILTER_AVERAGE, 1, "avg:2" },
+{ WIICAR_ACCEL_FILTER_AVERAGE, 2, "avg:4" },
+{ WIICAR_ACCEL_FILTER_AVERAGE, 3, "avg:8" }, };
+
+#define REPLAY_FILTER_COUNT (sizeof(replay_filters) / sizeof(replay_filters[0]))
+
+/// \brief Acceleration mode of one car during an accelerometer replay.
+typedef struct ReplayAccel_t
+{
+	WiimoteStatusDataType status;
+	WiicarAccelFilter_t filter;
+	bool calibrated;
+	bool commanded; ///< last_speed and last_direction are set
+	int32_t last_speed;
+	int32_t last_direction;
+} ReplayAccel_t;
+
+/*!
+ \brief Runs the frames through compute_motor_levels_accel() with one filter setting.
+
+ \param levels speed and direction of each replayed frame, two per record.
+ \param commanded set for each frame that was replayed.
+ \return double ns per replayed frame.
+ */
+static double replay_accel_filter(const FlightRecord_t **records,
+		uint32_t count, WiicarAccelFilterType_t type, uint8_t shift,
+		int32_t *levels, bool *commanded)
+{
+	static ReplayAccel_t cars[256];
+	ReplayAccel_t *car;
+	struct timespec start, end;
+	uint32_t i, frames = 0;
+	uint8_t j;
+
+	memset(cars, 0, sizeof(cars));
+	memset(commanded, 0, count * sizeof(*commanded));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < count; i++)
+	{
+		car = &cars[(uint8_t) records[i]->car];
+		if (FLIGHT_RECORD_CALIBRATION == records[i]->type)
+		{
+			for (j = 0; j < 3; j++)
+			{
+				car->status.accel_cal_data.zero[j]
+						= records[i]->data.calibration.zero[j];
+				car->status.accel_cal_data.one[j]
+						= records[i]->data.calibration.one[j];
+			}
+			build_accel_table(&car->status);
+			// the filter carries on over a recalibration, as it does in acceleration mode
+			if (!car->calibrated)
+				accel_filter_init(&car->filter, type, shift);
+			car->calibrated = true;
+			continue;
+		}
+		if (!car->calibrated)
+			continue;
+
+		for (j = 0; j < 3; j++)
+			car->status.accel_raw_data[j] = records[i]->data.frame.accel[j];
+		compute_motor_levels_accel(&car->status, &car->filter, &levels[2 * i],
+				&levels[2 * i + 1]);
+		commanded[i] = true;
+		frames++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return frames ? ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec
+			- start.tv_nsec)) / frames : 0.0;
+}
+
+/*!
+ \brief Replays the accelerometer frames through every filter setting of acceleration mode.
+
+ A car's frames are replayed from its first calibration record on, with its latest calibration.  For
+ each setting this prints how often the motor command changes from one frame to the next, how far
+ speed and direction move per frame, how far they are from the unfiltered command, which is the lag
+ of the filter while the wiimote is being tilted, and the time per frame of
+ compute_motor_levels_accel().
+
+ \param records the frame and calibration records of the window, in order.
+ \return int 0, or 4 if out of memory.
+ */
+static int replay_accel(const FlightRecord_t **records, uint32_t count)
+{
+	static ReplayAccel_t cars[256];
+	ReplayAccel_t *car;
+	int32_t *reference = calloc(4 * (size_t) count + 1, sizeof(int32_t));
+	int32_t *levels = reference + 2 * (size_t) count;
+	bool *commanded = calloc(count + 1, sizeof(bool));
+	uint64_t speed_step, direction_step, speed_lag, direction_lag;
+	uint32_t i, filter, frames, steps, changes;
+	double ns;
+
+	if ((NULL == reference) || (NULL == commanded))
+	{
+		fprintf(stderr, "out of memory\n");
+		free(reference);
+		free(commanded);
+		return 4;
+	}
+
+	replay_accel_filter(records, count, replay_filters[0].type,
+			replay_filters[0].shift, reference, commanded);
+
+	printf("filter frames changed_%% speed_step direction_step speed_lag direction_lag ns_per_frame\n");
+	for (filter = 0; filter < REPLAY_FILTER_COUNT; filter++)
+	{
+		ns = replay_accel_filter(records, count, replay_filters[filter].type,
+				replay_filters[filter].shift, levels, commanded);
+
+		memset(cars, 0, sizeof(cars));
+		speed_step = direction_step = speed_lag = direction_lag = 0;
+		frames = steps = changes = 0;
+		for (i = 0; i < count; i++)
+		{
+			if (!commanded[i])
+				continue;
+			car = &cars[(uint8_t) records[i]->car];
+
+			if (car->commanded)
+			{
+				speed_step += abs(levels[2 * i] - car->last_speed);
+				direction_step += abs(levels[2 * i + 1] - car->last_direction);
+				if ((levels[2 * i] != car->last_speed) || (levels[2 * i + 1]
+						!= car->last_direction))
+					changes++;
+				steps++;
+			}
+			car->last_speed = levels[2 * i];
+			car->last_direction = levels[2 * i + 1];
+			car->commanded = true;
+
+			speed_lag += abs(levels[2 * i] - reference[2 * i]);
+			direction_lag += abs(levels[2 * i + 1] - reference[2 * i + 1]);
+			frames++;
+		}
+
+		printf("%s %u %.1f %.2f %.2f %.2f %.2f %.1f\n",
+				replay_filters[filter].name, frames, steps ? 100.0 * changes
+						/ steps : 0.0, steps ? (double) speed_step / steps : 0.0,
+				steps ? (double) direction_step / steps : 0.0,
+				frames ? (double) speed_lag / frames : 0.0,
+				frames ? (double) direction_lag / frames : 0.0, ns);
+	}
+
+	free(reference);
+	free(commanded);
+	return 0;
+}
+
+static void usage(char *name)
+{
+	fprintf(stderr,
+			"usage: %s [-n seconds] [-r [-k kernel] [-v] [-t] [-l ms] | -a] [file]\n",
+			name);
+	fprintf(stderr, "  -n: print the last seconds of the recording (default %d)\n",
+			DEFAULT_SECONDS);
+	fprintf(stderr, "  -r: replay the IR frames through the batch IR kernel\n");
+	fprintf(stderr, "  -k: kernel, auto, scalar, sse2 or avx2 (default auto)\n");
+	fprintf(stderr, "  -v: check the kernel against the scalar kernel\n");
+	fprintf(stderr, "  -t: run the IR frames through the pose tracker\n");
+	fprintf(stderr, "  -l: compare the steering error of the tracked and predicted pose\n"
+		"      for commands taking effect ms after their frame\n");
+	fprintf(stderr, "  -a: compare the accelerometer filters of acceleration mode\n");
+	fprintf(stderr, "  file: defaults to %s\n", FLIGHT_RECORDER_DEFAULT_PATH);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = FLIGHT_RECORDER_DEFAULT_PATH;
+	uint32_t seconds = DEFAULT_SECONDS;
+	FlightRecorderHeader_t header;
+	FlightRecord_t *records;
+	uint32_t capacity, write_index, first, index;
+	uint64_t last_us = 0, timestamp_us;
+	const FlightRecord_t **frames = NULL;
+	uint32_t frame_count = 0;
+	WiicarIrBatchKernel_t kernel = IR_BATCH_KERNEL_AUTO;
+	bool replay = false, verify = false, track = false, accel = false;
+	int32_t lead_ms = -1;
+	FILE *file;
+	int opt, ret_val = 0;
+
+	while (-1 != (opt = getopt(argc, argv, "n:rk:vtl:a")))
+	{
+		switch (opt)
+		{
+		case 'n':
+			seconds = atoi(optarg);
+			break;
+		case 'r':
+			replay = true;
+			break;
+		case 'k':
+			for (kernel = IR_BATCH_KERNEL_AUTO; kernel
+					<= IR_BATCH_KERNEL_AVX2; kernel++)
+			{
+				if (0 == strcmp(optarg, ir_batch_kernel_name(kernel)))
+					break;
+			}
+			if (kernel > IR_BATCH_KERNEL_AVX2)
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'v':
+			verify = true;
+			break;
+		case 't':
+			track = true;
+			break;
+		case 'l':
+			lead_ms = atoi(optarg);
+			break;
+		case 'a':
+			accel = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		path = argv[optind];
+
+	file = fopen(path, "rb");
+	if (NULL == file)
+	{
+		perror(path);
+		return 2;
+	}
+
+	if (1 != fread(&header, sizeof(header), 1, file))
+	{
+		fprintf(stderr, "%s: no header\n", path);
+		return 3;
+	}
+
+	swapped = (bswap_32(FLIGHT_RECORDER_MAGIC) == header.magic);
+	if ((FLIGHT_RECORDER_MAGIC != file32(header.magic))
+			|| (FLIGHT_RECORDER_VERSION != file32(header.version))
+			|| (sizeof(FlightRecord_t) != file32(header.record_size)))
+	{
+		fprintf(stderr, "%s: not a flight recorder file of this version\n", path);
+		return 3;
+	}
+
+	capacity = file32(header.capacity);
+	write_index = file32(header.write_index);
+	if ((0 == capacity) || (capacity & (capacity - 1)))
+	{
+		fprintf(stderr, "%s: invalid capacity %u\n", path, capacity);
+		return 3;
+	}
+
+	records = calloc(capacity, sizeof(FlightRecord_t));
+	if ((NULL == records) || fseek(file, FLIGHT_RECORDER_HEADER_SIZE, SEEK_SET)
+			|| (capacity != fread(records, sizeof(FlightRecord_t), capacity,
+					file)))
+	{
+		fprintf(stderr, "%s: truncated\n", path);
+		return 3;
+	}
+	fclose(file);
+
+	first = (write_index > capacity) ? write_index - capacity : 0;
+
+	if (replay || accel)
+	{
+		frames = calloc(capacity, sizeof(*frames));
+		if (NULL == frames)
+		{
+			fprintf(stderr, "out of memory\n");
+			return 4;
+		}
+	}
+
+	// the newest complete record sets the end of the window
+	for (index = first; index != write_index; index++)
+	{
+		const FlightRecord_t *record = &records[index & (capacity - 1)];
+		if ((file32(record->sequence) == index + 1)
+				&& (file64(record->timestamp_us) > last_us))
+			last_us = file64(record->timestamp_us);
+	}
+
+	for (index = first; index != write_index; index++)
+	{
+		const FlightRecord_t *record = &records[index & (capacity - 1)];
+
+		// skip records torn by the crash or already overwritten
+		if (file32(record->sequence) != index + 1)
+			continue;
+
+		timestamp_us = file64(record->timestamp_us);
+		if (timestamp_us + (uint64_t) seconds * 1000000 < last_us)
+			continue;
+
+		if (!replay && !accel)
+			print_record(&header, record);
+		else if ((FLIGHT_RECORD_FRAME == record->type) || (accel
+				&& (FLIGHT_RECORD_CALIBRATION == record->type)))
+			frames[frame_count++] = record;
+	}
+
+	if (accel)
+	{
+		ret_val = replay_accel(frames, frame_count);
+		free(frames);
+	}
+	else if (replay)
+	{
+		ret_val = replay_ir(&header, frames, frame_count, kernel, verify,
+				track, lead_ms);
+		free(frames);
+	}
+
+	free(records);
+	return ret_val;
+}
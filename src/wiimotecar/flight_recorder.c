@@ -0,0 +1,253 @@
+/*!
+ \file
+
+ \brief Flight recorder: the last few thousand telemetry records, kept in a file that survives a crash.
+
+ The records are written into a shared memory mapping of a file on tmpfs, so recording a record is a
+ few stores and no system call, and whatever was written when the process died is still in the file.
+ The ring is shared by every thread: a writer claims a slot with an atomic increment of the write index
+ and marks the record complete by writing its sequence number last.
+
+ The previous file is kept with a .prev suffix when the recorder is opened, so a restart after a crash
+ does not overwrite the record of the crash.  Decode the file with wiicarflightlog.
+
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <wiicarutility/timestamp.h>
+
+#include "wiimote_frame.h"
+#include "flight_recorder.h"
+
+static FlightRecorderHeader_t *header = NULL;
+static FlightRecord_t *records = NULL;
+
+static const char *recorder_path = FLIGHT_RECORDER_DEFAULT_PATH;
+
+/*!
+ \brief Set the file flight_recorder_start() records into, an empty path disables the recorder.
+ */
+void flight_recorder_configure(const char *path)
+{
+	recorder_path = path;
+}
+
+/*!
+ \brief Open the configured file with the default capacity.
+
+ \return int32_t 0 on success or when disabled, otherwise -1 with errno set.
+ */
+int32_t flight_recorder_start(void)
+{
+	if ('\0' == recorder_path[0])
+		return 0;
+	return flight_recorder_open(recorder_path, FLIGHT_RECORDER_DEFAULT_CAPACITY);
+}
+
+/*!
+ \brief Create the ring file and start recording.
+
+ Must be called after init_tick_count().  Recording functions do nothing until the recorder is open.
+ The mapping is kept until the process exits.
+
+ \param capacity number of records, rounded down to a power of 2.
+ \return int32_t 0 on success, otherwise -1 with errno set.
+ */
+int32_t flight_recorder_open(const char *path, uint32_t capacity)
+{
+	char previous_path[256];
+	struct timeval now;
+	size_t mapping_size;
+	void *mapping;
+	int fd;
+
+	while (capacity & (capacity - 1))
+		capacity &= capacity - 1;
+	if (0 == capacity)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	snprintf(previous_path, sizeof(previous_path), "%s.prev", path);
+	rename(path, previous_path);
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (0 > fd)
+		return -1;
+
+	mapping_size = FLIGHT_RECORDER_HEADER_SIZE
+			+ (size_t) capacity * sizeof(FlightRecord_t);
+	if (ftruncate(fd, mapping_size))
+	{
+		close(fd);
+		return -1;
+	}
+
+	mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+			0);
+	close(fd);
+	if (MAP_FAILED == mapping)
+		return -1;
+
+	header = mapping;
+	records = (FlightRecord_t *) ((uint8_t *) mapping
+			+ FLIGHT_RECORDER_HEADER_SIZE);
+
+	gettimeofday(&now, NULL);
+	header->magic = FLIGHT_RECORDER_MAGIC;
+	header->version = FLIGHT_RECORDER_VERSION;
+	header->record_size = sizeof(FlightRecord_t);
+	header->capacity = capacity;
+	header->start_time_us = (uint64_t) now.tv_sec * 1000000 + now.tv_usec
+			- get_tick_count_us();
+	header->write_index = 0;
+
+	return 0;
+}
+
+static FlightRecord_t *claim_record(uint8_t type, int32_t car,
+		uint32_t *index)
+{
+	FlightRecord_t *record;
+
+	*index = __sync_fetch_and_add(&header->write_index, 1);
+	record = &records[*index & (header->capacity - 1)];
+
+	record->sequence = 0;
+	__sync_synchronize();
+
+	record->timestamp_us = get_tick_count_us();
+	record->type = type;
+	record->car = car;
+	record->reserved = 0;
+	return record;
+}
+
+static void commit_record(FlightRecord_t *record, uint32_t index)
+{
+	__sync_synchronize();
+	record->sequence = index + 1;
+}
+
+void flight_record_frame(int32_t car, const WiimoteFrame_t *frame)
+{
+	FlightRecord_t *record;
+	uint32_t index;
+	uint8_t i;
+
+	if (NULL == header)
+		return;
+
+	record = claim_record(FLIGHT_RECORD_FRAME, car, &index);
+	record->data.frame.buttons = frame->button_data;
+	for (i = 0; i < 3; i++)
+		record->data.frame.accel[i] = frame->accel_raw_data[i];
+	record->data.frame.ir_valid = 0;
+	for (i = 0; i < WIICAR_NUMBER_OF_MAX_IR_POINTS; i++)
+	{
+		if (frame->ir_raw_data.WiimoteIRPoint[i].valid)
+			record->data.frame.ir_valid |= 1 << i;
+		record->data.frame.ir_pos[i][0]
+				= frame->ir_raw_data.WiimoteIRPoint[i].pos[0];
+		record->data.frame.ir_pos[i][1]
+				= frame->ir_raw_data.WiimoteIRPoint[i].pos[1];
+		record->data.frame.ir_size[i]
+				= frame->ir_raw_data.WiimoteIRPoint[i].size;
+	}
+	commit_record(record, index);
+}
+
+void flight_record_accel(int32_t car, int32_t pitch, int32_t roll, int32_t yaw)
+{
+	FlightRecord_t *record;
+	uint32_t index;
+
+	if (NULL == header)
+		return;
+
+	record = claim_record(FLIGHT_RECORD_ACCEL, car, &index);
+	record->data.accel.pitch = pitch;
+	record->data.accel.roll = roll;
+	record->data.accel.yaw = yaw;
+	commit_record(record, index);
+}
+
+void flight_record_ir(int32_t car, int32_t theta, int32_t phi,
+		uint32_t distance)
+{
+	FlightRecord_t *record;
+	uint32_t index;
+
+	if (NULL == header)
+		return;
+
+	record = claim_record(FLIGHT_RECORD_IR, car, &index);
+	record->data.ir.theta = theta;
+	record->data.ir.phi = phi;
+	record->data.ir.distance = distance;
+	commit_record(record, index);
+}
+
+/*!
+ \brief Record a control board command.
+
+ Only the first FLIGHT_RECORD_TEXT_SIZE characters of the command are kept, enough for every motor
+ command.
+ */
+void flight_record_command(int32_t car, const char *command, int32_t result,
+		uint32_t latency_us)
+{
+	FlightRecord_t *record;
+	uint32_t index;
+
+	if (NULL == header)
+		return;
+
+	record = claim_record(FLIGHT_RECORD_COMMAND, car, &index);
+	record->data.command.result = result;
+	record->data.command.latency_us = latency_us;
+	memset(record->data.command.text, 0, FLIGHT_RECORD_TEXT_SIZE);
+	memcpy(record->data.command.text, command,
+			strnlen(command, FLIGHT_RECORD_TEXT_SIZE));
+	commit_record(record, index);
+}
+
+void flight_record_error(int32_t car, int32_t error)
+{
+	FlightRecord_t *record;
+	uint32_t index;
+
+	if (NULL == header)
+		return;
+
+	record = claim_record(FLIGHT_RECORD_ERROR, car, &index);
+	record->data.error.error = error;
+	commit_record(record, index);
+}
+
+void flight_record_calibration(int32_t car, const struct acc_cal *calibration)
+{
+	FlightRecord_t *record;
+	uint32_t index;
+	uint8_t i;
+
+	if (NULL == header)
+		return;
+
+	record = claim_record(FLIGHT_RECORD_CALIBRATION, car, &index);
+	for (i = 0; i < 3; i++)
+	{
+		record->data.calibration.zero[i] = calibration->zero[i];
+		record->data.calibration.one[i] = calibration->one[i];
+	}
+	commit_record(record, index);
+}
@@ -0,0 +1,120 @@
+/*!
+ \file
+
+ \brief Telemetry flight recorder kept in a memory mapped ring file.
+
+ The file layout is shared with the decoder, wiicarflightlog.
+
+ */
+
+#ifndef FLIGHT_RECORDER_H_
+#define FLIGHT_RECORDER_H_
+
+#include <stdint.h>
+
+/// \brief Ring file written by default, tmpfs on the router.
+#define FLIGHT_RECORDER_DEFAULT_PATH "/tmp/wiicar_flight.rec"
+
+/// \brief Records kept in the ring, a power of 2.
+#define FLIGHT_RECORDER_DEFAULT_CAPACITY 8192
+
+#define FLIGHT_RECORDER_MAGIC 0x57434652 // "WCFR"
+#define FLIGHT_RECORDER_VERSION 1
+
+/// \brief Offset of the first record in the file.
+#define FLIGHT_RECORDER_HEADER_SIZE 64
+
+#define FLIGHT_RECORD_TEXT_SIZE 24
+
+typedef enum FlightRecordType_t
+{
+	FLIGHT_RECORD_FRAME = 1, ///< raw wiimote report
+	FLIGHT_RECORD_ACCEL, ///< computed pitch, roll and yaw
+	FLIGHT_RECORD_IR, ///< computed theta, phi and distance
+	FLIGHT_RECORD_COMMAND, ///< control board command, with result and round trip
+	FLIGHT_RECORD_ERROR,
+	FLIGHT_RECORD_CALIBRATION, ///< accelerometer calibration, for replaying the frames
+} FlightRecordType_t;
+
+typedef struct FlightRecorderHeader_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t capacity;
+	uint64_t start_time_us; ///< wall clock in us since the epoch at which the tick count was 0
+	volatile uint32_t write_index; ///< number of records ever claimed
+	uint32_t reserved;
+} FlightRecorderHeader_t;
+
+/*!
+ \brief One fixed size record.
+
+ A writer claims a slot, clears sequence, fills in the record and then sets sequence to its index + 1.
+ A record whose sequence does not match its index is torn or was overwritten.
+ */
+typedef struct FlightRecord_t
+{
+	uint64_t timestamp_us; ///< get_tick_count_us()
+	volatile uint32_t sequence;
+	uint8_t type; ///< a FlightRecordType_t
+	int8_t car;
+	uint16_t reserved;
+	union
+	{
+		struct
+		{
+			uint16_t buttons;
+			uint8_t accel[3];
+			uint8_t ir_valid; ///< bit n set if IR point n is valid
+			uint16_t ir_pos[4][2];
+			int8_t ir_size[4];
+		} frame;
+		struct
+		{
+			int32_t pitch;
+			int32_t roll;
+			int32_t yaw;
+		} accel;
+		struct
+		{
+			int32_t theta;
+			int32_t phi;
+			uint32_t distance;
+		} ir;
+		struct
+		{
+			int32_t result;
+			uint32_t latency_us;
+			char text[FLIGHT_RECORD_TEXT_SIZE]; ///< start of the command, not terminated if truncated
+		} command;
+		struct
+		{
+			int32_t error;
+		} error;
+		struct
+		{
+			uint8_t zero[3];
+			uint8_t one[3];
+		} calibration;
+		uint8_t raw[32];
+	} data;
+} FlightRecord_t;
+
+struct WiimoteFrame_t;
+struct acc_cal;
+
+void flight_recorder_configure(const char *path);
+int32_t flight_recorder_start(void);
+int32_t flight_recorder_open(const char *path, uint32_t capacity);
+
+void flight_record_frame(int32_t car, const struct WiimoteFrame_t *frame);
+void flight_record_accel(int32_t car, int32_t pitch, int32_t roll, int32_t yaw);
+void flight_record_ir(int32_t car, int32_t theta, int32_t phi,
+		uint32_t distance);
+void flight_record_command(int32_t car, const char *command, int32_t result,
+		uint32_t latency_us);
+void flight_record_error(int32_t car, int32_t error);
+void flight_record_calibration(int32_t car, const struct acc_cal *calibration);
+
+#endif /* FLIGHT_RECORDER_H_ */
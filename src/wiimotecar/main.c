@@ -1,20 +1,168 @@
 /****************
  * Helloworld.cpp
  *****************/
+#define _GNU_SOURCE
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <sched.h>
 #include <config.h>
 
 #include "ControlTasks.h"
+#include "wiicar.h"
+#include "wiicar_math.h"
+#include "wiicar_realtime.h"
+#include "wiicar_watchdog.h"
+#include "wiicar_obstacle.h"
+#include "flight_recorder.h"
 
 //#define PORT_NAME "/dev/ttyUSB0"
 #define PORT_NAME "/dev/ttyS0"
 //#define PORT_NAME "/dev/rfcomm0"
 
+/*!
+ \brief Parse a whole decimal number from min to max.
+
+ \return bool false if arg is not a number or out of range, value is then left alone.
+ */
+static bool parse_range(const char *arg, int32_t min, int32_t max,
+		int32_t *value)
+{
+	char *end;
+	long parsed;
+
+	errno = 0;
+	parsed = strtol(arg, &end, 10);
+	if ((end == arg) || (*end != '\0') || errno || (parsed < min) || (parsed
+			> max))
+		return false;
+
+	*value = parsed;
+	return true;
+}
+
+/*!
+ \brief Parse the -a filter, off, iir:N or avg:N with N a power of 2 samples.
+
+ \return bool false if the filter is not valid.
+ */
+static bool configure_accel_filter(const char *arg)
+{
+	WiicarAccelFilterType_t type;
+	int32_t length;
+	uint8_t shift = 0;
+
+	if (0 == strcmp(arg, "off"))
+	{
+		accel_configure_filter(WIICAR_ACCEL_FILTER_NONE, 0);
+		return true;
+	}
+	if (0 == strncmp(arg, "iir:", 4))
+		type = WIICAR_ACCEL_FILTER_IIR;
+	else if (0 == strncmp(arg, "avg:", 4))
+		type = WIICAR_ACCEL_FILTER_AVERAGE;
+	else
+		return false;
+
+	length = atoi(arg + 4);
+	if ((length <= 0) || (length & (length - 1))
+			|| (length > (1 << WIICAR_ACCEL_FILTER_MAX_SHIFT)))
+		return false;
+	while ((1 << shift) < length)
+		shift++;
+
+	accel_configure_filter(type, shift);
+	return true;
+}
+
+/*!
+ \brief Parse the -g gains, see infrared_parse_pid().
+
+ \return bool false if the gains are not valid.
+ */
+static bool configure_pid(const char *arg)
+{
+	pid_gains_t speed, heading;
+
+	if (!infrared_parse_pid(arg, &speed, &heading))
+		return false;
+
+	infrared_configure_pid(&speed, &heading);
+	return true;
+}
+
+/*!
+ \brief Parse the -m limits, see motors_parse_limits().
+
+ \return bool false if the limits are not valid.
+ */
+static bool configure_motion(const char *arg)
+{
+	motion_limits_t speed, direction;
+
+	if (!motors_parse_limits(arg, &speed, &direction))
+		return false;
+
+	motors_configure_limits(&speed, &direction);
+	return true;
+}
+
+static void usage(char *name)
+{
+	fprintf(stderr,
+			"usage: %s [-r priority] [-c cpu] [-w deadline] [-f file] [-p lead] [-a filter]\n"
+			"       [-g gains] [-m limits] [-s period] [port...]\n",
+			name);
+	fprintf(stderr,
+			"  -r: run the control loops SCHED_FIFO at priority, %d to %d\n",
+			sched_get_priority_min(SCHED_FIFO),
+			sched_get_priority_max(SCHED_FIFO));
+	fprintf(stderr,
+			"  -c: pin the real-time control loops to cpu, %d spreads them (default)\n",
+			WIICAR_RT_CPU_AUTO);
+	fprintf(stderr,
+			"  -w: stop a car whose control loop stalls for deadline ms, up to %d, 0 disables\n"
+			"      (default %d)\n", WIICAR_WATCHDOG_MAX_DEADLINE_MS,
+			WIICAR_WATCHDOG_DEFAULT_DEADLINE_MS);
+	fprintf(stderr,
+			"  -f: flight recorder file, \"\" disables (default %s)\n",
+			FLIGHT_RECORDER_DEFAULT_PATH);
+	fprintf(stderr,
+			"  -p: camera and bluetooth latency in ms, added to the measured latency when\n"
+			"      predicting the car's pose in infrared mode, up to %d, -1 disables\n"
+			"      (default %d)\n",
+			WIICAR_POSE_MAX_LEAD_US / 1000, WIICAR_PREDICTION_DEFAULT_LEAD_MS);
+	fprintf(stderr,
+			"  -a: accelerometer filter of acceleration mode, off, iir:N (time constant) or\n"
+			"      avg:N (moving average) over N = 1, 2, 4, 8 or 16 samples (default iir:%d)\n",
+			1 << WIICAR_ACCEL_FILTER_DEFAULT_SHIFT);
+	fprintf(stderr,
+			"  -g: gains of infrared mode, speed from distance and steering from phi, as\n"
+			"      kp,ki,kd/kp,ki,kd (default %s)\n", WIICAR_INFRARED_DEFAULT_GAINS);
+	fprintf(stderr,
+			"  -m: limits of the motor levels in every mode, speed and direction motor as\n"
+			"      rate,rate_change per second, 0 for no limit (default %s)\n",
+			WIICAR_MOTION_DEFAULT_LIMITS);
+	fprintf(stderr,
+			"  -s: period of the range sensor reads in ms while a cutoff is set, up to %d,\n"
+			"      0 disables obstacle avoidance (default %d)\n",
+			WIICAR_SENSOR_MAX_PERIOD_MS, WIICAR_SENSOR_DEFAULT_PERIOD_MS);
+	fprintf(stderr, "  port: control board of each car, one wiimote per car\n");
+}
+
 int main(int argc, char **argv)
 {
-	char *dev_name;
+	char *default_dev_name = PORT_NAME;
+	int opt;
+	bool realtime = false;
+	int32_t priority = WIICAR_RT_DEFAULT_PRIORITY;
+	int32_t cpu = WIICAR_RT_CPU_AUTO;
+	int32_t value;
 
 #if _DEBUG
 	printf("\n%s\n", PACKAGE_STRING);
@@ -24,12 +172,87 @@ int main(int argc, char **argv)
 	printf("\n");
 #endif
 
+	while (-1 != (opt = getopt(argc, argv, "r:c:w:f:p:a:g:m:s:")))
+	{
+		switch (opt)
+		{
+		case 'r':
+			if (!parse_range(optarg, sched_get_priority_min(SCHED_FIFO),
+					sched_get_priority_max(SCHED_FIFO), &priority))
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			realtime = true;
+			break;
+		case 'c':
+			if (!parse_range(optarg, WIICAR_RT_CPU_AUTO, CPU_SETSIZE - 1, &cpu))
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'w':
+			if (!parse_range(optarg, 0, WIICAR_WATCHDOG_MAX_DEADLINE_MS, &value))
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			watchdog_configure(value);
+			break;
+		case 'f':
+			flight_recorder_configure(optarg);
+			break;
+		case 'p':
+			if (!parse_range(optarg, -1, WIICAR_POSE_MAX_LEAD_US / 1000, &value))
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			infrared_configure_prediction(value);
+			break;
+		case 'a':
+			if (!configure_accel_filter(optarg))
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'g':
+			if (!configure_pid(optarg))
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'm':
+			if (!configure_motion(optarg))
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 's':
+			if (!parse_range(optarg, 0, WIICAR_SENSOR_MAX_PERIOD_MS, &value))
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			obstacle_configure(value);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (realtime)
+		realtime_configure(priority, cpu);
+
 	if (optind < argc)
-		dev_name = argv[optind];
+		control_tasks(&argv[optind], argc - optind);
 	else
-		dev_name = PORT_NAME;
-
-	control_tasks(dev_name);
+		control_tasks(&default_dev_name, 1);
 
 	return 0;
 }
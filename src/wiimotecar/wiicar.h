@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "cwiid.h"
+#include <wiicarutility/pid.h>
+#include <wiicarutility/motion_profile.h>
 
 /// \brief Number of points the wiimote is capable of tracking.
 #define WIICAR_NUMBER_OF_MAX_IR_POINTS 4
@@ -20,6 +22,18 @@
 
 #define WIICAR_ACCEL_SCALING_VALUE (4096)
 
+/// \brief Accelerometer filter length of acceleration mode, 2^shift samples.
+#define WIICAR_ACCEL_FILTER_DEFAULT_SHIFT 2
+
+/// \brief Latency of the camera and the bluetooth link in ms, added to the measured latency when predicting.
+#define WIICAR_PREDICTION_DEFAULT_LEAD_MS 20
+
+/// \brief Gains of infrared mode, speed from distance / steering from phi, as kp,ki,kd.
+#define WIICAR_INFRARED_DEFAULT_GAINS "1.333,0,0/1,0,0"
+
+/// \brief Limits of the motor levels, speed / direction motor as rate,rate_change per second.
+#define WIICAR_MOTION_DEFAULT_LIMITS "1024,8192/4096,32767"
+
 typedef enum WiiCalIndex_t
 {
 	X_AXIS = 0, //
@@ -81,10 +95,13 @@ typedef struct WiimoteStatusDataType
 	uint16_t button_data;
 	uint8_t accel_raw_data[3];
 	struct WiimoteIrRawData_t ir_raw_data;
+	uint64_t timestamp_us; ///< get_tick_count_us() when the frame was received
 
 	// wiimote data
 	struct WiimoteAccelComputedData_t accel_computed_data;
 	struct acc_cal accel_cal_data;
+	bool accel_cal_valid;
+	int16_t accel_table[3][256]; ///< normalized value of each raw value, see build_accel_table()
 	struct WiimoteIRComputedData_t ir_computed_data;
 } WiimoteStatusDataType;
 
@@ -97,14 +114,67 @@ typedef enum SensorStatusType
 	SENSOR_ERROR = 0xFF,
 } SensorStatusType;
 
-int32_t stop_motors(void);
+struct control_board_session_t;
+struct WiicarPoseTracker_t;
+struct WiicarAccelFilter_t;
 
-int32_t computer_motor_levels_accel(
-		volatile struct WiimoteStatusDataType *wiimote_status);
+/*!
+ \brief Controllers of infrared mode.
+ */
+typedef struct WiicarInfraredPid_t
+{
+	pid_controller_t speed; ///< speed from the distance to the center of the camera
+	pid_controller_t heading; ///< steering from phi
+	bool reverse; ///< the car was driving in reverse
+} WiicarInfraredPid_t;
+
+/*!
+ \brief Motion profile of the motor levels, of the speed level and of the direction motor level.
+ */
+typedef struct WiicarMotionProfile_t
+{
+	motion_axis_t speed;
+	motion_axis_t direction;
+	uint32_t safe_stops; ///< watchdog stops of the car the profile has been reset for
+} WiicarMotionProfile_t;
 
-int32_t WiiComputeMotorLevelsInfrared(
-		volatile struct WiimoteStatusDataType *wiimote_status, bool *valid_points);
+int32_t stop_motors(void);
+int32_t stop_motors_priority(struct control_board_session_t *session);
+
+bool motors_parse_limits(const char *text, motion_limits_t *speed,
+		motion_limits_t *direction);
+void motors_configure_limits(const motion_limits_t *speed,
+		const motion_limits_t *direction);
+void motors_profile_start(WiicarMotionProfile_t *profile);
+void motors_profile_step(WiicarMotionProfile_t *profile, uint64_t time_us,
+		int32_t *speed_level, int32_t *direction_level);
+struct WiicarObstacleGuard_t;
+int32_t write_motor_levels_profiled(WiicarMotionProfile_t *profile,
+		struct WiicarObstacleGuard_t *obstacles, int32_t speed_level,
+		int32_t direction_level);
+int32_t stop_motors_profiled(WiicarMotionProfile_t *profile);
+
+void compute_motor_levels_accel(
+		struct WiimoteStatusDataType *wiimote_status,
+		struct WiicarAccelFilter_t *filter, int32_t *speed_level,
+		int32_t *direction_level);
+void accel_filter_start(struct WiicarAccelFilter_t *filter);
+
+bool compute_motor_levels_infrared(struct WiimoteStatusDataType *wiimote_status,
+		struct WiicarPoseTracker_t *tracker, WiicarInfraredPid_t *pid,
+		bool *valid_points, int32_t *speed_level, int32_t *direction_level);
+bool infrared_parse_pid(const char *text, pid_gains_t *speed,
+		pid_gains_t *heading);
+void infrared_configure_pid(const pid_gains_t *speed,
+		const pid_gains_t *heading);
+void infrared_pid_start(WiicarInfraredPid_t *pid);
 
 int32_t ComputeDirectionMotor(int32_t Direction);
+bool compute_motor_levels_buttons(
+		const struct WiimoteStatusDataType *wiimote_status,
+		int32_t *speed_level, int32_t *direction_level);
+
+void infrared_configure_prediction(int32_t lead_ms);
+int32_t infrared_prediction_time_us(uint64_t frame_time_us);
 
 #endif /*WIIMOTE_H_*/
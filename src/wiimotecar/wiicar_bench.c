@@ -0,0 +1,1086 @@
+/*!
+ \file
+
+ \brief wiicarbench: times the math and the control laws of the modes, per frame.
+
+ Every benchmark goes over all frames of an input, once to warm up and then a number of timed runs.
+ The time per frame of each run gives the mean, standard deviation, minimum and maximum, printed as
+ one CSV line per benchmark and input, so results of different builds and hosts can be compared by
+ a script.  The synthetic input is generated from a fixed seed; a flight recorder file given with -f
+ adds its frames as a second input.
+
+ With -s the harness drives a model of the car under the control law of infrared mode instead, and
+ compares how the gains of its PID controllers settle the car at the center of the camera.
+
+ Build and run with make bench.  BENCH_FLAGS passes options, BENCH_RUNNER runs the harness under an
+ emulator for a cross build, e.g. make bench BENCH_RUNNER="qemu-mips -L /path/to/sysroot".
+
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <wiicarutility/utility.h>
+#include <controlboard/hardware.h>
+
+#include "wiicar.h"
+#include "wiicar_math.h"
+#include "wiicar_ir_batch.h"
+#include "flight_recorder.h"
+#include "control_law.h"
+
+#define DEFAULT_RUNS 15
+#define DEFAULT_FRAMES 4096
+
+/// \brief Period of the synthetic frames, the wiimote reports at 100 Hz.
+#define SYNTHETIC_PERIOD_US 10000
+
+extern const struct cwiid_ir_src WiimoteMidpoint;
+
+/*!
+ \brief Frames a benchmark runs over, with what the benchmarks need computed from them beforehand.
+ */
+typedef struct BenchInput_t
+{
+	const char *name;
+	uint32_t count;
+	uint64_t *time_us;
+	uint8_t (*accel)[3];
+	struct WiimoteIrRawData_t *ir;
+	struct acc_cal calibration;
+
+	/// normalized acceleration of each frame
+	struct WiimoteAccelComputedData_t *normalized;
+
+	/// the frames that see three points or more, the three largest in slot order
+	uint32_t ir_count;
+	struct WiimoteIrRawData_t *selected;
+	uint16_t *coordinates;
+	WiicarIrBatchInput_t batch;
+} BenchInput_t;
+
+typedef uint32_t (*BenchFunction_t)(const BenchInput_t *input);
+
+/// \brief Keeps the results of the benchmarks from being optimised away.
+static volatile int32_t bench_sink;
+
+/// \brief Working state of the benchmarks, the status of the car of the control loop.
+static WiimoteStatusDataType status;
+static WiicarAccelFilter_t filter;
+static WiicarPoseTracker_t tracker;
+static WiicarInfraredPid_t pid;
+static WiicarMotionProfile_t profile;
+static WiicarControlState_t law_state;
+static WiicarIrBatchKernel_t batch_kernel;
+static WiicarIrBatchOutput_t batch_output;
+
+static uint32_t bench_normalize_accel(const BenchInput_t *input)
+{
+	int32_t sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < input->count; i++)
+	{
+		memcpy(status.accel_raw_data, input->accel[i], 3);
+		normalize_accel(&status);
+		sum += status.accel_computed_data.accel_normalized[X_AXIS];
+	}
+	bench_sink = sum;
+	return input->count;
+}
+
+static uint32_t bench_normalize_accel_value(const BenchInput_t *input)
+{
+	int32_t sum = 0;
+	uint32_t i;
+	uint8_t j;
+
+	for (i = 0; i < input->count; i++)
+	{
+		for (j = 0; j < 3; j++)
+			sum += normalize_accel_value(input->calibration.zero[j],
+					input->calibration.one[j], input->accel[i][j]);
+	}
+	bench_sink = sum;
+	return input->count;
+}
+
+static uint32_t bench_determine_pitch(const BenchInput_t *input)
+{
+	int32_t sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < input->count; i++)
+		sum += determine_pitch(&input->normalized[i]);
+	bench_sink = sum;
+	return input->count;
+}
+
+static uint32_t bench_determine_roll(const BenchInput_t *input)
+{
+	int32_t sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < input->count; i++)
+		sum += determine_roll(&input->normalized[i]);
+	bench_sink = sum;
+	return input->count;
+}
+
+static uint32_t bench_determine_yaw(const BenchInput_t *input)
+{
+	int32_t sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < input->count; i++)
+		sum += determine_yaw(&input->normalized[i]);
+	bench_sink = sum;
+	return input->count;
+}
+
+static int32_t bench_clamp_g(int32_t x)
+{
+	return coerce(x, -WIICAR_ACCEL_SCALING_VALUE, WIICAR_ACCEL_SCALING_VALUE);
+}
+
+static uint32_t bench_fixed_asin(const BenchInput_t *input)
+{
+	int32_t sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < input->count; i++)
+		sum += fixed_asin(bench_clamp_g(
+				input->normalized[i].accel_normalized[Y_AXIS]));
+	bench_sink = sum;
+	return input->count;
+}
+
+/// \brief The arcsine of determine_pitch() without --enable-fixed-point-math, soft-float on the router.
+static uint32_t bench_asin(const BenchInput_t *input)
+{
+	int32_t sum = 0;
+	uint32_t i;
+	float angle;
+
+	for (i = 0; i < input->count; i++)
+	{
+		angle = (float) bench_clamp_g(
+				input->normalized[i].accel_normalized[Y_AXIS])
+				/ WIICAR_ACCEL_SCALING_VALUE;
+		angle = asin(angle);
+		angle *= 180 / M_PI;
+		angle *= WIICAR_DEGREE_SCALING;
+		sum += angle;
+	}
+	bench_sink = sum;
+	return input->count;
+}
+
+static uint32_t bench_accel_filter(const BenchInput_t *input,
+		WiicarAccelFilterType_t type)
+{
+	struct WiimoteAccelComputedData_t accel;
+	int32_t sum = 0;
+	uint32_t i;
+
+	accel_filter_init(&filter, type, WIICAR_ACCEL_FILTER_DEFAULT_SHIFT);
+	for (i = 0; i < input->count; i++)
+	{
+		accel = input->normalized[i];
+		accel_filter_apply(&filter, &accel);
+		sum += accel.accel_normalized[X_AXIS];
+	}
+	bench_sink = sum;
+	return input->count;
+}
+
+static uint32_t bench_accel_filter_iir(const BenchInput_t *input)
+{
+	return bench_accel_filter(input, WIICAR_ACCEL_FILTER_IIR);
+}
+
+static uint32_t bench_accel_filter_average(const BenchInput_t *input)
+{
+	return bench_accel_filter(input, WIICAR_ACCEL_FILTER_AVERAGE);
+}
+
+static uint32_t bench_rescale_range(const BenchInput_t *input)
+{
+	int32_t sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < input->count; i++)
+		sum += rescale_range(input->normalized[i].accel_normalized[Y_AXIS], 0,
+				-WIICAR_ACCEL_SCALING_VALUE, WIICAR_ACCEL_SCALING_VALUE, 0,
+				MAX_REVERSE_SPEED, MAX_FORWARD_SPEED);
+	bench_sink = sum;
+	return input->count;
+}
+
+/// \brief Angles of up to 7 turns, from the acceleration, to wrap.
+static int32_t bench_turns(const BenchInput_t *input, uint32_t i)
+{
+	return input->normalized[i].accel_normalized[X_AXIS] * 60;
+}
+
+static uint32_t bench_cap_angle(const BenchInput_t *input)
+{
+	int32_t sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < input->count; i++)
+		sum += cap_angle(bench_turns(input, i), 180, 360,
+				WIICAR_DEGREE_SCALING);
+	bench_sink = sum;
+	return input->count;
+}
+
+static uint32_t bench_wrap_angle(const BenchInput_t *input)
+{
+	int32_t sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < input->count; i++)
+		sum += wrap_angle(bench_turns(input, i));
+	bench_sink = sum;
+	return input->count;
+}
+
+static uint32_t bench_determine_ir_front_back(const BenchInput_t *input)
+{
+	struct WiimoteIRPositions_t *positions =
+			&status.ir_computed_data.WiimoteIRPositions;
+	int32_t sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < input->ir_count; i++)
+	{
+		determine_ir_front_back(&input->selected[i], positions);
+		sum += positions->WiimoteCarPosition[WII_CAR_POSITION_BACK].pos[0];
+	}
+	bench_sink = sum;
+	return input->ir_count;
+}
+
+static uint32_t bench_compute_ir_data(const BenchInput_t *input)
+{
+	int32_t sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < input->ir_count; i++)
+	{
+		compute_ir_data(&input->selected[i], &status.ir_computed_data);
+		sum += status.ir_computed_data.phi;
+	}
+	bench_sink = sum;
+	return input->ir_count;
+}
+
+static uint32_t bench_ir_batch(const BenchInput_t *input)
+{
+	ir_batch_compute(batch_kernel, &input->batch, &batch_output,
+			input->ir_count);
+	bench_sink = input->ir_count ? batch_output.phi[input->ir_count - 1] : 0;
+	return input->ir_count;
+}
+
+static uint32_t bench_pose_tracker_update(const BenchInput_t *input)
+{
+	int32_t sum = 0;
+	uint32_t i;
+
+	pose_tracker_reset(&tracker);
+	for (i = 0; i < input->count; i++)
+	{
+		if (pose_tracker_update(&tracker, input->time_us[i], &input->ir[i],
+				&status.ir_computed_data))
+			sum += status.ir_computed_data.phi;
+	}
+	bench_sink = sum;
+	return input->count;
+}
+
+static uint32_t bench_control_accel(const BenchInput_t *input)
+{
+	int32_t speed, direction, sum = 0;
+	uint32_t i;
+
+	accel_filter_start(&filter);
+	for (i = 0; i < input->count; i++)
+	{
+		memcpy(status.accel_raw_data, input->accel[i], 3);
+		compute_motor_levels_accel(&status, &filter, &speed, &direction);
+		sum += speed + direction;
+	}
+	bench_sink = sum;
+	return input->count;
+}
+
+/*!
+ \brief The motion profile on levels following the tilt of the wiimote, at the time of each frame.
+ */
+static uint32_t bench_motion_profile(const BenchInput_t *input)
+{
+	const int16_t *normalized;
+	int32_t speed, direction, sum = 0;
+	uint32_t i;
+
+	motors_profile_start(&profile);
+	for (i = 0; i < input->count; i++)
+	{
+		normalized = input->normalized[i].accel_normalized;
+		speed = -normalized[Y_AXIS] * MAX_FORWARD_SPEED
+				/ WIICAR_ACCEL_SCALING_VALUE;
+		direction = DIRECTION_NULL_VALUE - normalized[X_AXIS]
+				* DIRECTION_NULL_VALUE / WIICAR_ACCEL_SCALING_VALUE;
+		motors_profile_step(&profile, input->time_us[i], &speed, &direction);
+		sum += speed + direction;
+	}
+	bench_sink = sum;
+	return input->count;
+}
+
+static uint32_t bench_control_infrared(const BenchInput_t *input)
+{
+	int32_t speed, direction, sum = 0;
+	uint32_t i;
+	bool valid_points;
+
+	pose_tracker_reset(&tracker);
+	infrared_pid_start(&pid);
+	for (i = 0; i < input->count; i++)
+	{
+		status.ir_raw_data = input->ir[i];
+		status.timestamp_us = input->time_us[i];
+		if (compute_motor_levels_infrared(&status, &tracker, &pid,
+				&valid_points, &speed, &direction))
+			sum += speed + direction;
+	}
+	bench_sink = sum;
+	return input->count;
+}
+
+/*!
+ \brief control_accel through the table of the law, as acceleration mode calls it.
+ */
+static uint32_t bench_control_law_accel(const BenchInput_t *input)
+{
+	const WiicarControlLaw_t *law = &control_law_accel;
+	int32_t speed, direction, sum = 0;
+	uint32_t i;
+
+	law->start(&law_state);
+	for (i = 0; i < input->count; i++)
+	{
+		memcpy(status.accel_raw_data, input->accel[i], 3);
+		law->compute(&law_state, &status, &speed, &direction);
+		sum += speed + direction;
+	}
+	bench_sink = sum;
+	return input->count;
+}
+
+/*!
+ \brief control_infrared through the table of the law, as infrared mode calls it.
+ */
+static uint32_t bench_control_law_infrared(const BenchInput_t *input)
+{
+	const WiicarControlLaw_t *law = &control_law_infrared;
+	int32_t speed, direction, sum = 0;
+	uint32_t i;
+
+	law->start(&law_state);
+	for (i = 0; i < input->count; i++)
+	{
+		status.ir_raw_data = input->ir[i];
+		status.timestamp_us = input->time_us[i];
+		if (law->compute(&law_state, &status, &speed, &direction))
+			sum += speed + direction;
+	}
+	bench_sink = sum;
+	return input->count;
+}
+
+static const struct
+{
+	const char *name;
+	BenchFunction_t function;
+	WiicarIrBatchKernel_t kernel; ///< for ir_batch, the kernel
+} benchmarks[] =
+{
+{ "normalize_accel", bench_normalize_accel },
+{ "normalize_accel_value", bench_normalize_accel_value },
+{ "determine_pitch", bench_determine_pitch },
+{ "determine_roll", bench_determine_roll },
+{ "determine_yaw", bench_determine_yaw },
+{ "fixed_asin", bench_fixed_asin },
+{ "asin", bench_asin },
+{ "accel_filter_iir", bench_accel_filter_iir },
+{ "accel_filter_average", bench_accel_filter_average },
+{ "rescale_range", bench_rescale_range },
+{ "cap_angle", bench_cap_angle },
+{ "wrap_angle", bench_wrap_angle },
+{ "determine_ir_front_back", bench_determine_ir_front_back },
+{ "compute_ir_data", bench_compute_ir_data },
+{ "ir_batch_scalar", bench_ir_batch, IR_BATCH_KERNEL_SCALAR },
+{ "ir_batch_sse2", bench_ir_batch, IR_BATCH_KERNEL_SSE2 },
+{ "ir_batch_avx2", bench_ir_batch, IR_BATCH_KERNEL_AVX2 },
+{ "pose_tracker_update", bench_pose_tracker_update },
+{ "control_accel", bench_control_accel },
+{ "control_infrared", bench_control_infrared },
+{ "control_law_accel", bench_control_law_accel },
+{ "control_law_infrared", bench_control_law_infrared },
+{ "motion_profile", bench_motion_profile }, };
+
+#define BENCHMARK_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static double elapsed_ns(const struct timespec *start,
+		const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec
+			- start->tv_nsec);
+}
+
+/*!
+ \brief Times one benchmark on one input and prints its CSV line.
+ */
+static void bench_run(uint32_t index, const BenchInput_t *input,
+		uint32_t runs)
+{
+	struct timespec start, end;
+	double ns, sum = 0, sum_squares = 0, min = 0, max = 0, mean, variance;
+	uint32_t run, frames;
+
+	memset(&status, 0, sizeof(status));
+	status.accel_cal_data = input->calibration;
+	build_accel_table(&status);
+	batch_kernel = benchmarks[index].kernel;
+
+	frames = benchmarks[index].function(input);
+	if (0 == frames)
+		return;
+
+	for (run = 0; run < runs; run++)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		benchmarks[index].function(input);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		ns = elapsed_ns(&start, &end) / frames;
+		sum += ns;
+		sum_squares += ns * ns;
+		if ((0 == run) || (ns < min))
+			min = ns;
+		if ((0 == run) || (ns > max))
+			max = ns;
+	}
+
+	mean = sum / runs;
+	variance = (runs > 1) ? (sum_squares - sum * mean) / (runs - 1) : 0;
+	printf("%s,%s,%u,%u,%.2f,%.2f,%.2f,%.2f\n", benchmarks[index].name,
+			input->name, frames, runs, mean, (variance > 0) ? sqrt(variance)
+					: 0.0, min, max);
+}
+
+static void *bench_alloc(size_t count, size_t size)
+{
+	void *memory = calloc(count + 1, size);
+
+	if (NULL == memory)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(4);
+	}
+	return memory;
+}
+
+static void input_alloc(BenchInput_t *input, const char *name,
+		uint32_t count)
+{
+	memset(input, 0, sizeof(*input));
+	input->name = name;
+	input->count = count;
+	input->time_us = bench_alloc(count, sizeof(*input->time_us));
+	input->accel = bench_alloc(count, sizeof(*input->accel));
+	input->ir = bench_alloc(count, sizeof(*input->ir));
+}
+
+/*!
+ \brief Computes what the benchmarks take as input from the frames.
+ */
+static void input_prepare(BenchInput_t *input)
+{
+	uint32_t i;
+	uint16_t *coordinates;
+	uint8_t j;
+
+	memset(&status, 0, sizeof(status));
+	status.accel_cal_data = input->calibration;
+	build_accel_table(&status);
+
+	input->normalized = bench_alloc(input->count, sizeof(*input->normalized));
+	input->selected = bench_alloc(input->count, sizeof(*input->selected));
+	for (i = 0; i < input->count; i++)
+	{
+		memcpy(status.accel_raw_data, input->accel[i], 3);
+		normalize_accel(&status);
+		input->normalized[i] = status.accel_computed_data;
+
+		if (select_ir_points(&input->ir[i], &input->selected[input->ir_count])
+				>= WIICAR_IR_NUMBER_OF_POINTS)
+			input->ir_count++;
+	}
+
+	// 6 input arrays and 7 output arrays of coordinates, then 3 of angles
+	coordinates = bench_alloc(13 * (size_t) input->ir_count, sizeof(uint16_t));
+	input->coordinates = coordinates;
+	for (j = 0; j < 3; j++)
+	{
+		input->batch.x[j] = coordinates + 2 * j * input->ir_count;
+		input->batch.y[j] = coordinates + (2 * j + 1) * input->ir_count;
+		for (i = 0; i < input->ir_count; i++)
+		{
+			coordinates[2 * j * input->ir_count + i]
+					= input->selected[i].WiimoteIRPoint[j].pos[0];
+			coordinates[(2 * j + 1) * input->ir_count + i]
+					= input->selected[i].WiimoteIRPoint[j].pos[1];
+		}
+	}
+}
+
+/// \brief Allocates the batch output for the largest input.
+static void batch_output_alloc(uint32_t count)
+{
+	uint16_t *coordinates = bench_alloc(7 * (size_t) count, sizeof(uint16_t));
+	int32_t *angles = bench_alloc(3 * (size_t) count, sizeof(int32_t));
+
+	batch_output.front_x = coordinates;
+	batch_output.front_y = coordinates + count;
+	batch_output.back_x = coordinates + 2 * count;
+	batch_output.back_y = coordinates + 3 * count;
+	batch_output.center_x = coordinates + 4 * count;
+	batch_output.center_y = coordinates + 5 * count;
+	batch_output.distance = coordinates + 6 * count;
+	batch_output.theta = angles;
+	batch_output.temp_phi = angles + count;
+	batch_output.phi = angles + 2 * count;
+}
+
+static int32_t noise(int32_t amplitude)
+{
+	return rand() % (2 * amplitude + 1) - amplitude;
+}
+
+/*!
+ \brief The car driving an ellipse under the camera while the wiimote is tilted.
+
+ The camera jitters by a pixel, every 100 frames the car is lost for 6, and every 50th frame a
+ reflection shows as a small fourth point.
+ */
+static void input_synthetic(BenchInput_t *input, uint32_t count)
+{
+	struct cwiid_ir_src *points;
+	double t, heading, center_x, center_y, pitch, roll;
+	uint32_t i;
+	uint8_t j;
+
+	input_alloc(input, "synthetic", count);
+	srand(1);
+	for (j = 0; j < 3; j++)
+	{
+		input->calibration.zero[j] = WIICAR_ZERO_G;
+		input->calibration.one[j] = WIICAR_ZERO_G + 26;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		t = i * (SYNTHETIC_PERIOD_US / 1e6);
+		input->time_us[i] = (uint64_t) i * SYNTHETIC_PERIOD_US;
+
+		pitch = 0.5 * sin(0.7 * t);
+		roll = 0.4 * sin(1.3 * t + 1);
+		input->accel[i][X_AXIS] = WIICAR_ZERO_G + 26 * sin(roll) + noise(1);
+		input->accel[i][Y_AXIS] = WIICAR_ZERO_G + 26 * sin(pitch) + noise(1);
+		input->accel[i][Z_AXIS] = WIICAR_ZERO_G + 26 * cos(pitch) * cos(roll)
+				+ noise(1);
+
+		center_x = 512 + 150 * cos(2 * t);
+		center_y = 384 + 120 * sin(2 * t);
+		heading = atan2(240 * cos(2 * t), -300 * sin(2 * t));
+		points = input->ir[i].WiimoteIRPoint;
+		for (j = 0; j < 3; j++)
+		{
+			points[j].valid = ((i % 100) < 94) || (j < 2);
+			points[j].size = 3;
+		}
+		points[0].pos[0] = center_x + 20 * cos(heading) - 6 * sin(heading)
+				+ noise(1);
+		points[0].pos[1] = center_y + 20 * sin(heading) + 6 * cos(heading)
+				+ noise(1);
+		points[1].pos[0] = center_x - 20 * cos(heading) + noise(1);
+		points[1].pos[1] = center_y - 20 * sin(heading) + noise(1);
+		points[2].pos[0] = center_x + 20 * cos(heading) + 6 * sin(heading)
+				+ noise(1);
+		points[2].pos[1] = center_y + 20 * sin(heading) - 6 * cos(heading)
+				+ noise(1);
+		if (0 == (i % 50))
+		{
+			points[3].valid = 1;
+			points[3].size = 1;
+			points[3].pos[0] = 100;
+			points[3].pos[1] = 700;
+		}
+	}
+	input_prepare(input);
+}
+
+/*!
+ \brief The frames of a flight recorder file, in the order they were recorded.
+
+ Takes the first calibration record, or the synthetic calibration if there is none.  Files of the
+ other byte order are not read, decode them on a host of the same order.
+
+ \return bool false if the file cannot be read or has no frames.
+ */
+static bool input_recorded(BenchInput_t *input, const char *path)
+{
+	FlightRecorderHeader_t header;
+	FlightRecord_t *records, *record;
+	uint32_t capacity, write_index, first, index, count = 0;
+	bool calibrated = false;
+	FILE *file;
+	uint8_t j;
+
+	file = fopen(path, "rb");
+	if (NULL == file)
+	{
+		perror(path);
+		return false;
+	}
+	if ((1 != fread(&header, sizeof(header), 1, file))
+			|| (FLIGHT_RECORDER_MAGIC != header.magic)
+			|| (FLIGHT_RECORDER_VERSION != header.version)
+			|| (sizeof(FlightRecord_t) != header.record_size)
+			|| (0 == header.capacity) || (header.capacity
+			& (header.capacity - 1)))
+	{
+		fprintf(stderr, "%s: not a flight recorder file of this version and byte order\n",
+				path);
+		fclose(file);
+		return false;
+	}
+
+	capacity = header.capacity;
+	write_index = header.write_index;
+	records = bench_alloc(capacity, sizeof(FlightRecord_t));
+	if (fseek(file, FLIGHT_RECORDER_HEADER_SIZE, SEEK_SET) || (capacity
+			!= fread(records, sizeof(FlightRecord_t), capacity, file)))
+	{
+		fprintf(stderr, "%s: truncated\n", path);
+		fclose(file);
+		free(records);
+		return false;
+	}
+	fclose(file);
+
+	first = (write_index > capacity) ? write_index - capacity : 0;
+	input_alloc(input, "recorded", write_index - first);
+	for (j = 0; j < 3; j++)
+	{
+		input->calibration.zero[j] = WIICAR_ZERO_G;
+		input->calibration.one[j] = WIICAR_ZERO_G + 26;
+	}
+
+	for (index = first; index != write_index; index++)
+	{
+		record = &records[index & (capacity - 1)];
+		if (record->sequence != index + 1)
+			continue;
+
+		if ((FLIGHT_RECORD_CALIBRATION == record->type) && !calibrated)
+		{
+			memcpy(input->calibration.zero, record->data.calibration.zero, 3);
+			memcpy(input->calibration.one, record->data.calibration.one, 3);
+			calibrated = true;
+		}
+		if (FLIGHT_RECORD_FRAME != record->type)
+			continue;
+
+		input->time_us[count] = record->timestamp_us;
+		memcpy(input->accel[count], record->data.frame.accel, 3);
+		for (j = 0; j < WIICAR_NUMBER_OF_MAX_IR_POINTS; j++)
+		{
+			input->ir[count].WiimoteIRPoint[j].valid
+					= 0 != (record->data.frame.ir_valid & (1 << j));
+			input->ir[count].WiimoteIRPoint[j].pos[0]
+					= record->data.frame.ir_pos[j][0];
+			input->ir[count].WiimoteIRPoint[j].pos[1]
+					= record->data.frame.ir_pos[j][1];
+			input->ir[count].WiimoteIRPoint[j].size
+					= record->data.frame.ir_size[j];
+		}
+		count++;
+	}
+	free(records);
+
+	if (0 == count)
+	{
+		fprintf(stderr, "%s: no frames\n", path);
+		return false;
+	}
+	input->count = count;
+	input_prepare(input);
+	return true;
+}
+
+/// \brief The settle runs: 10 s at 100 Hz, settled within 8 pixels of the center of the camera.
+#define SETTLE_PERIOD_US 10000
+#define SETTLE_FRAMES 1000
+#define SETTLE_DISTANCE 8.0
+
+/// \brief Frames are stamped this far ahead of the clock, so the prediction leads by -p alone.
+#define SETTLE_CLOCK_OFFSET_US (1ULL << 50)
+
+/*!
+ \brief Model of the car, in pixels of the camera.
+
+ Full speed is 250 pixels/s, reached with a time constant of 150 ms; below 24 speed levels the
+ motor does not overcome friction.  Full steering turns the front wheels by 30 degrees, with the
+ leds 40 pixels apart as the wheelbase; steering right, above DIRECTION_NULL_VALUE, turns the car
+ towards smaller angles of the camera's axes when driving forward.  A command takes effect 3 frames
+ after its frame.
+ */
+#define SETTLE_MAX_VELOCITY 250.0
+#define SETTLE_MOTOR_TAU 0.15
+#define SETTLE_DEAD_BAND 24
+#define SETTLE_MAX_STEER (M_PI / 6)
+#define SETTLE_WHEELBASE 40.0
+#define SETTLE_LAG_FRAMES 3
+
+typedef struct SettlePose_t
+{
+	double x;
+	double y;
+	double heading; ///< radians, of the camera's axes
+} SettlePose_t;
+
+typedef struct SettleResult_t
+{
+	double settle_ms; ///< negative if not settled
+	double overshoot; ///< furthest from the center after first within SETTLE_DISTANCE
+	double final_distance;
+} SettleResult_t;
+
+static void settle_frame(const SettlePose_t *pose,
+		struct WiimoteIrRawData_t *frame)
+{
+	struct cwiid_ir_src *points = frame->WiimoteIRPoint;
+	double c = cos(pose->heading), s = sin(pose->heading);
+	uint8_t j;
+
+	memset(frame, 0, sizeof(*frame));
+	points[0].pos[0] = pose->x + 20 * c - 6 * s + noise(1);
+	points[0].pos[1] = pose->y + 20 * s + 6 * c + noise(1);
+	points[1].pos[0] = pose->x - 20 * c + noise(1);
+	points[1].pos[1] = pose->y - 20 * s + noise(1);
+	points[2].pos[0] = pose->x + 20 * c + 6 * s + noise(1);
+	points[2].pos[1] = pose->y + 20 * s - 6 * c + noise(1);
+	for (j = 0; j < 3; j++)
+	{
+		points[j].size = 3;
+		points[j].valid = (points[j].pos[0] < 1024) && (points[j].pos[1] < 768);
+	}
+}
+
+/*!
+ \brief Drives the car from a start pose under the control law of infrared mode with the gains.
+ */
+static void settle_run(const SettlePose_t *start, const pid_gains_t *speed_gains,
+		const pid_gains_t *heading_gains, SettleResult_t *result)
+{
+	SettlePose_t pose = *start;
+	int32_t speed[SETTLE_LAG_FRAMES + 1], direction[SETTLE_LAG_FRAMES + 1];
+	double velocity = 0, target, steer, distance, dt = SETTLE_PERIOD_US / 1e6;
+	bool valid_points, reached = false;
+	uint32_t i, slot;
+	int32_t level;
+
+	memset(&status, 0, sizeof(status));
+	pose_tracker_reset(&tracker);
+	infrared_configure_pid(speed_gains, heading_gains);
+	infrared_pid_start(&pid);
+	motors_profile_start(&profile);
+	for (i = 0; i <= SETTLE_LAG_FRAMES; i++)
+	{
+		speed[i] = 0;
+		direction[i] = DIRECTION_NULL_VALUE;
+	}
+	result->settle_ms = 0;
+	result->overshoot = 0;
+
+	for (i = 0; i < SETTLE_FRAMES; i++)
+	{
+		settle_frame(&pose, &status.ir_raw_data);
+		status.timestamp_us = SETTLE_CLOCK_OFFSET_US + (uint64_t) i
+				* SETTLE_PERIOD_US;
+		slot = i % (SETTLE_LAG_FRAMES + 1);
+		if (compute_motor_levels_infrared(&status, &tracker, &pid,
+				&valid_points, &speed[slot], &direction[slot]))
+			motors_profile_step(&profile, status.timestamp_us, &speed[slot],
+					&direction[slot]);
+		else
+		{
+			// stopped at once, as stop_motors_profiled()
+			motors_profile_start(&profile);
+			speed[slot] = 0;
+			direction[slot] = DIRECTION_NULL_VALUE;
+		}
+
+		// the command of SETTLE_LAG_FRAMES ago takes effect
+		slot = (i + 1) % (SETTLE_LAG_FRAMES + 1);
+		level = speed[slot];
+		if (abs(level) <= SETTLE_DEAD_BAND)
+			target = 0;
+		else
+			target = ((level > 0) ? 1 : -1) * (abs(level) - SETTLE_DEAD_BAND)
+					* SETTLE_MAX_VELOCITY / (MAX_FORWARD_SPEED - SETTLE_DEAD_BAND);
+		velocity += (target - velocity) * dt / SETTLE_MOTOR_TAU;
+		steer = (direction[slot] - DIRECTION_NULL_VALUE) * SETTLE_MAX_STEER
+				/ (MAX_DIRECTION_MOTOR - DIRECTION_NULL_VALUE);
+
+		pose.heading -= velocity / SETTLE_WHEELBASE * tan(steer) * dt;
+		pose.x += velocity * cos(pose.heading) * dt;
+		pose.y += velocity * sin(pose.heading) * dt;
+
+		distance = hypot(pose.x - WiimoteMidpoint.pos[0], pose.y
+				- WiimoteMidpoint.pos[1]);
+		if (distance > SETTLE_DISTANCE)
+			result->settle_ms = -1;
+		else if (result->settle_ms < 0)
+			result->settle_ms = (i + 1) * (SETTLE_PERIOD_US / 1000.0);
+		if (reached && (distance > result->overshoot))
+			result->overshoot = distance;
+		reached = reached || (distance <= SETTLE_DISTANCE);
+	}
+	result->final_distance = distance;
+}
+
+#define SETTLE_STARTS 8
+
+/// \brief Gains the settle runs compare, WIICAR_INFRARED_DEFAULT_GAINS first.
+static const char *settle_gains[] =
+{ WIICAR_INFRARED_DEFAULT_GAINS, "1.333,0,0/3,0,0", "1.333,1,0/3,0,0",
+		"1.333,1,0.2/3,0,0.2", NULL };
+
+/*!
+ \brief Start poses around the center of the camera, facing every way.
+ */
+static void settle_synthetic_starts(SettlePose_t *starts)
+{
+	double angle;
+	uint32_t i;
+
+	for (i = 0; i < SETTLE_STARTS; i++)
+	{
+		angle = 2 * M_PI * i / SETTLE_STARTS;
+		starts[i].x = WiimoteMidpoint.pos[0] + ((i & 1) ? 250 : 150) * cos(angle);
+		starts[i].y = WiimoteMidpoint.pos[1] + ((i & 1) ? 250 : 150) * sin(angle);
+		starts[i].heading = angle + M_PI + ((3 * i) % SETTLE_STARTS) * 2
+				* M_PI / SETTLE_STARTS;
+	}
+}
+
+/*!
+ \brief The pose of the first frame of the recording that sees the car.
+
+ \return bool false if no frame sees the car.
+ */
+static bool settle_recorded_start(const BenchInput_t *input,
+		SettlePose_t *start)
+{
+	struct WiimoteIRComputedData_t computed;
+	const struct cwiid_ir_src *position =
+			computed.WiimoteIRPositions.WiimoteCarPosition;
+
+	if (0 == input->ir_count)
+		return false;
+
+	compute_ir_data(&input->selected[0], &computed);
+	start->x = position[WII_CAR_POSITION_CENTER].pos[0];
+	start->y = position[WII_CAR_POSITION_CENTER].pos[1];
+	start->heading = atan2(position[WII_CAR_POSITION_FRONT].pos[1]
+			- position[WII_CAR_POSITION_BACK].pos[1],
+			position[WII_CAR_POSITION_FRONT].pos[0]
+					- position[WII_CAR_POSITION_BACK].pos[0]);
+	return true;
+}
+
+/*!
+ \brief Runs the car from each start with the gains and prints their CSV line.
+ */
+static void settle_compare(const char *gains, const char *input,
+		const SettlePose_t *starts, uint32_t count)
+{
+	pid_gains_t speed_gains, heading_gains;
+	SettleResult_t result;
+	double settle_sum = 0, settle_max = 0, overshoot_sum = 0, final_sum = 0;
+	uint32_t i, settled = 0;
+
+	if (!infrared_parse_pid(gains, &speed_gains, &heading_gains))
+		return;
+
+	srand(1);
+	for (i = 0; i < count; i++)
+	{
+		settle_run(&starts[i], &speed_gains, &heading_gains, &result);
+		if (result.settle_ms >= 0)
+		{
+			settled++;
+			settle_sum += result.settle_ms;
+			if (result.settle_ms > settle_max)
+				settle_max = result.settle_ms;
+		}
+		overshoot_sum += result.overshoot;
+		final_sum += result.final_distance;
+	}
+
+	printf("\"%s\",%s,%u,%u,%.0f,%.0f,%.1f,%.1f\n", gains, input, count, settled,
+			settled ? settle_sum / settled : -1.0, settled ? settle_max : -1.0,
+			overshoot_sum / count, final_sum / count);
+}
+
+static void usage(char *name)
+{
+	fprintf(stderr,
+			"usage: %s [-r runs] [-n frames] [-f file] [-b name] [-s] [-g gains]\n"
+			"       [-m limits]\n",
+			name);
+	fprintf(stderr, "  -r: timed runs of each benchmark (default %d)\n",
+			DEFAULT_RUNS);
+	fprintf(stderr, "  -n: synthetic frames (default %d)\n", DEFAULT_FRAMES);
+	fprintf(stderr, "  -f: also run on the frames of a flight recorder file\n");
+	fprintf(stderr, "  -b: only run the benchmarks whose name contains name\n");
+	fprintf(stderr,
+			"  -s: instead, drive a model of the car to the center of the camera under\n"
+			"      infrared mode, from %d starts and from the start of the recording\n",
+			SETTLE_STARTS);
+	fprintf(stderr,
+			"  -g: with -s, also compare these gains of infrared mode, see wiimotecarapp\n");
+	fprintf(stderr,
+			"  -m: limits of the motor levels, see wiimotecarapp (default %s)\n",
+			WIICAR_MOTION_DEFAULT_LIMITS);
+	fprintf(stderr,
+			"Prints benchmark,input,frames,runs,mean_ns,stddev_ns,min_ns,max_ns per line,\n"
+			"times per frame, or with -s\n"
+			"gains,input,starts,settled,mean_settle_ms,max_settle_ms,mean_overshoot_px,\n"
+			"mean_final_px per line.\n");
+}
+
+int main(int argc, char **argv)
+{
+	BenchInput_t inputs[2];
+	uint32_t input_count = 1, runs = DEFAULT_RUNS, frames = DEFAULT_FRAMES;
+	uint32_t i, j, largest = 0;
+	const char *path = NULL, *only = NULL, *gains = NULL;
+	SettlePose_t starts[SETTLE_STARTS];
+	pid_gains_t speed_gains, heading_gains;
+	motion_limits_t speed_limits, direction_limits;
+	bool settle = false;
+	int opt;
+
+	while (-1 != (opt = getopt(argc, argv, "r:n:f:b:sg:m:")))
+	{
+		switch (opt)
+		{
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 'f':
+			path = optarg;
+			break;
+		case 'b':
+			only = optarg;
+			break;
+		case 's':
+			settle = true;
+			break;
+		case 'g':
+			gains = optarg;
+			break;
+		case 'm':
+			if (!motors_parse_limits(optarg, &speed_limits, &direction_limits))
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			motors_configure_limits(&speed_limits, &direction_limits);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((0 == runs) || (0 == frames) || ((NULL != gains)
+			&& !infrared_parse_pid(gains, &speed_gains, &heading_gains)))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	input_synthetic(&inputs[0], frames);
+	if (NULL != path)
+	{
+		if (!input_recorded(&inputs[1], path))
+			return 2;
+		input_count++;
+	}
+
+	if (settle)
+	{
+		printf("gains,input,starts,settled,mean_settle_ms,max_settle_ms,"
+			"mean_overshoot_px,mean_final_px\n");
+		settle_synthetic_starts(starts);
+		for (j = 0; NULL != settle_gains[j]; j++)
+			settle_compare(settle_gains[j], inputs[0].name, starts, SETTLE_STARTS);
+		if (NULL != gains)
+			settle_compare(gains, inputs[0].name, starts, SETTLE_STARTS);
+
+		if ((input_count > 1) && settle_recorded_start(&inputs[1], starts))
+		{
+			for (j = 0; NULL != settle_gains[j]; j++)
+				settle_compare(settle_gains[j], inputs[1].name, starts, 1);
+			if (NULL != gains)
+				settle_compare(gains, inputs[1].name, starts, 1);
+		}
+		return 0;
+	}
+
+	for (i = 0; i < input_count; i++)
+	{
+		if (inputs[i].ir_count > largest)
+			largest = inputs[i].ir_count;
+	}
+	batch_output_alloc(largest);
+
+	printf("benchmark,input,frames,runs,mean_ns,stddev_ns,min_ns,max_ns\n");
+	for (j = 0; j < BENCHMARK_COUNT; j++)
+	{
+		if ((NULL != only) && (NULL == strstr(benchmarks[j].name, only)))
+			continue;
+		if ((IR_BATCH_KERNEL_AUTO != benchmarks[j].kernel)
+				&& !ir_batch_kernel_available(benchmarks[j].kernel))
+			continue;
+		for (i = 0; i < input_count; i++)
+			bench_run(j, &inputs[i], runs);
+	}
+
+	return 0;
+}
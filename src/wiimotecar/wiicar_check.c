@@ -0,0 +1,681 @@
+/*!
+ \file
+
+ \brief wiicarcheck: checks the integer math against its references, run by make check.
+
+ Each check sweeps its inputs exhaustively where that is cheap, or random inputs from a fixed seed
+ where it is not, prints the first few mismatches and a summary line.  The exit status is the number
+ of checks that failed.
+
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <wiicarutility/utility.h>
+#include <wiicarutility/interval_stats.h>
+
+#include "wiicar.h"
+#include "wiicar_math.h"
+#include "wiicar_ir_batch.h"
+
+/// \brief Mismatches printed per check, the rest are only counted.
+#define CHECK_MAX_REPORTED 10
+
+/// \brief Largest error of fixed_asin(), in degrees * 100.
+#define CHECK_ASIN_MAX_ERROR 2.0
+
+/// \brief Random point sets per IR check, half anywhere in the camera's view, half in tight clusters.
+#define CHECK_IR_RANDOM_SETS 2000000
+
+/// \brief Side of the grid whose every point set is checked, and of the random clusters.
+#define CHECK_IR_GRID 5
+
+#define CHECK_IR_WIDTH 1024
+#define CHECK_IR_HEIGHT 768
+
+/// \brief Streams of intervals checked, and the longest stream.
+#define CHECK_INTERVAL_STREAMS 2000
+#define CHECK_INTERVAL_MAX_COUNT 5000
+
+/// \brief Angles swept one by one by the angle wrap check, and those checked at each end of int32_t.
+#define CHECK_ANGLE_SWEEP 5000000
+#define CHECK_ANGLE_EXTREMES 2000
+
+/// \brief Largest |dx| and |dy| of the vectors compute_vector_polar() is checked on.
+#define CHECK_POLAR_RANGE 1100
+
+/// \brief Largest error of the angle of compute_vector_polar(), in degrees * 100.
+#define CHECK_POLAR_MAX_ERROR 0.7
+
+/// \brief Synthetic frames per IR batch kernel, not a whole number of vectors so the tail is checked too.
+#define CHECK_IR_BATCH_FRAMES 200003
+
+typedef struct CheckResult_t
+{
+	uint64_t cases;
+	uint64_t failures;
+} CheckResult_t;
+
+typedef void (*CheckFunction_t)(CheckResult_t *result);
+
+/*!
+ \brief Count a case, printing it if it fails and is among the first failures.
+ */
+static void check_case(CheckResult_t *result, bool passed, const char *fmt,
+		...)
+{
+	va_list args;
+
+	result->cases++;
+	if (passed)
+		return;
+
+	if (result->failures++ < CHECK_MAX_REPORTED)
+	{
+		va_start(args, fmt);
+		printf("  ");
+		vprintf(fmt, args);
+		printf("\n");
+		va_end(args);
+	}
+}
+
+/*!
+ \brief fixed_asin() over every input and past both ends, against asin().
+ */
+static void check_fixed_asin(CheckResult_t *result)
+{
+	double exact, error, worst = 0;
+	int32_t x, clamped, angle;
+
+	for (x = -WIICAR_ACCEL_SCALING_VALUE - 64; x <= WIICAR_ACCEL_SCALING_VALUE
+			+ 64; x++)
+	{
+		clamped = coerce(x, -WIICAR_ACCEL_SCALING_VALUE,
+				WIICAR_ACCEL_SCALING_VALUE);
+		exact = asin((double) clamped / WIICAR_ACCEL_SCALING_VALUE) * 18000
+				/ M_PI;
+		angle = fixed_asin(x);
+		error = fabs(angle - exact);
+		if (error > worst)
+			worst = error;
+		check_case(result, error < CHECK_ASIN_MAX_ERROR,
+				"fixed_asin(%d) = %d, exact %.2f", x, angle, exact);
+	}
+	printf("  worst error %.2f, bound %.2f\n", worst, CHECK_ASIN_MAX_ERROR);
+}
+
+/*!
+ \brief cap_angle() as it used to be, one circle at a time, in 64 bits so it cannot overflow itself.
+ */
+static int64_t reference_cap_angle(int64_t x, int32_t cap_value,
+		int32_t circle_size, int32_t scaling)
+{
+	while (x > (int64_t) cap_value * scaling)
+		x -= (int64_t) circle_size * scaling;
+	while (x < ((int64_t) cap_value - circle_size) * scaling)
+		x += (int64_t) circle_size * scaling;
+	return x;
+}
+
+static void check_angle(CheckResult_t *result, int32_t x)
+{
+	static const int32_t caps[][2] =
+	{
+	{ 180, 360 },
+	{ 360, 360 },
+	{ 0, 360 },
+	{ 90, 180 } };
+	int64_t expected;
+	int32_t angle;
+	uint8_t i;
+
+	expected = reference_cap_angle(x, 180, 360, WIICAR_DEGREE_SCALING);
+	angle = wrap_angle(x);
+	check_case(result, angle == expected, "wrap_angle(%d) = %d, expected %lld",
+			x, angle, (long long) expected);
+
+	for (i = 0; i < sizeof(caps) / sizeof(caps[0]); i++)
+	{
+		expected = reference_cap_angle(x, caps[i][0], caps[i][1],
+				WIICAR_DEGREE_SCALING);
+		angle = cap_angle(x, caps[i][0], caps[i][1], WIICAR_DEGREE_SCALING);
+		check_case(result, angle == expected,
+				"cap_angle(%d, %d, %d) = %d, expected %lld", x, caps[i][0],
+				caps[i][1], angle, (long long) expected);
+	}
+}
+
+/*!
+ \brief wrap_angle() and cap_angle() against the loop they replaced: every angle within
+ CHECK_ANGLE_SWEEP, and the ones next to INT32_MIN and INT32_MAX.
+ */
+static void check_angle_wrap(CheckResult_t *result)
+{
+	int32_t x;
+
+	for (x = -CHECK_ANGLE_SWEEP; x <= CHECK_ANGLE_SWEEP; x++)
+		check_angle(result, x);
+
+	for (x = 0; x < CHECK_ANGLE_EXTREMES; x++)
+	{
+		check_angle(result, INT32_MIN + x);
+		check_angle(result, INT32_MAX - x);
+	}
+}
+
+/*!
+ \brief compute_vector_polar() over every vector within CHECK_POLAR_RANGE, against sqrt() and atan2().
+
+ The length is the exact length rounded to the nearest unit.  The angle is within
+ CHECK_POLAR_MAX_ERROR of the exact angle, taken round the circle so -18000 and 18000 agree, and a
+ vertical vector is exactly +-9000.
+ */
+static void check_vector_polar(CheckResult_t *result)
+{
+	double exact, error, worst = 0;
+	uint32_t magnitude, length;
+	int32_t dx, dy, angle;
+
+	for (dx = -CHECK_POLAR_RANGE; dx <= CHECK_POLAR_RANGE; dx++)
+	{
+		for (dy = -CHECK_POLAR_RANGE; dy <= CHECK_POLAR_RANGE; dy++)
+		{
+			compute_vector_polar(dx, dy, &magnitude, &angle);
+			length = lround(sqrt((double) dx * dx + (double) dy * dy));
+			check_case(result, magnitude == length,
+					"compute_vector_polar(%d, %d) length %u, expected %u", dx,
+					dy, magnitude, length);
+
+			if (0 == dx)
+			{
+				check_case(result, angle == ((dy >= 0) ? 9000 : -9000),
+						"compute_vector_polar(0, %d) angle %d", dy, angle);
+				continue;
+			}
+
+			exact = atan2(dy, dx) * 18000 / M_PI;
+			error = fabs(angle - exact);
+			if (error > 18000)
+				error = 36000 - error;
+			if (error > worst)
+				worst = error;
+			check_case(result, error <= CHECK_POLAR_MAX_ERROR,
+					"compute_vector_polar(%d, %d) angle %d, exact %.3f", dx, dy,
+					angle, exact);
+		}
+	}
+	printf("  worst angle error %.3f, bound %.2f\n", worst,
+			CHECK_POLAR_MAX_ERROR);
+}
+
+static bool sqrt_exact(uint32_t x, uint32_t root)
+{
+	return ((uint64_t) root * root <= x) && (((uint64_t) root + 1) * (root + 1)
+			> x);
+}
+
+/*!
+ \brief fixed_sqrt() rounds down exactly: every input below 2^24, and each side of every square above.
+ */
+static void check_fixed_sqrt(CheckResult_t *result)
+{
+	uint32_t x, root, square;
+
+	for (x = 0; x < (1UL << 24); x++)
+	{
+		root = fixed_sqrt(x);
+		check_case(result, sqrt_exact(x, root), "fixed_sqrt(%u) = %u", x,
+				root);
+	}
+
+	for (root = 1 << 12; root < (1 << 16); root++)
+	{
+		square = root * root;
+		check_case(result, fixed_sqrt(square - 1) == root - 1,
+				"fixed_sqrt(%u) = %u", square - 1, fixed_sqrt(square - 1));
+		check_case(result, fixed_sqrt(square) == root, "fixed_sqrt(%u) = %u",
+				square, fixed_sqrt(square));
+	}
+	check_case(result, fixed_sqrt(UINT32_MAX) == 65535, "fixed_sqrt(%u) = %u",
+			UINT32_MAX, fixed_sqrt(UINT32_MAX));
+}
+
+/*!
+ \brief normalize_accel() as it used to compute each value, before the table.
+ */
+static int16_t reference_accel(uint8_t zero, uint8_t one, uint8_t raw)
+{
+	int32_t accel;
+	int32_t one_g;
+
+	accel = ((int32_t) zero) - ((int32_t) raw);
+	accel *= WIICAR_ACCEL_SCALING_VALUE;
+	one_g = one - zero;
+	if (accel >= 0)
+		accel += one_g / 2;
+	else
+		accel -= one_g / 2;
+	accel /= one_g;
+
+	return accel;
+}
+
+/*!
+ \brief build_accel_table() and normalize_accel() against the formula, every calibration and raw value.
+
+ Every zero and one calibration pair with one != zero, the formula divides by one - zero, and every
+ raw value.  Each axis gets a different pair, so the tables of all three are checked on every build.
+ */
+static void check_accel_table(CheckResult_t *result)
+{
+	static WiimoteStatusDataType status;
+	uint32_t zero, one, raw;
+	uint8_t axis, axis_zero[3], axis_one[3];
+	int16_t expected;
+
+	for (zero = 0; zero < 256; zero++)
+		for (one = 0; one < 256; one++)
+		{
+			if (zero == one)
+				continue;
+
+			for (axis = 0; axis < 3; axis++)
+			{
+				axis_zero[axis] = zero + axis * 85;
+				axis_one[axis] = one + axis * 85;
+				status.accel_cal_data.zero[axis] = axis_zero[axis];
+				status.accel_cal_data.one[axis] = axis_one[axis];
+			}
+			build_accel_table(&status);
+
+			for (raw = 0; raw < 256; raw++)
+			{
+				for (axis = 0; axis < 3; axis++)
+					status.accel_raw_data[axis] = raw;
+				normalize_accel(&status);
+
+				for (axis = 0; axis < 3; axis++)
+				{
+					expected = reference_accel(axis_zero[axis],
+							axis_one[axis], raw);
+					check_case(result,
+							status.accel_computed_data.accel_normalized[axis]
+									== expected,
+							"axis %u zero %u one %u raw %u: %d, expected %d",
+							axis, axis_zero[axis], axis_one[axis], raw,
+							status.accel_computed_data.accel_normalized[axis],
+							expected);
+				}
+			}
+		}
+}
+
+/// \brief xorshift32, the same numbers from the same seed on every host.
+static uint32_t check_random(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static int64_t reference_distance_squared(const struct cwiid_ir_src *a,
+		const struct cwiid_ir_src *b)
+{
+	int64_t dx = (int64_t) a->pos[0] - b->pos[0];
+	int64_t dy = (int64_t) a->pos[1] - b->pos[1];
+
+	return dx * dx + dy * dy;
+}
+
+/*!
+ \brief determine_ir_front_back() as it used to be written, one branch per back point, on exact distances.
+
+ The tie rule: 0 and 1 are the front only if their side is strictly the shortest, then 1 and 2, otherwise
+ 0 and 2.
+ */
+static void reference_ir_front_back(const struct cwiid_ir_src *points,
+		struct WiimoteIRPositions_t *positions)
+{
+	struct cwiid_ir_src *front =
+			&positions->WiimoteCarPosition[WII_CAR_POSITION_FRONT];
+	int64_t distance_01, distance_12, distance_02;
+	uint8_t front_1, front_2, back;
+
+	distance_01 = reference_distance_squared(&points[0], &points[1]);
+	distance_12 = reference_distance_squared(&points[1], &points[2]);
+	distance_02 = reference_distance_squared(&points[0], &points[2]);
+
+	if ((distance_01 < distance_12) && (distance_01 < distance_02))
+	{
+		front_1 = 0;
+		front_2 = 1;
+		back = 2;
+	}
+	else if ((distance_12 < distance_01) && (distance_12 < distance_02))
+	{
+		front_1 = 1;
+		front_2 = 2;
+		back = 0;
+	}
+	else
+	{
+		front_1 = 0;
+		front_2 = 2;
+		back = 1;
+	}
+
+	front->pos[0] = (points[front_1].pos[0] + points[front_2].pos[0] + 1) / 2;
+	front->pos[1] = (points[front_1].pos[1] + points[front_2].pos[1] + 1) / 2;
+	front->size = (points[front_1].size + points[front_2].size + 1) / 2;
+	positions->WiimoteCarPosition[WII_CAR_POSITION_BACK] = points[back];
+}
+
+static bool same_ir_point(const struct cwiid_ir_src *a,
+		const struct cwiid_ir_src *b)
+{
+	return (a->pos[0] == b->pos[0]) && (a->pos[1] == b->pos[1]) && (a->size
+			== b->size);
+}
+
+/*!
+ \brief Check determine_ir_front_back() on one point set, counting it as a tie if no side is strictly shortest.
+ */
+static void check_ir_set(CheckResult_t *result,
+		const struct WiimoteIrRawData_t *raw, uint64_t *ties)
+{
+	const struct cwiid_ir_src *points = raw->WiimoteIRPoint;
+	struct WiimoteIRPositions_t expected, actual;
+	int64_t distance_01, distance_12, distance_02;
+
+	memset(&expected, 0, sizeof(expected));
+	memset(&actual, 0, sizeof(actual));
+	reference_ir_front_back(points, &expected);
+	determine_ir_front_back(raw, &actual);
+
+	check_case(result, same_ir_point(
+			&expected.WiimoteCarPosition[WII_CAR_POSITION_FRONT],
+			&actual.WiimoteCarPosition[WII_CAR_POSITION_FRONT])
+			&& same_ir_point(
+					&expected.WiimoteCarPosition[WII_CAR_POSITION_BACK],
+					&actual.WiimoteCarPosition[WII_CAR_POSITION_BACK]),
+			"(%u,%u) (%u,%u) (%u,%u): back (%u,%u), expected (%u,%u)",
+			points[0].pos[0], points[0].pos[1], points[1].pos[0],
+			points[1].pos[1], points[2].pos[0], points[2].pos[1],
+			actual.WiimoteCarPosition[WII_CAR_POSITION_BACK].pos[0],
+			actual.WiimoteCarPosition[WII_CAR_POSITION_BACK].pos[1],
+			expected.WiimoteCarPosition[WII_CAR_POSITION_BACK].pos[0],
+			expected.WiimoteCarPosition[WII_CAR_POSITION_BACK].pos[1]);
+
+	distance_01 = reference_distance_squared(&points[0], &points[1]);
+	distance_12 = reference_distance_squared(&points[1], &points[2]);
+	distance_02 = reference_distance_squared(&points[0], &points[2]);
+	if (!((distance_01 < distance_12) && (distance_01 < distance_02))
+			&& !((distance_12 < distance_01) && (distance_12 < distance_02))
+			&& !((distance_02 < distance_01) && (distance_02 < distance_12)))
+		(*ties)++;
+}
+
+/*!
+ \brief determine_ir_front_back() against the branching reference.
+
+ Every set of three points on a small grid, which holds every kind of tie, then random sets anywhere
+ in the camera's 1024x768 view and random sets in tight clusters, where ties are common.
+ */
+static void check_determine_ir_front_back(CheckResult_t *result)
+{
+	struct WiimoteIrRawData_t raw;
+	uint32_t seed = 0x1d872b41;
+	uint64_t ties = 0;
+	uint32_t i, j, cell[3], base[2], span[2];
+
+	memset(&raw, 0, sizeof(raw));
+	for (j = 0; j < 3; j++)
+		raw.WiimoteIRPoint[j].valid = 1;
+
+	for (cell[0] = 0; cell[0] < CHECK_IR_GRID * CHECK_IR_GRID; cell[0]++)
+		for (cell[1] = 0; cell[1] < CHECK_IR_GRID * CHECK_IR_GRID; cell[1]++)
+			for (cell[2] = 0; cell[2] < CHECK_IR_GRID * CHECK_IR_GRID; cell[2]++)
+			{
+				for (j = 0; j < 3; j++)
+				{
+					raw.WiimoteIRPoint[j].pos[0] = cell[j] % CHECK_IR_GRID;
+					raw.WiimoteIRPoint[j].pos[1] = cell[j] / CHECK_IR_GRID;
+					raw.WiimoteIRPoint[j].size = 1 + j;
+				}
+				check_ir_set(result, &raw, &ties);
+			}
+
+	for (i = 0; i < CHECK_IR_RANDOM_SETS; i++)
+	{
+		if (i & 1)
+		{
+			span[0] = CHECK_IR_GRID;
+			span[1] = CHECK_IR_GRID;
+			base[0] = check_random(&seed) % (CHECK_IR_WIDTH - span[0]);
+			base[1] = check_random(&seed) % (CHECK_IR_HEIGHT - span[1]);
+		}
+		else
+		{
+			span[0] = CHECK_IR_WIDTH;
+			span[1] = CHECK_IR_HEIGHT;
+			base[0] = 0;
+			base[1] = 0;
+		}
+
+		for (j = 0; j < 3; j++)
+		{
+			raw.WiimoteIRPoint[j].pos[0] = base[0] + check_random(&seed)
+					% span[0];
+			raw.WiimoteIRPoint[j].pos[1] = base[1] + check_random(&seed)
+					% span[1];
+			raw.WiimoteIRPoint[j].size = check_random(&seed) % 16;
+		}
+		check_ir_set(result, &raw, &ties);
+	}
+	printf("  %llu sets without a strictly shortest side\n",
+			(unsigned long long) ties);
+}
+
+static uint16_t batch_coordinates[6][CHECK_IR_BATCH_FRAMES];
+static uint16_t batch_positions[2][7][CHECK_IR_BATCH_FRAMES];
+static int32_t batch_angles[2][3][CHECK_IR_BATCH_FRAMES];
+
+/*!
+ \brief Frame i of the synthetic IR frames: anywhere in view, clustered, vertical, or at the edges.
+ */
+static void make_ir_batch_frame(uint32_t i, uint32_t *seed)
+{
+	uint32_t base_x = check_random(seed) % (CHECK_IR_WIDTH - CHECK_IR_GRID);
+	uint32_t base_y = check_random(seed) % (CHECK_IR_HEIGHT - CHECK_IR_GRID);
+	uint8_t j;
+
+	for (j = 0; j < 3; j++)
+	{
+		uint16_t *x = &batch_coordinates[2 * j][i];
+		uint16_t *y = &batch_coordinates[2 * j + 1][i];
+
+		switch (i % 4)
+		{
+		case 0:
+			*x = check_random(seed) % CHECK_IR_WIDTH;
+			*y = check_random(seed) % CHECK_IR_HEIGHT;
+			break;
+		case 1:
+			*x = base_x + check_random(seed) % CHECK_IR_GRID;
+			*y = base_y + check_random(seed) % CHECK_IR_GRID;
+			break;
+		case 2:
+			// 0 and 2 in line with the camera's y axis, 1 level with 0, where dx or dy is 0
+			*x = (1 == j) ? check_random(seed) % CHECK_IR_WIDTH : base_x;
+			*y = (1 == j) ? base_y : check_random(seed) % CHECK_IR_HEIGHT;
+			break;
+		default:
+			*x = (check_random(seed) & 1) ? CHECK_IR_WIDTH - 1 : 0;
+			*y = (check_random(seed) & 1) ? CHECK_IR_HEIGHT - 1 : 0;
+			break;
+		}
+	}
+}
+
+/*!
+ \brief Each vector IR batch kernel built in and run by this cpu, bit-exact against the scalar kernel.
+ */
+static void check_ir_batch(CheckResult_t *result)
+{
+	static const WiicarIrBatchKernel_t kernels[] =
+	{ IR_BATCH_KERNEL_SSE2, IR_BATCH_KERNEL_AVX2 };
+	WiicarIrBatchInput_t input;
+	WiicarIrBatchOutput_t output[2];
+	uint32_t seed = 0x5eed1e57;
+	uint32_t i, k;
+	uint8_t j, field;
+	bool same;
+
+	for (j = 0; j < 3; j++)
+	{
+		input.x[j] = batch_coordinates[2 * j];
+		input.y[j] = batch_coordinates[2 * j + 1];
+	}
+	for (j = 0; j < 2; j++)
+	{
+		output[j].front_x = batch_positions[j][0];
+		output[j].front_y = batch_positions[j][1];
+		output[j].back_x = batch_positions[j][2];
+		output[j].back_y = batch_positions[j][3];
+		output[j].center_x = batch_positions[j][4];
+		output[j].center_y = batch_positions[j][5];
+		output[j].distance = batch_positions[j][6];
+		output[j].theta = batch_angles[j][0];
+		output[j].temp_phi = batch_angles[j][1];
+		output[j].phi = batch_angles[j][2];
+	}
+
+	for (i = 0; i < CHECK_IR_BATCH_FRAMES; i++)
+		make_ir_batch_frame(i, &seed);
+	ir_batch_compute(IR_BATCH_KERNEL_SCALAR, &input, &output[1],
+			CHECK_IR_BATCH_FRAMES);
+
+	for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+	{
+		if (!ir_batch_kernel_available(kernels[k]))
+		{
+			printf("  %s not built in or not run by this cpu\n",
+					ir_batch_kernel_name(kernels[k]));
+			continue;
+		}
+
+		memset(batch_positions[0], 0, sizeof(batch_positions[0]));
+		memset(batch_angles[0], 0, sizeof(batch_angles[0]));
+		ir_batch_compute(kernels[k], &input, &output[0], CHECK_IR_BATCH_FRAMES);
+
+		for (i = 0; i < CHECK_IR_BATCH_FRAMES; i++)
+		{
+			same = true;
+			for (field = 0; field < 7; field++)
+				same &= (batch_positions[0][field][i]
+						== batch_positions[1][field][i]);
+			for (field = 0; field < 3; field++)
+				same &= (batch_angles[0][field][i] == batch_angles[1][field][i]);
+			check_case(result, same,
+					"%s frame %u (%u,%u) (%u,%u) (%u,%u): phi %d, scalar %d",
+					ir_batch_kernel_name(kernels[k]), i, input.x[0][i],
+					input.y[0][i], input.x[1][i], input.y[1][i],
+					input.x[2][i], input.y[2][i], output[0].phi[i],
+					output[1].phi[i]);
+		}
+	}
+}
+
+/*!
+ \brief interval_stats_summary() against the mean and standard deviation in double, to the microsecond.
+
+ Random streams around a 10 ms period with jitter from none to the period itself, a few with stalls
+ past INTERVAL_STATS_MAX_US, which the reference caps the same way.
+ */
+static void check_interval_stats(CheckResult_t *result)
+{
+	interval_stats_t stats;
+	uint32_t seed = 0x0badcafe;
+	uint32_t stream, i, count, spread, interval, capped, worst;
+	uint32_t mean_us, jitter_us;
+	double sum, square_sum, mean, jitter;
+
+	for (stream = 0; stream < CHECK_INTERVAL_STREAMS; stream++)
+	{
+		interval_stats_reset(&stats);
+		count = 1 + check_random(&seed) % CHECK_INTERVAL_MAX_COUNT;
+		spread = 1 + check_random(&seed) % 10000;
+		sum = 0;
+		square_sum = 0;
+		worst = 0;
+		for (i = 0; i < count; i++)
+		{
+			interval = 10000 - spread / 2 + check_random(&seed) % spread;
+			if (0 == check_random(&seed) % 1000)
+				interval = INTERVAL_STATS_MAX_US + check_random(&seed)
+						% INTERVAL_STATS_MAX_US;
+			capped = (interval > INTERVAL_STATS_MAX_US) ? INTERVAL_STATS_MAX_US
+					: interval;
+			sum += capped;
+			square_sum += (double) capped * capped;
+			if (interval > worst)
+				worst = interval;
+			interval_stats_add(&stats, interval);
+		}
+
+		mean = sum / count;
+		jitter = sqrt(fmax(square_sum / count - mean * mean, 0));
+		interval_stats_summary(&stats, &mean_us, &jitter_us);
+		check_case(result, (fabs(mean_us - mean) < 1) && (fabs(jitter_us
+				- jitter) < 1) && (stats.worst_us == worst),
+				"%u intervals: mean %u, jitter %u, worst %u, expected %.2f, %.2f, %u",
+				count, mean_us, jitter_us, stats.worst_us, mean, jitter, worst);
+	}
+}
+
+static const struct
+{
+	const char *name;
+	CheckFunction_t function;
+} checks[] =
+{
+{ "fixed_asin", check_fixed_asin },
+{ "fixed_sqrt", check_fixed_sqrt },
+{ "angle_wrap", check_angle_wrap },
+{ "vector_polar", check_vector_polar },
+{ "accel_table", check_accel_table },
+{ "determine_ir_front_back", check_determine_ir_front_back },
+{ "ir_batch", check_ir_batch },
+{ "interval_stats", check_interval_stats }, };
+
+#define CHECK_COUNT (sizeof(checks) / sizeof(checks[0]))
+
+int main(int argc, char **argv)
+{
+	CheckResult_t result;
+	uint32_t i;
+	int failed = 0;
+
+	for (i = 0; i < CHECK_COUNT; i++)
+	{
+		memset(&result, 0, sizeof(result));
+		printf("%s:\n", checks[i].name);
+		checks[i].function(&result);
+		printf("%s: %llu cases, %llu failed\n", checks[i].name,
+				(unsigned long long) result.cases,
+				(unsigned long long) result.failures);
+		if (result.failures)
+			failed++;
+	}
+	return failed;
+}
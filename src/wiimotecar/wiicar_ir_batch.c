@@ -0,0 +1,214 @@
+/*!
+ \file
+
+ \brief Batched IR frame processing, for replaying recorded IR data offline.
+
+ compute_ir_data() works on one frame at a time, which is right for the control loop but slow for
+ analysing hours of recorded frames.  The batch kernels take the frames as arrays of
+ coordinates and compute front/back, midpoint, distance, theta and phi for many frames at once.
+
+ On x86 the kernel is built for SSE2 and AVX2 from GCC vector extensions, and picked at run time.
+ Everything else runs the scalar kernel, which is compute_ir_data() itself and the reference the
+ vector kernels are bit-exact against.
+
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <wiicarutility/error_message.h>
+
+#include "wiicar.h"
+#include "wiicar_math.h"
+#include "wiicar_ir_batch.h"
+
+// __builtin_convertvector needs GCC 9, clang reports itself as GCC 4
+#if (defined(__x86_64__) || defined(__i386__)) && (__GNUC__ >= 9)
+#define IR_BATCH_X86 1
+#else
+#define IR_BATCH_X86 0
+#endif
+
+extern const struct cwiid_ir_src WiimoteMidpoint;
+
+/*!
+ \brief Runs compute_ir_data() on each frame.
+ */
+static void ir_batch_scalar(const WiicarIrBatchInput_t *input,
+		const WiicarIrBatchOutput_t *output, uint32_t start, uint32_t end)
+{
+	struct WiimoteIrRawData_t raw;
+	struct WiimoteIRComputedData_t computed;
+	struct cwiid_ir_src *position = computed.WiimoteIRPositions.WiimoteCarPosition;
+	uint32_t i;
+	uint8_t j;
+
+	memset(&raw, 0, sizeof(raw));
+	for (i = start; i < end; i++)
+	{
+		for (j = 0; j < 3; j++)
+		{
+			raw.WiimoteIRPoint[j].valid = 1;
+			raw.WiimoteIRPoint[j].pos[0] = input->x[j][i];
+			raw.WiimoteIRPoint[j].pos[1] = input->y[j][i];
+		}
+
+		compute_ir_data(&raw, &computed);
+
+		output->front_x[i] = position[WII_CAR_POSITION_FRONT].pos[0];
+		output->front_y[i] = position[WII_CAR_POSITION_FRONT].pos[1];
+		output->back_x[i] = position[WII_CAR_POSITION_BACK].pos[0];
+		output->back_y[i] = position[WII_CAR_POSITION_BACK].pos[1];
+		output->center_x[i] = position[WII_CAR_POSITION_CENTER].pos[0];
+		output->center_y[i] = position[WII_CAR_POSITION_CENTER].pos[1];
+		output->distance[i] = computed.distance;
+		output->theta[i] = computed.theta;
+		output->temp_phi[i] = computed.temp_phi;
+		output->phi[i] = computed.phi;
+	}
+}
+
+#if IR_BATCH_X86
+typedef int32_t v4si __attribute__ ((vector_size (16)));
+typedef uint32_t v4su __attribute__ ((vector_size (16)));
+typedef uint16_t v4hu __attribute__ ((vector_size (8)));
+typedef float v4sf __attribute__ ((vector_size (16)));
+typedef uint32_t v2su __attribute__ ((vector_size (8)));
+typedef uint64_t v2du __attribute__ ((vector_size (16)));
+
+typedef int32_t v8si __attribute__ ((vector_size (32)));
+typedef uint32_t v8su __attribute__ ((vector_size (32)));
+typedef uint16_t v8hu __attribute__ ((vector_size (16)));
+typedef float v8sf __attribute__ ((vector_size (32)));
+typedef uint64_t v4du __attribute__ ((vector_size (32)));
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#define IR_SUFFIX sse2
+#define IR_LANES 4
+#define IR_VEC v4si
+#define IR_UVEC v4su
+#define IR_HVEC v4hu
+#define IR_FVEC v4sf
+#define IR_HALF v2su
+#define IR_DVEC v2du
+#include "wiicar_ir_batch_kernel.h"
+#undef IR_SUFFIX
+#undef IR_LANES
+#undef IR_VEC
+#undef IR_UVEC
+#undef IR_HVEC
+#undef IR_FVEC
+#undef IR_HALF
+#undef IR_DVEC
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define IR_SUFFIX avx2
+#define IR_LANES 8
+#define IR_VEC v8si
+#define IR_UVEC v8su
+#define IR_HVEC v8hu
+#define IR_FVEC v8sf
+#define IR_HALF v4su
+#define IR_DVEC v4du
+#include "wiicar_ir_batch_kernel.h"
+#undef IR_SUFFIX
+#undef IR_LANES
+#undef IR_VEC
+#undef IR_UVEC
+#undef IR_HVEC
+#undef IR_FVEC
+#undef IR_HALF
+#undef IR_DVEC
+#pragma GCC pop_options
+#endif
+
+/*!
+ \brief Whether the kernel was built in and runs on this cpu.
+ */
+bool ir_batch_kernel_available(WiicarIrBatchKernel_t kernel)
+{
+	switch (kernel)
+	{
+	case IR_BATCH_KERNEL_AUTO:
+	case IR_BATCH_KERNEL_SCALAR:
+		return true;
+#if IR_BATCH_X86
+	case IR_BATCH_KERNEL_SSE2:
+		return __builtin_cpu_supports("sse2");
+	case IR_BATCH_KERNEL_AVX2:
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+/*!
+ \brief The widest kernel this cpu runs.
+ */
+WiicarIrBatchKernel_t ir_batch_best_kernel(void)
+{
+	if (ir_batch_kernel_available(IR_BATCH_KERNEL_AVX2))
+		return IR_BATCH_KERNEL_AVX2;
+	if (ir_batch_kernel_available(IR_BATCH_KERNEL_SSE2))
+		return IR_BATCH_KERNEL_SSE2;
+	return IR_BATCH_KERNEL_SCALAR;
+}
+
+const char *ir_batch_kernel_name(WiicarIrBatchKernel_t kernel)
+{
+	switch (kernel)
+	{
+	case IR_BATCH_KERNEL_AUTO:
+		return "auto";
+	case IR_BATCH_KERNEL_SCALAR:
+		return "scalar";
+	case IR_BATCH_KERNEL_SSE2:
+		return "sse2";
+	case IR_BATCH_KERNEL_AVX2:
+		return "avx2";
+	default:
+		return "unknown";
+	}
+}
+
+/*!
+ \brief Computes compute_ir_data() for count frames.
+
+ The frames left over after the last whole vector go through the scalar kernel.
+
+ \param kernel the kernel to use, IR_BATCH_KERNEL_AUTO for the widest available.
+ \return int32_t ERR_NONE, or ERR_PARAM if the kernel is not available.
+ */
+int32_t ir_batch_compute(WiicarIrBatchKernel_t kernel,
+		const WiicarIrBatchInput_t *input, const WiicarIrBatchOutput_t *output,
+		uint32_t count)
+{
+	uint32_t done = 0;
+
+	if (IR_BATCH_KERNEL_AUTO == kernel)
+		kernel = ir_batch_best_kernel();
+
+	if (!ir_batch_kernel_available(kernel))
+		return ERR_PARAM;
+
+	switch (kernel)
+	{
+#if IR_BATCH_X86
+	case IR_BATCH_KERNEL_SSE2:
+		done = ir_batch_sse2(input, output, 0, count);
+		break;
+	case IR_BATCH_KERNEL_AVX2:
+		done = ir_batch_avx2(input, output, 0, count);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	ir_batch_scalar(input, output, done, count);
+	return ERR_NONE;
+}
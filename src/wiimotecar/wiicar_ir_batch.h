@@ -0,0 +1,57 @@
+/*!
+ \file
+
+ \brief Batched IR frame processing, for replaying recorded IR data offline.
+
+ */
+
+#ifndef WIICAR_IR_BATCH_H_
+#define WIICAR_IR_BATCH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*!
+ \brief Three IR points per frame, one array per coordinate.
+
+ Coordinates are as reported by the camera, below 1024.
+ */
+typedef struct WiicarIrBatchInput_t
+{
+	const uint16_t *x[3];
+	const uint16_t *y[3];
+} WiicarIrBatchInput_t;
+
+/*!
+ \brief What compute_ir_data() computes for each frame, one array per value.
+ */
+typedef struct WiicarIrBatchOutput_t
+{
+	uint16_t *front_x;
+	uint16_t *front_y;
+	uint16_t *back_x;
+	uint16_t *back_y;
+	uint16_t *center_x;
+	uint16_t *center_y;
+	uint16_t *distance;
+	int32_t *theta;
+	int32_t *temp_phi;
+	int32_t *phi;
+} WiicarIrBatchOutput_t;
+
+typedef enum WiicarIrBatchKernel_t
+{
+	IR_BATCH_KERNEL_AUTO = 0, ///< the widest kernel this cpu runs
+	IR_BATCH_KERNEL_SCALAR, ///< compute_ir_data() frame by frame, the reference
+	IR_BATCH_KERNEL_SSE2, ///< 4 frames at a time
+	IR_BATCH_KERNEL_AVX2, ///< 8 frames at a time
+} WiicarIrBatchKernel_t;
+
+bool ir_batch_kernel_available(WiicarIrBatchKernel_t kernel);
+WiicarIrBatchKernel_t ir_batch_best_kernel(void);
+const char *ir_batch_kernel_name(WiicarIrBatchKernel_t kernel);
+int32_t ir_batch_compute(WiicarIrBatchKernel_t kernel,
+		const WiicarIrBatchInput_t *input, const WiicarIrBatchOutput_t *output,
+		uint32_t count);
+
+#endif /* WIICAR_IR_BATCH_H_ */
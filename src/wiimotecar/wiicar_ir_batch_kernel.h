@@ -0,0 +1,209 @@
+/*!
+ \file
+
+ \brief Body of a SIMD IR batch kernel, included by wiicar_ir_batch.c once per instruction set.
+
+ The includer defines IR_SUFFIX, IR_LANES, the vector types IR_VEC (int32), IR_UVEC (uint32),
+ IR_HVEC (uint16), IR_FVEC (float), IR_HALF (uint32, half the lanes) and IR_DVEC (uint64, half the
+ lanes).
+
+ Every step mirrors compute_ir_data() operation for operation, so the results are bit-exact.
+
+ */
+
+#define IR_CAT2(a, b) a##_##b
+#define IR_CAT(a, b) IR_CAT2(a, b)
+#define IR_FN(name) IR_CAT(name, IR_SUFFIX)
+
+/*!
+ \brief The low half of the lanes.
+
+ Vectors are split and joined through memcpy, which GCC turns into the extract and insert instructions;
+ __builtin_shufflevector would do it directly but needs GCC 12.
+ */
+static inline IR_HALF IR_FN(low)(IR_UVEC v)
+{
+	IR_HALF half;
+
+	memcpy(&half, &v, sizeof(half));
+	return half;
+}
+
+static inline IR_HALF IR_FN(high)(IR_UVEC v)
+{
+	IR_HALF half;
+
+	memcpy(&half, (const char *) &v + sizeof(half), sizeof(half));
+	return half;
+}
+
+static inline IR_UVEC IR_FN(join)(IR_HALF low, IR_HALF high)
+{
+	IR_UVEC v;
+
+	memcpy(&v, &low, sizeof(low));
+	memcpy((char *) &v + sizeof(low), &high, sizeof(high));
+	return v;
+}
+
+static inline IR_VEC IR_FN(load)(const uint16_t *p)
+{
+	IR_HVEC h;
+
+	memcpy(&h, p, sizeof(h));
+	return __builtin_convertvector(h, IR_VEC);
+}
+
+static inline void IR_FN(store16)(uint16_t *p, IR_VEC v)
+{
+	IR_HVEC h = __builtin_convertvector(v, IR_HVEC);
+
+	memcpy(p, &h, sizeof(h));
+}
+
+static inline IR_VEC IR_FN(select)(IR_VEC mask, IR_VEC a, IR_VEC b)
+{
+	return (mask & a) | (~mask & b);
+}
+
+/*!
+ \brief wrap_angle() for angles less than a turn outside the range.
+ */
+static inline IR_VEC IR_FN(wrap)(IR_VEC angle)
+{
+	angle -= (angle > WIICAR_HALF_CIRCLE) & WIICAR_FULL_CIRCLE;
+	angle += (angle < -WIICAR_HALF_CIRCLE) & WIICAR_FULL_CIRCLE;
+	return angle;
+}
+
+/*!
+ \brief compute_vector_polar_unwrapped() on every lane.
+ */
+static inline void IR_FN(polar)(IR_VEC dx, IR_VEC dy, IR_VEC *magnitude,
+		IR_VEC *angle)
+{
+	IR_VEC ax = (dx ^ (dx >> 31)) - (dx >> 31);
+	IR_VEC ay = (dy ^ (dy >> 31)) - (dy >> 31);
+	IR_VEC larger, shift, x, y, z, next_x, mask, left, up, rounded;
+	IR_DVEC low, high, low_shift, high_shift;
+	IR_DVEC one = (IR_DVEC) { } + 1;
+	uint8_t i;
+
+	larger = IR_FN(select)(ay > ax, ay, ax);
+	larger |= (larger == 0) & 1;
+
+	// clz from the float exponent, exact below 2^24
+	shift = 28 - ((((IR_VEC) __builtin_convertvector(larger, IR_FVEC)) >> 23)
+			- 127);
+	x = (IR_VEC) ((IR_UVEC) dx << (IR_UVEC) shift);
+	y = (IR_VEC) ((IR_UVEC) dy << (IR_UVEC) shift);
+
+	// rotate into the right half plane: up (y, -x, 90), down (-y, x, -90)
+	left = x < 0;
+	up = y >= 0;
+	next_x = IR_FN(select)(left, IR_FN(select)(up, y, -y), x);
+	y = IR_FN(select)(left, IR_FN(select)(up, -x, x), y);
+	x = next_x;
+	z = left & ((up & (2 * 90 * WIICAR_DEGREE_SCALING * 256)) - 90
+			* WIICAR_DEGREE_SCALING * 256);
+
+	for (i = 0; i < WIICAR_CORDIC_ITERATIONS; i++)
+	{
+		mask = y >> 31;
+		next_x = x + (((y >> i) ^ mask) - mask);
+		y -= ((x >> i) ^ mask) - mask;
+		x = next_x;
+		z += (wiicar_cordic_angles[i] ^ mask) - mask;
+	}
+
+	// the length needs 64 bit products, half the lanes at a time
+	low = __builtin_convertvector(IR_FN(low)((IR_UVEC) x), IR_DVEC);
+	high = __builtin_convertvector(IR_FN(high)((IR_UVEC) x), IR_DVEC);
+	low_shift = __builtin_convertvector(IR_FN(low)((IR_UVEC) shift), IR_DVEC);
+	high_shift = __builtin_convertvector(IR_FN(high)((IR_UVEC) shift),
+			IR_DVEC);
+	low = (low * WIICAR_CORDIC_INVERSE_GAIN + (one << (low_shift + 29)))
+			>> (low_shift + 30);
+	high = (high * WIICAR_CORDIC_INVERSE_GAIN + (one << (high_shift + 29)))
+			>> (high_shift + 30);
+	rounded = (IR_VEC) IR_FN(join)(__builtin_convertvector(low, IR_HALF),
+			__builtin_convertvector(high, IR_HALF));
+
+	// a vertical or zero vector is exactly +-90
+	*magnitude = IR_FN(select)(dx == 0, ay, rounded);
+	*angle = IR_FN(select)(dx == 0, ((dy >= 0) & (2 * 90 * WIICAR_DEGREE_SCALING))
+			- 90 * WIICAR_DEGREE_SCALING, (z + 128) >> 8);
+}
+
+/*!
+ \brief Processes frames from start on in whole vectors.
+
+ \return uint32_t the first frame not processed, fewer than IR_LANES before end.
+ */
+static uint32_t IR_FN(ir_batch)(const WiicarIrBatchInput_t *input,
+		const WiicarIrBatchOutput_t *output, uint32_t start, uint32_t end)
+{
+	IR_VEC x0, y0, x1, y1, x2, y2;
+	IR_VEC d01, d12, d02, shortest_01, shortest_12;
+	IR_VEC front_x, front_y, back_x, back_y, center_x, center_y;
+	IR_VEC distance, angle, theta, temp_phi, phi;
+	int32_t midpoint_x = WiimoteMidpoint.pos[0];
+	int32_t midpoint_y = WiimoteMidpoint.pos[1];
+	uint32_t i;
+
+	for (i = start; i + IR_LANES <= end; i += IR_LANES)
+	{
+		x0 = IR_FN(load)(&input->x[0][i]);
+		y0 = IR_FN(load)(&input->y[0][i]);
+		x1 = IR_FN(load)(&input->x[1][i]);
+		y1 = IR_FN(load)(&input->y[1][i]);
+		x2 = IR_FN(load)(&input->x[2][i]);
+		y2 = IR_FN(load)(&input->y[2][i]);
+
+		// determine_ir_front_back()
+		d01 = (x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0);
+		d12 = (x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1);
+		d02 = (x2 - x0) * (x2 - x0) + (y2 - y0) * (y2 - y0);
+		shortest_01 = (d01 < d12) & (d01 < d02);
+		shortest_12 = (d12 < d01) & (d12 < d02);
+
+		back_x = IR_FN(select)(shortest_01, x2, IR_FN(select)(shortest_12, x0, x1));
+		back_y = IR_FN(select)(shortest_01, y2, IR_FN(select)(shortest_12, y0, y1));
+		front_x = (IR_FN(select)(shortest_12, x1, x0) + IR_FN(select)(
+				shortest_01, x1, x2) + 1) >> 1;
+		front_y = (IR_FN(select)(shortest_12, y1, y0) + IR_FN(select)(
+				shortest_01, y1, y2) + 1) >> 1;
+
+		// determine_car_midpoint()
+		center_x = (front_x + back_x + 1) >> 1;
+		center_y = (front_y + back_y + 1) >> 1;
+
+		// compute_ir_theta(), y reversed
+		IR_FN(polar)(front_x - back_x, back_y - front_y, &distance, &angle);
+		theta = -IR_FN(wrap)(angle + 90 * WIICAR_DEGREE_SCALING);
+
+		// distance and compute_ir_temp_phi()
+		IR_FN(polar)(midpoint_x - center_x, center_y - midpoint_y, &distance,
+				&angle);
+		temp_phi = -IR_FN(wrap)(angle + 90 * WIICAR_DEGREE_SCALING);
+
+		IR_FN(store16)(&output->front_x[i], front_x);
+		IR_FN(store16)(&output->front_y[i], front_y);
+		IR_FN(store16)(&output->back_x[i], back_x);
+		IR_FN(store16)(&output->back_y[i], back_y);
+		IR_FN(store16)(&output->center_x[i], center_x);
+		IR_FN(store16)(&output->center_y[i], center_y);
+		IR_FN(store16)(&output->distance[i], distance);
+		memcpy(&output->theta[i], &theta, sizeof(theta));
+		memcpy(&output->temp_phi[i], &temp_phi, sizeof(temp_phi));
+
+		// compute_ir_phi()
+		phi = IR_FN(wrap)(theta - temp_phi);
+		memcpy(&output->phi[i], &phi, sizeof(phi));
+	}
+	return i;
+}
+
+#undef IR_FN
+#undef IR_CAT
+#undef IR_CAT2
@@ -5,65 +5,359 @@
 
  \todo Some of these functions update and use global data, others have pass by reference.
 
+ The router has no FPU, so asin, atan and sqrt are soft-float library calls there.  IR distances and
+ angles are always computed with integer CORDIC.  Configured with --enable-fixed-point-math, the
+ accelerometer angles are computed with table lookups and integer arithmetic as well.
+
  */
 
+#include <config.h>
 #include "wiicar.h"
+#include "wiicar_math.h"
 #include <stdint.h>
+#include <stdlib.h>
+#if !WIICAR_FIXED_POINT_MATH
 #include <math.h>
+#endif
+
+/*!
+ \brief Wraps an angle into the range from cap_value - circle_size to cap_value.
 
+ An angle above the range ends up in (cap_value - circle_size, cap_value], one below it in
+ [cap_value - circle_size, cap_value), as if whole circles were subtracted or added one at a time.
+ Takes constant time however far off the angle is.  Use wrap_angle() for the usual -180 to 180.
+ */
 int32_t cap_angle(int32_t x, int32_t cap_value, int32_t circle_size,
 		int32_t scaling)
 {
-	int32_t y = x;
-	while (y > (cap_value * scaling))
+	int32_t high = cap_value * scaling;
+	int32_t low = (cap_value - circle_size) * scaling;
+	uint32_t circle = circle_size * scaling;
+
+	// number of whole circles, from unsigned differences so no input overflows
+	if (x > high)
+		return x - (((uint32_t) x - (uint32_t) high - 1) / circle + 1) * circle;
+	if (x < low)
+		return x + (((uint32_t) low - (uint32_t) x - 1) / circle + 1) * circle;
+	return x;
+}
+
+/*!
+ \brief asin of 0..0.5 in degrees * 100, at steps of 1/64.
+
+ One entry past the range, so the interpolation needs no bounds check.
+ */
+static const int16_t asin_table[34] =
+{ 0, 90, 179, 269, 358, 448, 538, 628, 718, 808, 899, 990, 1081, 1172, 1264,
+		1355, 1448, 1540, 1633, 1727, 1821, 1916, 2011, 2106, 2202, 2299, 2397,
+		2495, 2594, 2694, 2795, 2897, 3000, 3104 };
+
+/*!
+ \brief Linear interpolation in the table above.
+
+ \param x table argument in units of 1 / 65536.
+ */
+static int32_t interpolate_table(const int16_t *table, uint32_t x)
+{
+	uint32_t index = x >> 10;
+	int32_t fraction = x & 1023;
+
+	return table[index] + (((table[index + 1] - table[index]) * fraction + 512)
+			>> 10);
+}
+
+/*!
+ \brief Integer square root, rounded down.
+
+ Gives the same result as (uint32_t) sqrt(x) for every x.  One result bit per step, without branches
+ on the data inside the loop, which mispredict on every other step.
+ */
+uint32_t fixed_sqrt(uint32_t x)
+{
+	uint32_t root = 0;
+	uint32_t bit, trial, mask;
+
+	if (0 == x)
+		return 0;
+
+	// highest even bit position not above the top bit of x
+	bit = 1UL << ((31 - __builtin_clz(x)) & ~1);
+
+	while (bit)
+	{
+		trial = root + bit;
+		mask = -(uint32_t) (x >= trial);
+		x -= trial & mask;
+		root = (root >> 1) + (bit & mask);
+		bit >>= 2;
+	}
+	return root;
+}
+
+/*!
+ \brief Integer only arcsine.
+
+ Above 0.5 the table is steep, so asin(x) = 90 - 2 * asin(sqrt((1 - x) / 2)) is used there instead.
+ Less than 0.02 degrees off the exact arcsine.
+
+ \param x sine scaled by WIICAR_ACCEL_SCALING_VALUE, -1 to 1.
+ \return int32_t angle in degrees * 100, -9000 to 9000.
+ */
+int32_t fixed_asin(int32_t x)
+{
+	uint32_t magnitude = (x < 0) ? -x : x;
+	int32_t angle;
+
+	if (magnitude > WIICAR_ACCEL_SCALING_VALUE)
+		magnitude = WIICAR_ACCEL_SCALING_VALUE;
+
+	if (magnitude <= (WIICAR_ACCEL_SCALING_VALUE / 2))
+	{
+		angle = interpolate_table(asin_table, magnitude
+				* (65536 / WIICAR_ACCEL_SCALING_VALUE));
+	}
+	else
+	{
+		// (1 - x) / 2 in units of 1 / 2^32, its root in units of 1 / 65536
+		angle = 90 * WIICAR_DEGREE_SCALING - 2 * interpolate_table(asin_table,
+				fixed_sqrt((WIICAR_ACCEL_SCALING_VALUE - magnitude)
+						* (0x80000000UL / WIICAR_ACCEL_SCALING_VALUE)));
+	}
+
+	return (x < 0) ? -angle : angle;
+}
+
+/*!
+ \brief atan(2^-i) in degrees * 100 * 256.
+ */
+const int32_t wiicar_cordic_angles[WIICAR_CORDIC_ITERATIONS] =
+{ 1152000, 680065, 359328, 182400, 91554, 45822, 22916, 11459, 5730, 2865,
+		1432, 716, 358, 179, 90, 45 };
+
+/*!
+ \brief compute_vector_polar(), leaving the angle up to 10 degrees past -180 or 180.
+
+ The vector is rotated onto the x axis in a fixed number of shift and add steps, the rotations add
+ up to its angle and the final x is its length times the CORDIC gain.  The vector is scaled up first so
+ short vectors get the same precision as long ones.  No branches depend on the data inside the loop.
+
+ The length is the exact length rounded to the nearest unit, where compute_distance() used to round
+ down, and the angle is less than 0.01 degrees off the exact angle, checked exhaustively over
+ vectors up to 1100 long.
+ */
+static void compute_vector_polar_unwrapped(int32_t dx, int32_t dy,
+		uint32_t *magnitude, WiicarAngle_t *angle)
+{
+	int32_t x, y, next_x, mask;
+	int32_t z = 0;
+	uint32_t larger;
+	uint8_t shift, i;
+
+	if (0 == dx)
 	{
-		y -= circle_size * scaling;
+		*magnitude = (dy < 0) ? -dy : dy;
+		*angle = (dy >= 0) ? 90 * WIICAR_DEGREE_SCALING : -90
+				* WIICAR_DEGREE_SCALING;
+		return;
+	}
+
+	larger = (dx < 0) ? -dx : dx;
+	if ((uint32_t) ((dy < 0) ? -dy : dy) > larger)
+		larger = (dy < 0) ? -dy : dy;
+
+	// put the top bit at 28, leaving room for the gain of 1.65 and the sign
+	shift = __builtin_clz(larger) - 3;
+	x = dx * (1L << shift);
+	y = dy * (1L << shift);
+
+	// rotate into the right half plane, where the steps converge
+	if (x < 0)
+	{
+		next_x = x;
+		if (y >= 0)
+		{
+			x = y;
+			y = -next_x;
+			z = 90 * WIICAR_DEGREE_SCALING * 256;
+		}
+		else
+		{
+			x = -y;
+			y = next_x;
+			z = -90 * WIICAR_DEGREE_SCALING * 256;
+		}
 	}
 
-	while (y < ((cap_value - circle_size) * scaling))
+	for (i = 0; i < WIICAR_CORDIC_ITERATIONS; i++)
 	{
-		y += circle_size * scaling;
+		// rotate towards the x axis, negating the step when y is below it
+		mask = y >> 31;
+		next_x = x + (((y >> i) ^ mask) - mask);
+		y -= ((x >> i) ^ mask) - mask;
+		x = next_x;
+		z += (wiicar_cordic_angles[i] ^ mask) - mask;
 	}
-	return y;
+
+	*magnitude = ((uint64_t) x * WIICAR_CORDIC_INVERSE_GAIN
+			+ (1ULL << (29 + shift))) >> (30 + shift);
+	*angle = (z + 128) >> 8;
 }
 
-volatile struct cwiid_ir_src WiimoteMidpoint =
+/*!
+ \brief Computes the length and angle of a vector with integer CORDIC vectoring.
+
+ \param dx x component, |dx| < 2^28.
+ \param dy y component, |dy| < 2^28.
+ \param magnitude filled with the length of the vector.
+ \param angle filled with the angle in degrees * 100 counter clockwise from the x axis, -18000 to 18000.
+ A vertical or zero vector is +-9000, as compute_angle() always returned.
+ */
+void compute_vector_polar(int32_t dx, int32_t dy, uint32_t *magnitude,
+		int32_t *angle)
+{
+	WiicarAngle_t unwrapped;
+
+	compute_vector_polar_unwrapped(dx, dy, magnitude, &unwrapped);
+	*angle = wrap_angle(unwrapped);
+}
+
+const struct cwiid_ir_src WiimoteMidpoint =
 { 0,
 { 1024 / 2, 768 / 2 }, 0 };
 
+/*!
+ \brief Normalize one accelerometer value based on calibration data.
+
+ Remove offset and setup scaling using factory calibration data read out of Wiimote.  This is what
+ build_accel_table() puts in the table, it divides and is too slow for every sample.
+ */
+int16_t normalize_accel_value(uint8_t zero, uint8_t one, uint8_t raw)
+{
+	int32_t accel;
+	int32_t one_g;
+
+	accel = ((int32_t) zero) - ((int32_t) raw);
+
+	accel *= WIICAR_ACCEL_SCALING_VALUE;
+
+	one_g = one - zero;
+
+	if (accel >= 0)
+		accel += one_g / 2;
+	else
+		accel -= one_g / 2;
+
+	accel /= one_g;
+
+	return accel;
+}
+
+/*!
+ \brief Compute the normalized value of every raw accelerometer value, once the calibration data is read.
+
+ \param wiimote_status pointer to the wiimote status data, with valid calibration data.
+ */
+void build_accel_table(struct WiimoteStatusDataType *wiimote_status)
+{
+	uint8_t zero, one;
+	uint8_t i;
+	uint16_t raw;
+
+	for (i = 0; i < 3; i++)
+	{
+		zero = wiimote_status->accel_cal_data.zero[i];
+		one = wiimote_status->accel_cal_data.one[i];
+
+		for (raw = 0; raw < 256; raw++)
+			wiimote_status->accel_table[i][raw] = normalize_accel_value(zero, one,
+					raw);
+	}
+}
+
 /*!
  \brief Normalize accleration values based on calibration data.
 
- Remove offset and setup scaling using factory calibration data read out of Wiimote.
+ Looks the values up in the table of build_accel_table().
 
  \param wiimote_status pointer to the wiimote status data
  */
-void normalize_accel(volatile struct WiimoteStatusDataType *wiimote_status)
+void normalize_accel(struct WiimoteStatusDataType *wiimote_status)
 {
-	int32_t accel;
 	uint8_t i;
-	int32_t one_g;
 
 	for (i = 0; i < 3; i++)
 	{
-		accel = ((int32_t) wiimote_status->accel_cal_data.zero[i])
-				- ((int32_t) wiimote_status->accel_raw_data[i]);
+		wiimote_status->accel_computed_data.accel_normalized[i]
+				= wiimote_status->accel_table[i][wiimote_status->accel_raw_data[i]];
+	}
+
+}
 
-		accel *= WIICAR_ACCEL_SCALING_VALUE;
+/*!
+ \brief Set up a filter for accel_filter_apply(), it starts from the first sample it sees.
 
-		one_g = wiimote_status->accel_cal_data.one[i]
-				- wiimote_status->accel_cal_data.zero[i];
+ \param type WIICAR_ACCEL_FILTER_NONE passes the samples through.
+ \param shift log2 of the length: the time constant of the IIR filter, or the number of samples averaged,
+ in samples.  At most WIICAR_ACCEL_FILTER_MAX_SHIFT.
+ */
+void accel_filter_init(WiicarAccelFilter_t *filter,
+		WiicarAccelFilterType_t type, uint8_t shift)
+{
+	filter->type = type;
+	filter->shift = (shift > WIICAR_ACCEL_FILTER_MAX_SHIFT) ?
+			WIICAR_ACCEL_FILTER_MAX_SHIFT : shift;
+	filter->primed = false;
+	filter->index = 0;
+}
 
-		if (accel >= 0)
-			accel += one_g / 2;
-		else
-			accel -= one_g / 2;
+/*!
+ \brief Filters the normalized acceleration of each axis in place, in constant time per sample.
+
+ The IIR filter is the one pole low pass y += (x - y) / 2^shift, kept with 8 fraction bits.  The
+ moving average keeps the running sum of a ring of the last 2^shift samples.  Both are primed with the
+ first sample, so they do not ramp up from 0.
+ */
+void accel_filter_apply(WiicarAccelFilter_t *filter,
+		struct WiimoteAccelComputedData_t *WiimoteAccelComputedData)
+{
+	const uint8_t length = 1 << filter->shift;
+	int32_t x;
+	uint8_t i, j;
+
+	for (i = 0; i < 3; i++)
+	{
+		x = WiimoteAccelComputedData->accel_normalized[i];
+
+		switch (filter->type)
+		{
+		case WIICAR_ACCEL_FILTER_IIR:
+			if (!filter->primed)
+				filter->state[i] = x << 8;
+			filter->state[i] += ((x << 8) - filter->state[i]) >> filter->shift;
+			x = (filter->state[i] + 128) >> 8;
+			break;
+
+		case WIICAR_ACCEL_FILTER_AVERAGE:
+			if (!filter->primed)
+			{
+				for (j = 0; j < length; j++)
+					filter->ring[i][j] = x;
+				filter->state[i] = x << filter->shift;
+			}
+			filter->state[i] += x - filter->ring[i][filter->index];
+			filter->ring[i][filter->index] = x;
+			x = (filter->state[i] + (length >> 1)) >> filter->shift;
+			break;
 
-		accel /= one_g;
+		default:
+			break;
+		}
 
-		wiimote_status->accel_computed_data.accel_normalized[i] = accel;
+		WiimoteAccelComputedData->accel_normalized[i] = x;
 	}
 
+	filter->index = (filter->index + 1) & (length - 1);
+	filter->primed = true;
 }
 
 /*!
@@ -74,10 +368,14 @@ void normalize_accel(volatile struct WiimoteStatusDataType *wiimote_status)
  \param WiimoteAccelComputedData must contain normalized accelerometers values.
  */
 int32_t determine_pitch(
-		volatile struct WiimoteAccelComputedData_t *WiimoteAccelComputedData)
+		const struct WiimoteAccelComputedData_t *WiimoteAccelComputedData)
 {
 	int32_t y_accel = WiimoteAccelComputedData->accel_normalized[Y_AXIS];
+#if WIICAR_FIXED_POINT_MATH
+	int32_t pitch;
+#else
 	float pitch;
+#endif
 
 	// cap the y_accel at 1 G
 	if (y_accel > WIICAR_ACCEL_SCALING_VALUE)
@@ -89,17 +387,21 @@ int32_t determine_pitch(
 		y_accel = -WIICAR_ACCEL_SCALING_VALUE;
 	}
 
+#if WIICAR_FIXED_POINT_MATH
+	pitch = fixed_asin(y_accel);
+#else
 	pitch = (float) y_accel / WIICAR_ACCEL_SCALING_VALUE;
 	pitch = asin(pitch);
 	pitch *= 180 / M_PI;
 	pitch *= WIICAR_DEGREE_SCALING;
+#endif
 
 	if (WiimoteAccelComputedData->accel_normalized[Z_AXIS] > 0)
 	{
 		pitch = 18000 - pitch;
 	}
 
-	pitch = cap_angle(pitch, 180, 360, 100);
+	pitch = wrap_angle(pitch);
 
 	return pitch;
 }
@@ -113,7 +415,7 @@ int32_t determine_pitch(
  */
 
 int32_t determine_roll(
-		volatile struct WiimoteAccelComputedData_t *WiimoteAccelComputedData)
+		const struct WiimoteAccelComputedData_t *WiimoteAccelComputedData)
 {
 	int32_t x_accel = WiimoteAccelComputedData->accel_normalized[X_AXIS];
 	int32_t roll;
@@ -128,15 +430,19 @@ int32_t determine_roll(
 		x_accel = -WIICAR_ACCEL_SCALING_VALUE;
 	}
 
+#if WIICAR_FIXED_POINT_MATH
+	roll = fixed_asin(x_accel);
+#else
 	roll = WIICAR_DEGREE_SCALING * asin((float) x_accel
 			/ WIICAR_ACCEL_SCALING_VALUE) * 180 / M_PI;
+#endif
 
 	if (WiimoteAccelComputedData->accel_normalized[Z_AXIS] > 0)
 	{
 		roll = 18000 - roll;
 	}
 
-	roll = cap_angle(roll, 180, 360, 100);
+	roll = wrap_angle(roll);
 
 	return 0 - roll;
 }
@@ -148,7 +454,7 @@ int32_t determine_roll(
  */
 
 int32_t determine_yaw(
-		volatile struct WiimoteAccelComputedData_t *WiimoteAccelComputedData)
+		const struct WiimoteAccelComputedData_t *WiimoteAccelComputedData)
 {
 	int32_t z_accel = WiimoteAccelComputedData->accel_normalized[Z_AXIS];
 	int32_t yaw;
@@ -163,8 +469,12 @@ int32_t determine_yaw(
 		z_accel = -WIICAR_ACCEL_SCALING_VALUE;
 	}
 
+#if WIICAR_FIXED_POINT_MATH
+	yaw = fixed_asin(z_accel);
+#else
 	yaw = WIICAR_DEGREE_SCALING * asin((float) z_accel
 			/ WIICAR_ACCEL_SCALING_VALUE) * 180 / M_PI;
+#endif
 
 	yaw += 9000;
 
@@ -173,7 +483,7 @@ int32_t determine_yaw(
 		yaw = 18000 - yaw;
 	}
 
-	yaw = cap_angle(yaw, 180, 360, 100);
+	yaw = wrap_angle(yaw);
 
 	return yaw;
 }
@@ -186,12 +496,12 @@ int32_t determine_yaw(
 
 uint32_t compute_distance(int16_t x_1, int16_t x_2, int16_t y_1, int16_t y_2)
 {
-	int32_t x_dist, y_dist;
+	uint32_t distance;
+	int32_t angle;
 
-	x_dist = x_2 - x_1;
-	y_dist = y_2 - y_1;
+	compute_vector_polar(x_2 - x_1, y_2 - y_1, &distance, &angle);
 
-	return ((uint32_t) sqrt(x_dist * x_dist + y_dist * y_dist));
+	return distance;
 }
 
 /*!
@@ -207,35 +517,13 @@ uint32_t compute_distance(int16_t x_1, int16_t x_2, int16_t y_1, int16_t y_2)
 int32_t compute_angle(int16_t x_1, int16_t x_2, int16_t y_1, int16_t y_2)
 {
 	int32_t theta1;
-	int32_t tan_theta;
+	uint32_t distance;
 	int16_t dx, dy;
 
 	dx = (int16_t) x_2 - (int16_t) x_1;
 	dy = (int16_t) y_2 - (int16_t) y_1;
 
-	if (dx == 0)
-	{
-		if (dy >= 0)
-		{
-			return 90 * WIICAR_DEGREE_SCALING;
-		}
-		else
-		{
-			return -90 * WIICAR_DEGREE_SCALING;
-		}
-	}
-
-	tan_theta = ((int32_t) WIICAR_ACCEL_SCALING_VALUE * dy) / dx;
-
-	theta1 = atan((float) tan_theta / WIICAR_ACCEL_SCALING_VALUE) * 180 / M_PI
-			* WIICAR_DEGREE_SCALING;
-
-	if (dx < 0)
-	{
-		theta1 += (180 * WIICAR_DEGREE_SCALING);
-	}
-
-	theta1 = cap_angle(theta1, 180, 360, WIICAR_DEGREE_SCALING);
+	compute_vector_polar(dx, dy, &distance, &theta1);
 
 	return theta1;
 }
@@ -245,130 +533,192 @@ int32_t compute_angle(int16_t x_1, int16_t x_2, int16_t y_1, int16_t y_2)
 
  A point is considered invalid of x = y = 0x03FF.
 
- Note that this requires the three valid points to be the first points, as this is the only way the later processing will work.
-
+ Every slot is counted, the valid points need not be the first ones.  select_ir_points() gathers them.
 
  \param WiimoteIRComputedData pointer to wiimote infrared computeddata structure.  When function finished, will contain count of IR point.
 
  */
 void count_ir_points(
-		volatile struct WiimoteIRComputedData_t *WiimoteIRComputedData,
-		volatile struct WiimoteIrRawData_t *WiimoteIrRawData)
+		struct WiimoteIRComputedData_t *WiimoteIRComputedData,
+		const struct WiimoteIrRawData_t *WiimoteIrRawData)
 {
 	uint8_t i;
 	uint8_t count = 0;
 
-	for (i = 0; i < 4; i++)
-	{
-		if (WiimoteIrRawData->WiimoteIRPoint[i].valid)
-		{
-			count++;
-		}
-		else
-		{
-			break;
-		}
-
-	}
+	for (i = 0; i < WIICAR_NUMBER_OF_MAX_IR_POINTS; i++)
+		count += (0 != WiimoteIrRawData->WiimoteIRPoint[i].valid);
 
 	WiimoteIRComputedData->count = count;
 }
 
 /*!
- \brief Function computes the distance between two IR points.
+ \brief Gathers the valid IR points from every slot, dropping the smallest beyond three.
+
+ With a fourth point in view, a reflection or another light, the three largest are the car's leds.
+ The points keep the order of their slots: the camera keeps a spot in the same slot while it stays in
+ view, which associate_ir_front_back() relies on.  Of points of equal size the later slot is dropped.
+
+ \param selected the three points, or fewer, followed by invalid ones.
+ \return uint8_t number of valid points in view, up to four.
+ */
+uint8_t select_ir_points(const struct WiimoteIrRawData_t *WiimoteIrRawData,
+		struct WiimoteIrRawData_t *selected)
+{
+	uint8_t i, count = 0, smallest = 0;
+
+	for (i = 0; i < WIICAR_NUMBER_OF_MAX_IR_POINTS; i++)
+	{
+		if (!WiimoteIrRawData->WiimoteIRPoint[i].valid)
+			continue;
+
+		selected->WiimoteIRPoint[count] = WiimoteIrRawData->WiimoteIRPoint[i];
+		if (selected->WiimoteIRPoint[count].size
+				<= selected->WiimoteIRPoint[smallest].size)
+			smallest = count;
+		count++;
+	}
+
+	if (count > WIICAR_IR_NUMBER_OF_POINTS)
+	{
+		for (i = smallest; i < count - 1; i++)
+			selected->WiimoteIRPoint[i] = selected->WiimoteIRPoint[i + 1];
+		selected->WiimoteIRPoint[count - 1].valid = 0;
+	}
 
- This is basically a forwarding function for ComputeDistance.  Although it may be changed to elimiate the squareroot using approx:
+	for (i = count; i < WIICAR_NUMBER_OF_MAX_IR_POINTS; i++)
+		selected->WiimoteIRPoint[i].valid = 0;
 
+	return count;
+}
 
- distance = sqrt(dx^2 + dy^2) ~ dx + dy
+/*!
+ \brief Function computes the distance between two IR points.
 
- This would significantly reduce processing time, and probably still allow for finding front and back points.
+ This is basically a forwarding function for ComputeDistance.  Where distances are only compared, use
+ compute_ir_distance_squared() instead.
 
  \param WiimotePoint1 pointer the first IR point.
  \param WiimotePoint2 pointer to the second IR point.
 
  \return uint32_t The distance between WiimotePoint1 and WiimotePoint2
  */
-uint32_t compute_ir_distance(volatile struct cwiid_ir_src *WiimotePoint1,
-		volatile struct cwiid_ir_src *WiimotePoint2)
+uint32_t compute_ir_distance(const struct cwiid_ir_src *WiimotePoint1,
+		const struct cwiid_ir_src *WiimotePoint2)
 {
 	return compute_distance(WiimotePoint1->pos[0], WiimotePoint2->pos[0],
 			WiimotePoint1->pos[1], WiimotePoint2->pos[1]);
 }
 
 /*!
- \brief Determines IR points are front and which are back.
+ \brief Computes the square of the distance between two IR points, exact and without a root.
 
- Checks the distance between all three points, the shortest distance is the front, the other point is the back.
+ \return uint32_t The squared distance between WiimotePoint1 and WiimotePoint2
+ */
+uint32_t compute_ir_distance_squared(const struct cwiid_ir_src *WiimotePoint1,
+		const struct cwiid_ir_src *WiimotePoint2)
+{
+	int32_t dx = WiimotePoint2->pos[0] - WiimotePoint1->pos[0];
+	int32_t dy = WiimotePoint2->pos[1] - WiimotePoint1->pos[1];
 
- \param WiimoteIRPositions this will be filled with the front and back point.  Front is the midpoint of the two front LEDS.
- \param WiimoteIRData this contains the input IR data to the function.
+	return dx * dx + dy * dy;
+}
+
+/*!
+ \brief Fills in the front and back of the car, given which of the three points is the back led.
  */
-void determine_ir_front_back(
-		volatile struct WiimoteIrRawData_t *WiimoteIrRawData,
-		volatile struct WiimoteIRPositions_t *WiimoteIRPositions)
+static void set_ir_front_back(const struct cwiid_ir_src *points,
+		uint8_t back, struct WiimoteIRPositions_t *WiimoteIRPositions)
 {
-	uint32_t distance_01, distance_12, distance_02;
+	const struct cwiid_ir_src *front_1 = &points[back == 0];
+	const struct cwiid_ir_src *front_2 = &points[2 - (back == 2)];
 
-	distance_01 = compute_ir_distance(&WiimoteIrRawData->WiimoteIRPoint[0],
-			&WiimoteIrRawData->WiimoteIRPoint[1]);
-	distance_12 = compute_ir_distance(&WiimoteIrRawData->WiimoteIRPoint[1],
-			&WiimoteIrRawData->WiimoteIRPoint[2]);
-	distance_02 = compute_ir_distance(&WiimoteIrRawData->WiimoteIRPoint[0],
-			&WiimoteIrRawData->WiimoteIRPoint[2]);
+	WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_FRONT].pos[0]
+			= (front_1->pos[0] + front_2->pos[0] + 1) / 2;
 
-	if ((distance_01 < distance_12) && (distance_01 < distance_02)) // 01 is shortest distance -> 01 are front points, 2 is back
-	{
-		WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_FRONT].pos[0]
-				= (WiimoteIrRawData->WiimoteIRPoint[0].pos[0]
-						+ WiimoteIrRawData->WiimoteIRPoint[1].pos[0] + 1) / 2;
+	WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_FRONT].pos[1]
+			= (front_1->pos[1] + front_2->pos[1] + 1) / 2;
 
-		WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_FRONT].pos[1]
-				= (WiimoteIrRawData->WiimoteIRPoint[0].pos[1]
-						+ WiimoteIrRawData->WiimoteIRPoint[1].pos[1] + 1) / 2;
+	WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_FRONT].size
+			= (front_1->size + front_2->size + 1) / 2;
 
-		WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_FRONT].size
-				= (WiimoteIrRawData->WiimoteIRPoint[0].size
-						+ WiimoteIrRawData->WiimoteIRPoint[1].size + 1) / 2;
+	WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_BACK]
+			= points[back];
+}
 
-		WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_BACK]
-				= WiimoteIrRawData->WiimoteIRPoint[2];
-	}
-	else if ((distance_12 < distance_01) && (distance_12 < distance_02)) // 12 is shortest distance -> 12 are front points, 0 is back
-	{
-		WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_FRONT].pos[0]
-				= (WiimoteIrRawData->WiimoteIRPoint[1].pos[0]
-						+ WiimoteIrRawData->WiimoteIRPoint[2].pos[0] + 1) / 2;
+/*!
+ \brief Which of three points is the back led, as determine_ir_front_back().
+ */
+static uint8_t classify_ir_back(const struct cwiid_ir_src *points)
+{
+	uint32_t distance_01, distance_12, distance_02;
+	uint8_t shortest_01, shortest_12;
 
-		WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_FRONT].pos[1]
-				= (WiimoteIrRawData->WiimoteIRPoint[1].pos[1]
-						+ WiimoteIrRawData->WiimoteIRPoint[2].pos[1] + 1) / 2;
+	distance_01 = compute_ir_distance_squared(&points[0], &points[1]);
+	distance_12 = compute_ir_distance_squared(&points[1], &points[2]);
+	distance_02 = compute_ir_distance_squared(&points[0], &points[2]);
 
-		WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_FRONT].size
-				= (WiimoteIrRawData->WiimoteIRPoint[1].size
-						+ WiimoteIrRawData->WiimoteIRPoint[2].size + 1) / 2;
+	shortest_01 = (distance_01 < distance_12) & (distance_01 < distance_02);
+	shortest_12 = (distance_12 < distance_01) & (distance_12 < distance_02);
 
-		WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_BACK]
-				= WiimoteIrRawData->WiimoteIRPoint[0];
-	}
-	else // 02 is shortest distance -> 02 are front points, 1 is back
-	{
-		WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_FRONT].pos[0]
-				= (WiimoteIrRawData->WiimoteIRPoint[0].pos[0]
-						+ WiimoteIrRawData->WiimoteIRPoint[2].pos[0] + 1) / 2;
+	// 01 shortest -> 2 is back, 12 shortest -> 0 is back, otherwise 1 is back
+	return 1 + shortest_01 - shortest_12;
+}
 
-		WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_FRONT].pos[1]
-				= (WiimoteIrRawData->WiimoteIRPoint[0].pos[1]
-						+ WiimoteIrRawData->WiimoteIRPoint[2].pos[1] + 1) / 2;
+/*!
+ \brief Determines IR points are front and which are back.
 
-		WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_FRONT].size
-				= (WiimoteIrRawData->WiimoteIRPoint[0].size
-						+ WiimoteIrRawData->WiimoteIRPoint[2].size + 1) / 2;
+ Checks the distance between all three points, the shortest distance is the front, the other point is the back.
+ Only the order of the distances matters, so their squares are compared.  When no distance is strictly
+ the shortest, 0 and 2 are taken as the front points.  The front pair is selected by index rather than
+ by branching, the outcome is different on nearly every frame.
 
-		WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_BACK]
-				= WiimoteIrRawData->WiimoteIRPoint[1];
-	}
+ \param WiimoteIRPositions this will be filled with the front and back point.  Front is the midpoint of the two front LEDS.
+ \param WiimoteIRData this contains the input IR data to the function.
+ */
+void determine_ir_front_back(
+		const struct WiimoteIrRawData_t *WiimoteIrRawData,
+		struct WiimoteIRPositions_t *WiimoteIRPositions)
+{
+	set_ir_front_back(WiimoteIrRawData->WiimoteIRPoint, classify_ir_back(
+			WiimoteIrRawData->WiimoteIRPoint), WiimoteIRPositions);
+}
+
+/*!
+ \brief Determines the front and back like determine_ir_front_back(), keeping the back led of the last frame.
 
+ If the point in the slot of the last back led is still within a quarter of the car's length of
+ where that led was, it is the back led again; a front led would have to move three quarters of the
+ car's length in one frame to get there.  That takes one distance instead of three.  Only when this
+ fails, after a dropout or a jump, are the points classified from their distances again.  This also
+ keeps the front and back from flipping when the car is seen end on and the three distances are
+ nearly equal.
+
+ \param association which point was the back led, updated for this frame.
+ \param WiimoteIrRawData three valid points, as from select_ir_points().
+ */
+void associate_ir_front_back(WiicarIrAssociation_t *association,
+		const struct WiimoteIrRawData_t *WiimoteIrRawData,
+		struct WiimoteIRPositions_t *WiimoteIRPositions)
+{
+	const struct cwiid_ir_src *points = WiimoteIrRawData->WiimoteIRPoint;
+	const struct cwiid_ir_src *back =
+			&WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_BACK];
+	uint8_t index = association->back_index;
+	int32_t dx = points[index].pos[0] - association->back[0];
+	int32_t dy = points[index].pos[1] - association->back[1];
+
+	if (!association->locked || ((uint32_t) (dx * dx + dy * dy)
+			>= association->length_squared / 16))
+		index = classify_ir_back(points);
+
+	set_ir_front_back(points, index, WiimoteIRPositions);
+
+	association->locked = true;
+	association->back_index = index;
+	association->back[0] = back->pos[0];
+	association->back[1] = back->pos[1];
+	association->length_squared = compute_ir_distance_squared(back,
+			&WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_FRONT]);
 }
 
 /*!
@@ -378,7 +728,7 @@ void determine_ir_front_back(
  in this data structure.
  */
 void determine_car_midpoint(
-		volatile struct WiimoteIRPositions_t *WiimoteIRPositions)
+		struct WiimoteIRPositions_t *WiimoteIRPositions)
 {
 	WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_CENTER].pos[0]
 			= (WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_FRONT].pos[0]
@@ -403,7 +753,7 @@ void determine_car_midpoint(
 
  \return uint32_t distance of the two points.
  */
-uint32_t compute_ir_point_distance(volatile struct cwiid_ir_src *WiimoteIRPoint)
+uint32_t compute_ir_point_distance(const struct cwiid_ir_src *WiimoteIRPoint)
 {
 	return compute_ir_distance(WiimoteIRPoint, &WiimoteMidpoint);
 }
@@ -416,13 +766,42 @@ uint32_t compute_ir_point_distance(volatile struct cwiid_ir_src *WiimoteIRPoint)
 
  \return int32_t the resulting angle in degrees * 100.
  */
-int32_t compute_ir_angle(volatile struct cwiid_ir_src *WiimotePoint1,
-		volatile struct cwiid_ir_src *WiimotePoint2)
+int32_t compute_ir_angle(const struct cwiid_ir_src *WiimotePoint1,
+		const struct cwiid_ir_src *WiimotePoint2)
 {
 	return compute_angle(WiimotePoint1->pos[0], WiimotePoint2->pos[0], 768
 			- WiimotePoint1->pos[1], 768 - WiimotePoint2->pos[1]); // reverse y coord
 }
 
+/*!
+ \brief compute_ir_angle(), without wrapping the angle.
+ */
+static WiicarAngle_t compute_ir_angle_unwrapped(
+		const struct cwiid_ir_src *WiimotePoint1,
+		const struct cwiid_ir_src *WiimotePoint2)
+{
+	uint32_t distance;
+	WiicarAngle_t angle;
+	int16_t dx, dy;
+
+	dx = WiimotePoint2->pos[0] - WiimotePoint1->pos[0];
+	dy = WiimotePoint1->pos[1] - WiimotePoint2->pos[1]; // reverse y coord
+
+	compute_vector_polar_unwrapped(dx, dy, &distance, &angle);
+
+	return angle;
+}
+
+/*!
+ \brief Turns the angle of a line in the camera image into a heading, 0 towards the top of the wiimote.
+
+ The angle is only wrapped once, here.
+ */
+static int32_t heading_from_angle(WiicarAngle_t angle)
+{
+	return 0 - wrap_angle(angle + 90 * WIICAR_DEGREE_SCALING);
+}
+
 /*!
  \brief Computes the current wiimotes heading.
 
@@ -437,16 +816,13 @@ int32_t compute_ir_angle(volatile struct cwiid_ir_src *WiimotePoint1,
  \return int32_t the resulting angle in degrees * 100.
  */
 int32_t compute_ir_theta(
-		volatile struct WiimoteIRPositions_t *WiimoteIRPositions)
+		const struct WiimoteIRPositions_t *WiimoteIRPositions)
 {
-	int32_t theta1 = compute_ir_angle(
+	WiicarAngle_t theta1 = compute_ir_angle_unwrapped(
 			&WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_BACK],
 			&WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_FRONT]);
 
-	theta1 += (90 * WIICAR_DEGREE_SCALING);
-	theta1 = cap_angle(theta1, 180, 360, WIICAR_DEGREE_SCALING);
-
-	return 0 - theta1;
+	return heading_from_angle(theta1);
 }
 
 /*!
@@ -458,16 +834,13 @@ int32_t compute_ir_theta(
  \return int32_t the resuling angle in degrees * 100
  */
 int32_t compute_ir_temp_phi(
-		volatile struct WiimoteIRPositions_t *WiimoteIRPositions)
+		const struct WiimoteIRPositions_t *WiimoteIRPositions)
 {
-	int32_t phi1 = compute_ir_angle(
+	WiicarAngle_t phi1 = compute_ir_angle_unwrapped(
 			&WiimoteIRPositions->WiimoteCarPosition[WII_CAR_POSITION_CENTER],
 			&WiimoteMidpoint);
 
-	phi1 += (90 * WIICAR_DEGREE_SCALING);
-	phi1 = cap_angle(phi1, 180, 360, WIICAR_DEGREE_SCALING);
-
-	return 0 - phi1;
+	return heading_from_angle(phi1);
 }
 
 /*!
@@ -485,7 +858,7 @@ int32_t compute_ir_phi(int32_t theta, int32_t temp_phi)
 	int32_t phi;
 
 	phi = theta - temp_phi;
-	phi = cap_angle(phi, 180, 360, WIICAR_DEGREE_SCALING);
+	phi = wrap_angle(phi);
 
 	return phi;
 }
@@ -507,23 +880,302 @@ int32_t compute_ir_phi(int32_t theta, int32_t temp_phi)
  \param WiimoteIrRawData header to wiimote IR data.  must already be populated with IR points.
  \param WiimoteIRComputedData Pointer to computed data struct, will fill in computed IR data.
  */
-void compute_ir_data(volatile struct WiimoteIrRawData_t *WiimoteIrRawData,
-		volatile struct WiimoteIRComputedData_t *WiimoteIRComputedData)
+void compute_ir_data(const struct WiimoteIrRawData_t *WiimoteIrRawData,
+		struct WiimoteIRComputedData_t *WiimoteIRComputedData)
 {
-
 	determine_ir_front_back(WiimoteIrRawData,
 			&WiimoteIRComputedData->WiimoteIRPositions);
 
+	compute_ir_data_from_positions(WiimoteIRComputedData);
+}
+
+/*!
+ \brief compute_ir_data() once the front and back of the car are known.
+ */
+void compute_ir_data_from_positions(
+		struct WiimoteIRComputedData_t *WiimoteIRComputedData)
+{
+	const struct cwiid_ir_src *center =
+			&WiimoteIRComputedData->WiimoteIRPositions.WiimoteCarPosition[WII_CAR_POSITION_CENTER];
+	uint32_t distance;
+	WiicarAngle_t angle;
+
 	determine_car_midpoint(&WiimoteIRComputedData->WiimoteIRPositions);
 
-	WiimoteIRComputedData->distance
-			= compute_ir_point_distance(
-					&WiimoteIRComputedData->WiimoteIRPositions.WiimoteCarPosition[WII_CAR_POSITION_CENTER]);
+	// distance and temp_phi are the length and heading of the same vector, center to camera center
+	compute_vector_polar_unwrapped(WiimoteMidpoint.pos[0] - center->pos[0],
+			center->pos[1] - WiimoteMidpoint.pos[1], &distance, &angle);
+
+	WiimoteIRComputedData->distance = distance;
 	WiimoteIRComputedData->theta = compute_ir_theta(
 			&WiimoteIRComputedData->WiimoteIRPositions);
-	WiimoteIRComputedData->temp_phi = compute_ir_temp_phi(
-			&WiimoteIRComputedData->WiimoteIRPositions);
+	WiimoteIRComputedData->temp_phi = heading_from_angle(angle);
+	WiimoteIRComputedData->phi = compute_ir_phi(WiimoteIRComputedData->theta,
+			WiimoteIRComputedData->temp_phi);
+}
+
+/*!
+ \brief Gains of the pose tracker, in 1/256.
+
+ beta = alpha^2 / (2 - alpha) is the critically damped choice for an alpha-beta filter.
+ */
+#define POSE_ALPHA 96
+#define POSE_BETA 22
+#define POSE_GAIN_BITS 8
+
+/// \brief A measurement this many pixels or more off the prediction starts a new track.
+#define POSE_GATE (64 << WIICAR_POSE_FRACTION_BITS)
+
+/// \brief A heading this far off the prediction starts a new track, the car cannot turn that fast.
+#define POSE_HEADING_GATE ((90 * WIICAR_DEGREE_SCALING) << WIICAR_POSE_FRACTION_BITS)
+
+/// \brief Frames closer than this are taken as this far apart when estimating rates.
+#define POSE_MIN_RATE_DT_US 1000
+
+/// \brief Limits of the rates, well above what the car does: 2048 pixels and 720 degrees a second.
+#define POSE_MAX_SPEED (2048 << WIICAR_POSE_FRACTION_BITS)
+#define POSE_MAX_TURN_RATE ((720 * WIICAR_DEGREE_SCALING) << WIICAR_POSE_FRACTION_BITS)
+
+#define POSE_HALF_CIRCLE (WIICAR_HALF_CIRCLE << WIICAR_POSE_FRACTION_BITS)
+#define POSE_FULL_CIRCLE (WIICAR_FULL_CIRCLE << WIICAR_POSE_FRACTION_BITS)
+
+/*!
+ \brief Wraps a tracker heading that is less than a turn outside the range.
+ */
+static int32_t pose_wrap(int32_t theta)
+{
+	if (theta > POSE_HALF_CIRCLE)
+		theta -= POSE_FULL_CIRCLE;
+	else if (theta < -POSE_HALF_CIRCLE)
+		theta += POSE_FULL_CIRCLE;
+	return theta;
+}
+
+/*!
+ \brief Adds beta times a residual over dt to a rate, limited to +-limit.
+ */
+static int32_t pose_rate_update(int32_t rate, int32_t residual, uint32_t dt,
+		int32_t limit)
+{
+	int64_t next;
+
+	if (dt < POSE_MIN_RATE_DT_US)
+		dt = POSE_MIN_RATE_DT_US;
+
+	next = rate + (((int64_t) residual * POSE_BETA) << (WIICAR_POSE_RATE_BITS
+			- POSE_GAIN_BITS)) / dt;
+	if (next > limit)
+		return limit;
+	if (next < -limit)
+		return -limit;
+	return next;
+}
+
+/*!
+ \brief Moves the state forward to time_us at the current rates.
+
+ \return uint32_t the time the state moved, at most WIICAR_POSE_COAST_US.
+ */
+static uint32_t pose_tracker_predict(WiicarPoseTracker_t *tracker,
+		uint64_t time_us)
+{
+	uint32_t dt = 0;
+
+	if (time_us > tracker->time_us)
+		dt = (time_us - tracker->time_us > WIICAR_POSE_COAST_US) ?
+				WIICAR_POSE_COAST_US : time_us - tracker->time_us;
+
+	tracker->x += ((int64_t) tracker->vx * dt) >> WIICAR_POSE_RATE_BITS;
+	tracker->y += ((int64_t) tracker->vy * dt) >> WIICAR_POSE_RATE_BITS;
+	tracker->theta = pose_wrap(tracker->theta + (((int64_t) tracker->omega
+			* dt) >> WIICAR_POSE_RATE_BITS));
+	tracker->time_us = time_us;
+	return dt;
+}
+
+/*!
+ \brief Forget the pose, the next measurement starts a new track.
+ */
+void pose_tracker_reset(WiicarPoseTracker_t *tracker)
+{
+	tracker->valid = false;
+	tracker->time_us = 0;
+	tracker->measured_us = 0;
+	tracker->x = 0;
+	tracker->y = 0;
+	tracker->vx = 0;
+	tracker->vy = 0;
+	tracker->theta = 0;
+	tracker->omega = 0;
+	tracker->association.locked = false;
+}
+
+/*!
+ \brief Correct the pose with the center and heading measured from a frame.
+
+ A measurement too far from the prediction, such as the first one after the track was lost, starts a
+ new track at rest.
+
+ \param x, y center of the car in camera pixels.
+ \param theta heading in degrees * 100, as compute_ir_theta().
+ */
+void pose_tracker_measure(WiicarPoseTracker_t *tracker, uint64_t time_us,
+		int32_t x, int32_t y, int32_t theta)
+{
+	int32_t residual_x, residual_y, residual_theta;
+	uint32_t dt;
+
+	x <<= WIICAR_POSE_FRACTION_BITS;
+	y <<= WIICAR_POSE_FRACTION_BITS;
+	theta = wrap_angle(theta) << WIICAR_POSE_FRACTION_BITS;
+
+	if (tracker->valid)
+	{
+		dt = pose_tracker_predict(tracker, time_us);
+		residual_x = x - tracker->x;
+		residual_y = y - tracker->y;
+		residual_theta = pose_wrap(theta - tracker->theta);
+
+		if ((abs(residual_x) < POSE_GATE) && (abs(residual_y) < POSE_GATE)
+				&& (abs(residual_theta) < POSE_HEADING_GATE))
+		{
+			tracker->x += (residual_x * POSE_ALPHA) >> POSE_GAIN_BITS;
+			tracker->y += (residual_y * POSE_ALPHA) >> POSE_GAIN_BITS;
+			tracker->theta = pose_wrap(tracker->theta + ((residual_theta
+					* POSE_ALPHA) >> POSE_GAIN_BITS));
+			tracker->vx = pose_rate_update(tracker->vx, residual_x, dt,
+					POSE_MAX_SPEED);
+			tracker->vy = pose_rate_update(tracker->vy, residual_y, dt,
+					POSE_MAX_SPEED);
+			tracker->omega = pose_rate_update(tracker->omega, residual_theta,
+					dt, POSE_MAX_TURN_RATE);
+			tracker->measured_us = time_us;
+			return;
+		}
+	}
+
+	tracker->valid = true;
+	tracker->time_us = time_us;
+	tracker->measured_us = time_us;
+	tracker->x = x;
+	tracker->y = y;
+	tracker->vx = 0;
+	tracker->vy = 0;
+	tracker->theta = theta;
+	tracker->omega = 0;
+}
+
+/*!
+ \brief Carry the pose through a frame without a measurement.
+
+ \return bool true while the pose is still tracked, false once it was not measured for
+ WIICAR_POSE_COAST_US.
+ */
+bool pose_tracker_coast(WiicarPoseTracker_t *tracker, uint64_t time_us)
+{
+	if (!tracker->valid)
+		return false;
+
+	if (time_us - tracker->measured_us > WIICAR_POSE_COAST_US)
+	{
+		tracker->valid = false;
+		return false;
+	}
+
+	pose_tracker_predict(tracker, time_us);
+	return true;
+}
+
+/*!
+ \brief Track the car through one frame, as infrared mode does.
+
+ With three or more points in view, the three largest are taken as the car's leds and associated with
+ those of the last frame, and the pose is corrected with them.  Otherwise the pose is carried, and the
+ association is dropped.
+
+ \param WiimoteIRComputedData count and the measured positions and angles are filled in, and when the
+ pose is tracked, the tracked values as pose_tracker_output().
+ \return bool whether the pose is tracked.
+ */
+bool pose_tracker_update(WiicarPoseTracker_t *tracker, uint64_t time_us,
+		const struct WiimoteIrRawData_t *WiimoteIrRawData,
+		struct WiimoteIRComputedData_t *WiimoteIRComputedData)
+{
+	const struct cwiid_ir_src *center =
+			&WiimoteIRComputedData->WiimoteIRPositions.WiimoteCarPosition[WII_CAR_POSITION_CENTER];
+	struct WiimoteIrRawData_t selected;
+
+	WiimoteIRComputedData->count = select_ir_points(WiimoteIrRawData,
+			&selected);
+
+	if (WiimoteIRComputedData->count >= WIICAR_IR_NUMBER_OF_POINTS)
+	{
+		associate_ir_front_back(&tracker->association, &selected,
+				&WiimoteIRComputedData->WiimoteIRPositions);
+		compute_ir_data_from_positions(WiimoteIRComputedData);
+		pose_tracker_measure(tracker, time_us, center->pos[0], center->pos[1],
+				WiimoteIRComputedData->theta);
+	}
+	else
+	{
+		tracker->association.locked = false;
+		if (!pose_tracker_coast(tracker, time_us))
+			return false;
+	}
+
+	pose_tracker_output(tracker, WiimoteIRComputedData);
+	return true;
+}
+
+/*!
+ \brief Fill in the center, distance, theta, temp_phi and phi from the tracked pose.
+
+ The same quantities as compute_ir_data(), but the distance and angles are computed from the
+ sub-pixel center.  The front and back points are left as they were last measured.
+ */
+void pose_tracker_output(const WiicarPoseTracker_t *tracker,
+		struct WiimoteIRComputedData_t *WiimoteIRComputedData)
+{
+	struct cwiid_ir_src *center =
+			&WiimoteIRComputedData->WiimoteIRPositions.WiimoteCarPosition[WII_CAR_POSITION_CENTER];
+	const int32_t half = 1 << (WIICAR_POSE_FRACTION_BITS - 1);
+	uint32_t distance;
+	WiicarAngle_t angle;
+
+	center->pos[0] = (tracker->x + half) >> WIICAR_POSE_FRACTION_BITS;
+	center->pos[1] = (tracker->y + half) >> WIICAR_POSE_FRACTION_BITS;
+
+	compute_vector_polar_unwrapped((WiimoteMidpoint.pos[0]
+			<< WIICAR_POSE_FRACTION_BITS) - tracker->x, tracker->y
+			- (WiimoteMidpoint.pos[1] << WIICAR_POSE_FRACTION_BITS), &distance,
+			&angle);
+
+	WiimoteIRComputedData->distance = (distance + half)
+			>> WIICAR_POSE_FRACTION_BITS;
+	WiimoteIRComputedData->theta = wrap_angle((tracker->theta + half)
+			>> WIICAR_POSE_FRACTION_BITS);
+	WiimoteIRComputedData->temp_phi = heading_from_angle(angle);
 	WiimoteIRComputedData->phi = compute_ir_phi(WiimoteIRComputedData->theta,
 			WiimoteIRComputedData->temp_phi);
 }
 
+/*!
+ \brief pose_tracker_output() for the pose predicted ahead to time_us at the current rates.
+
+ Compensates the latency between a frame and the motor command computed from it taking effect.  The
+ prediction reaches at most WIICAR_POSE_MAX_LEAD_US past the state, a time before it gives the state.
+ */
+void pose_tracker_output_at(const WiicarPoseTracker_t *tracker,
+		uint64_t time_us,
+		struct WiimoteIRComputedData_t *WiimoteIRComputedData)
+{
+	WiicarPoseTracker_t predicted = *tracker;
+
+	if (time_us > tracker->time_us + WIICAR_POSE_MAX_LEAD_US)
+		time_us = tracker->time_us + WIICAR_POSE_MAX_LEAD_US;
+	else if (time_us < tracker->time_us)
+		time_us = tracker->time_us;
+
+	pose_tracker_predict(&predicted, time_us);
+	pose_tracker_output(&predicted, WiimoteIRComputedData);
+}
@@ -4,27 +4,151 @@
 #include <stdint.h>
 #include "wiicar.h"
 
-void normalize_accel(volatile struct WiimoteStatusDataType *wiimote_status);
-int32_t determine_pitch(volatile struct WiimoteAccelComputedData_t *WiimoteAccelComputedData);
-int32_t determine_roll(volatile struct WiimoteAccelComputedData_t *WiimoteAccelComputedData);
-int32_t determine_yaw(volatile struct WiimoteAccelComputedData_t *WiimoteAccelComputedData);
+int16_t normalize_accel_value(uint8_t zero, uint8_t one, uint8_t raw);
+void build_accel_table(struct WiimoteStatusDataType *wiimote_status);
+void normalize_accel(struct WiimoteStatusDataType *wiimote_status);
 
-void count_ir_points(volatile struct WiimoteIRComputedData_t *WiimoteIRComputedData, volatile struct WiimoteIrRawData_t *WiimoteIrRawData);
+/// \brief Longest accelerometer filter, 2^shift samples.
+#define WIICAR_ACCEL_FILTER_MAX_SHIFT 4
+
+typedef enum WiicarAccelFilterType_t
+{
+	WIICAR_ACCEL_FILTER_NONE = 0,
+	WIICAR_ACCEL_FILTER_IIR, ///< one pole low pass
+	WIICAR_ACCEL_FILTER_AVERAGE, ///< moving average
+} WiicarAccelFilterType_t;
+
+/*!
+ \brief Low pass filter of the normalized acceleration, one state per axis.
+ */
+typedef struct WiicarAccelFilter_t
+{
+	WiicarAccelFilterType_t type;
+	uint8_t shift; ///< log2 of the length in samples
+	bool primed; ///< set once the first sample is in the state
+	uint8_t index; ///< next slot of the ring
+	int32_t state[3]; ///< IIR: output with 8 fraction bits, average: sum of the ring
+	int16_t ring[3][1 << WIICAR_ACCEL_FILTER_MAX_SHIFT];
+} WiicarAccelFilter_t;
+
+void accel_filter_init(WiicarAccelFilter_t *filter, WiicarAccelFilterType_t type, uint8_t shift);
+void accel_filter_apply(WiicarAccelFilter_t *filter, struct WiimoteAccelComputedData_t *WiimoteAccelComputedData);
+void accel_configure_filter(WiicarAccelFilterType_t type, uint8_t shift);
+
+int32_t determine_pitch(const struct WiimoteAccelComputedData_t *WiimoteAccelComputedData);
+int32_t determine_roll(const struct WiimoteAccelComputedData_t *WiimoteAccelComputedData);
+int32_t determine_yaw(const struct WiimoteAccelComputedData_t *WiimoteAccelComputedData);
+
+void count_ir_points(struct WiimoteIRComputedData_t *WiimoteIRComputedData, const struct WiimoteIrRawData_t *WiimoteIrRawData);
+uint8_t select_ir_points(const struct WiimoteIrRawData_t *WiimoteIrRawData, struct WiimoteIrRawData_t *selected);
 uint32_t compute_distance(int16_t x_1, int16_t x_2, int16_t y_1, int16_t y_2);
 int32_t compute_angle(int16_t x_1, int16_t x_2, int16_t y_1, int16_t y_2);
 
-uint32_t compute_ir_distance(volatile struct cwiid_ir_src *WiimotePoint1, volatile struct cwiid_ir_src *WiimotePoint2);
-void determine_ir_front_back(volatile  struct WiimoteIrRawData_t *WiimoteIrRawData, volatile struct WiimoteIRPositions_t *WiimoteIRPositions);
-void determine_car_midpoint(volatile struct WiimoteIRPositions_t *WiimoteIRPositions);
-uint32_t compute_ir_point_distance(volatile struct cwiid_ir_src *WiimoteIRPoint);
-int32_t compute_ir_angle(volatile struct cwiid_ir_src *WiimotePoint1, volatile struct cwiid_ir_src *WiimotePoint2);
-int32_t compute_ir_theta(volatile struct WiimoteIRPositions_t *WiimoteIRPositions);
-int32_t compute_ir_temp_phi(volatile struct WiimoteIRPositions_t *WiimoteIRPositions);
+uint32_t compute_ir_distance(const struct cwiid_ir_src *WiimotePoint1, const struct cwiid_ir_src *WiimotePoint2);
+uint32_t compute_ir_distance_squared(const struct cwiid_ir_src *WiimotePoint1, const struct cwiid_ir_src *WiimotePoint2);
+void determine_ir_front_back(const struct WiimoteIrRawData_t *WiimoteIrRawData, struct WiimoteIRPositions_t *WiimoteIRPositions);
+void determine_car_midpoint(struct WiimoteIRPositions_t *WiimoteIRPositions);
+uint32_t compute_ir_point_distance(const struct cwiid_ir_src *WiimoteIRPoint);
+int32_t compute_ir_angle(const struct cwiid_ir_src *WiimotePoint1, const struct cwiid_ir_src *WiimotePoint2);
+int32_t compute_ir_theta(const struct WiimoteIRPositions_t *WiimoteIRPositions);
+int32_t compute_ir_temp_phi(const struct WiimoteIRPositions_t *WiimoteIRPositions);
 int32_t compute_ir_phi(int32_t theta, int32_t temp_phi);
-void compute_ir_data(volatile struct WiimoteIrRawData_t *WiimoteIrRawData, volatile struct WiimoteIRComputedData_t *WiimoteIRComputedData);
+void compute_ir_data(const struct WiimoteIrRawData_t *WiimoteIrRawData, struct WiimoteIRComputedData_t *WiimoteIRComputedData);
+void compute_ir_data_from_positions(struct WiimoteIRComputedData_t *WiimoteIRComputedData);
 
 
 int32_t cap_angle(int32_t x, int32_t cap_value, int32_t circle_size, int32_t scaling);
 
+/*!
+ \brief An angle in degrees * 100 that may lie any number of turns outside -180 to 180.
+
+ Angles can be added and subtracted without wrapping in between, only the final value needs wrap_angle().
+ */
+typedef int32_t WiicarAngle_t;
+
+#define WIICAR_HALF_CIRCLE (180 * WIICAR_DEGREE_SCALING)
+#define WIICAR_FULL_CIRCLE (360 * WIICAR_DEGREE_SCALING)
+
+/*!
+ \brief cap_angle(x, 180, 360, WIICAR_DEGREE_SCALING), in constant time and with constant operands.
+
+ -180 and 180 are both kept: above the range the result is in (-180, 180], below it in [-180, 180).
+ */
+static inline int32_t wrap_angle(WiicarAngle_t x)
+{
+	// unsigned differences, so no input overflows
+	if (x > WIICAR_HALF_CIRCLE)
+		return x - (((uint32_t) x - WIICAR_HALF_CIRCLE - 1) / WIICAR_FULL_CIRCLE
+				+ 1) * WIICAR_FULL_CIRCLE;
+	if (x < -WIICAR_HALF_CIRCLE)
+		return x + (((uint32_t) -WIICAR_HALF_CIRCLE - (uint32_t) x - 1)
+				/ WIICAR_FULL_CIRCLE + 1) * WIICAR_FULL_CIRCLE;
+	return x;
+}
+
+/// \brief Number of CORDIC steps, each adds about one bit to the angle.  16 leave 0.002 degrees.
+#define WIICAR_CORDIC_ITERATIONS 16
+
+/// \brief 1 / product of sqrt(1 + 2^-2i) over all steps, in units of 2^-30.
+#define WIICAR_CORDIC_INVERSE_GAIN 652032874ULL
+
+extern const int32_t wiicar_cordic_angles[WIICAR_CORDIC_ITERATIONS];
+
+uint32_t fixed_sqrt(uint32_t x);
+int32_t fixed_asin(int32_t x);
+void compute_vector_polar(int32_t dx, int32_t dy, uint32_t *magnitude, int32_t *angle);
+
+/// \brief Fraction bits of the tracked position and heading.
+#define WIICAR_POSE_FRACTION_BITS 8
+
+/// \brief Rates are per 2^WIICAR_POSE_RATE_BITS us, about a second, so predicting needs no division.
+#define WIICAR_POSE_RATE_BITS 20
+
+/// \brief How long the pose is carried through a dropout before the car is stopped.
+#define WIICAR_POSE_COAST_US 250000
+
+/// \brief Furthest pose_tracker_output_at() predicts ahead.
+#define WIICAR_POSE_MAX_LEAD_US 200000
+
+/*!
+ \brief Which of the car's three IR points was the back led, kept from frame to frame.
+ */
+typedef struct WiicarIrAssociation_t
+{
+	bool locked; ///< back holds the back led of the last frame
+	uint8_t back_index; ///< which of the selected points was the back led
+	uint16_t back[2]; ///< position of the back led
+	uint32_t length_squared; ///< squared distance from the back led to the front of the car
+} WiicarIrAssociation_t;
+
+void associate_ir_front_back(WiicarIrAssociation_t *association, const struct WiimoteIrRawData_t *WiimoteIrRawData, struct WiimoteIRPositions_t *WiimoteIRPositions);
+
+/*!
+ \brief Alpha-beta tracker of the car's center and heading in camera space.
+
+ An alpha-beta filter is the steady state of a Kalman filter with constant velocity, with fixed gains
+ it needs no covariance and runs in a few integer operations per frame.
+ */
+typedef struct WiicarPoseTracker_t
+{
+	bool valid;
+	uint64_t time_us; ///< time the state is predicted to
+	uint64_t measured_us; ///< time of the last measurement
+	int32_t x; ///< center of the car in camera pixels, WIICAR_POSE_FRACTION_BITS fraction bits
+	int32_t y;
+	int32_t vx; ///< change of x per 2^WIICAR_POSE_RATE_BITS us
+	int32_t vy;
+	int32_t theta; ///< heading in degrees * 100, wrapped, WIICAR_POSE_FRACTION_BITS fraction bits
+	int32_t omega; ///< change of theta per 2^WIICAR_POSE_RATE_BITS us
+	WiicarIrAssociation_t association;
+} WiicarPoseTracker_t;
+
+void pose_tracker_reset(WiicarPoseTracker_t *tracker);
+void pose_tracker_measure(WiicarPoseTracker_t *tracker, uint64_t time_us, int32_t x, int32_t y, int32_t theta);
+bool pose_tracker_coast(WiicarPoseTracker_t *tracker, uint64_t time_us);
+bool pose_tracker_update(WiicarPoseTracker_t *tracker, uint64_t time_us, const struct WiimoteIrRawData_t *WiimoteIrRawData, struct WiimoteIRComputedData_t *WiimoteIRComputedData);
+void pose_tracker_output(const WiicarPoseTracker_t *tracker, struct WiimoteIRComputedData_t *WiimoteIRComputedData);
+void pose_tracker_output_at(const WiicarPoseTracker_t *tracker, uint64_t time_us, struct WiimoteIRComputedData_t *WiimoteIRComputedData);
+
 
 #endif /*WIIMOTEMATH_H_*/
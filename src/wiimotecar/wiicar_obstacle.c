@@ -0,0 +1,235 @@
+/*!
+ \file
+
+ \brief Caps the speed of a car towards an object seen by its range sensors.
+
+ Reading the sensors is a round trip to the control board.  Done by the control loop, before every
+ motor command, it would add that round trip to every command.  Instead each car has a poller thread
+ reading the sensors every period and publishing the newest reading; the control loop takes it without
+ waiting, classifies it against the cutoffs set from the menu and caps the speed of the command in the
+ direction of an object.  The poller only reads while a cutoff is set, so a car without sensors sends no
+ more commands than before.
+
+ The poller shares the serial line of the car, a motor command sent while a read is on the line waits
+ for it, at most one round trip.
+
+ The reaction time is measured from the reading to the acknowledgement of the first capped command sent
+ on it.  The object itself may have come into range up to one period before the reading.
+
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <wiicarutility/timestamp.h>
+#include <wiicarutility/error_message.h>
+#include <controlboard/control_board.h>
+#include <controlboard/hardware.h>
+
+#include "wiicar_realtime.h"
+#include "wiicar_obstacle.h"
+
+static uint32_t sensor_period_us = WIICAR_SENSOR_DEFAULT_PERIOD_MS * 1000;
+
+/*!
+ \brief Set the period at which the range sensors are read, 0 disables obstacle avoidance.
+
+ Must be called before obstacle_guard_start().
+ */
+void obstacle_configure(uint32_t period_ms)
+{
+	sensor_period_us = period_ms * 1000;
+}
+
+void obstacle_guard_init(WiicarObstacleGuard_t *guard,
+		control_board_session_t *session)
+{
+	memset(guard, 0, sizeof(*guard));
+	guard->session = session;
+}
+
+static void publish_sample(WiicarObstacleGuard_t *guard, const int32_t *values)
+{
+	__sync_fetch_and_add(&guard->sequence, 1);
+	__sync_synchronize();
+	guard->sample.sequence++;
+	guard->sample.time_us = get_tick_count_us();
+	guard->sample.fwd = values[SENSOR_FWD];
+	guard->sample.rev = values[SENSOR_REV];
+	__sync_synchronize();
+	__sync_fetch_and_add(&guard->sequence, 1);
+}
+
+static void take_sample(WiicarObstacleGuard_t *guard,
+		WiicarSensorSample_t *sample)
+{
+	uint32_t sequence;
+
+	do
+	{
+		sequence = guard->sequence;
+		__sync_synchronize();
+		*sample = guard->sample;
+		__sync_synchronize();
+	} while ((sequence & 1) || (sequence != guard->sequence));
+}
+
+static void *obstacle_poller(void *arg)
+{
+	WiicarObstacleGuard_t *guard = arg;
+
+	comm_bind_session(guard->session);
+
+	for (;;)
+	{
+		if ((0 == guard->sensor_cutoff_fwd) && (0 == guard->sensor_cutoff_rev))
+		{
+			usleep(sensor_period_us);
+			continue;
+		}
+
+		if (ERR_NONE != read_sensor_values())
+		{
+			guard->stats.read_errors++;
+			usleep(WIICAR_SENSOR_RETRY_MS * 1000);
+			continue;
+		}
+		guard->stats.reads++;
+		publish_sample(guard, get_sensor_values());
+		usleep(sensor_period_us);
+	}
+	return NULL;
+}
+
+/*!
+ \brief Start the poller of a car once its control board is connected, unless avoidance is disabled.
+
+ \param slot the car's slot, the poller runs alongside the car's control loop.
+ \return int32_t 0 on success, otherwise the error from pthread_create.
+ */
+int32_t obstacle_guard_start(WiicarObstacleGuard_t *guard, int32_t slot)
+{
+	int32_t ret_val;
+
+	if (0 == sensor_period_us)
+		return 0;
+
+	ret_val = realtime_create_thread(&guard->thread, obstacle_poller, guard,
+			slot);
+	if (0 == ret_val)
+		pthread_detach(guard->thread);
+	return ret_val;
+}
+
+/*!
+ \brief Classify the newest reading against the cutoffs.
+
+ \param sample receives the reading classified.
+ \return SensorStatusType SENSOR_ERROR if a cutoff is set but there is no reading newer than
+ WIICAR_SENSOR_MAX_AGE_MS.
+ */
+SensorStatusType obstacle_classify(WiicarObstacleGuard_t *guard,
+		uint64_t now_us, WiicarSensorSample_t *sample)
+{
+	const int32_t cutoff_fwd = guard->sensor_cutoff_fwd;
+	const int32_t cutoff_rev = guard->sensor_cutoff_rev;
+	int32_t status = SENSOR_CLEAR;
+
+	if ((0 == sensor_period_us) || ((0 == cutoff_fwd) && (0 == cutoff_rev)))
+		return SENSOR_CLEAR;
+
+	take_sample(guard, sample);
+	if ((0 == sample->sequence) || ((now_us > sample->time_us) && (now_us
+			- sample->time_us > WIICAR_SENSOR_MAX_AGE_MS * 1000)))
+		return SENSOR_ERROR;
+
+	if (cutoff_fwd && (sample->fwd >= cutoff_fwd))
+		status |= SENSOR_FORWARD_OBJECT;
+	if (cutoff_rev && (sample->rev >= cutoff_rev))
+		status |= SENSOR_REVERSE_OBJECT;
+	return status;
+}
+
+/*!
+ \brief Cap a speed level towards the objects of status, SENSOR_ERROR caps both directions.
+ */
+int32_t obstacle_limit_speed(SensorStatusType status, int32_t speed_level)
+{
+	if ((status & SENSOR_FORWARD_OBJECT) && (speed_level > SPEED_NULL_VALUE))
+		return SPEED_NULL_VALUE;
+	if ((status & SENSOR_REVERSE_OBJECT) && (speed_level < SPEED_NULL_VALUE))
+		return SPEED_NULL_VALUE;
+	return speed_level;
+}
+
+/*!
+ \brief Cap the speed level of a command about to be sent.
+
+ \param sample receives the reading the speed was capped on.
+ \return bool true if the speed was capped.
+ */
+bool obstacle_guard_limit(WiicarObstacleGuard_t *guard, uint64_t now_us,
+		int32_t *speed_level, WiicarSensorSample_t *sample)
+{
+	int32_t limited;
+
+	if (SPEED_NULL_VALUE == *speed_level)
+		return false;
+
+	limited = obstacle_limit_speed(obstacle_classify(guard, now_us, sample),
+			*speed_level);
+	if (limited == *speed_level)
+		return false;
+
+	guard->stats.limited++;
+	*speed_level = limited;
+	return true;
+}
+
+/*!
+ \brief Measure the reaction to a reading, once a command capped on it has been acknowledged.
+ */
+void obstacle_record_reaction(WiicarObstacleGuard_t *guard,
+		const WiicarSensorSample_t *sample)
+{
+	WiicarObstacleStats_t *stats = &guard->stats;
+	uint64_t now = get_tick_count_us();
+	uint32_t reaction;
+
+	if ((sample->sequence == guard->reacted) || (now < sample->time_us))
+		return;
+	guard->reacted = sample->sequence;
+
+	reaction = now - sample->time_us;
+	stats->reactions++;
+	stats->reaction_total_us += reaction;
+	if (reaction > stats->reaction_worst_us)
+		stats->reaction_worst_us = reaction;
+}
+
+void obstacle_get_stats(const WiicarObstacleGuard_t *guard,
+		WiicarObstacleStats_t *stats)
+{
+	*stats = guard->stats;
+}
+
+/*!
+ \brief Print the sensor reads, the capped commands and the reaction time of a car.
+ */
+void obstacle_report(const WiicarObstacleGuard_t *guard)
+{
+	WiicarObstacleStats_t stats;
+
+	obstacle_get_stats(guard, &stats);
+	if ((0 == stats.reads) && (0 == stats.read_errors))
+		return;
+
+	fprintf(stderr,
+			"Obstacles: %u sensor reads, %u errors, %u commands capped, reaction %.1f ms mean, %.1f ms worst\n",
+			stats.reads, stats.read_errors, stats.limited,
+			stats.reactions ? stats.reaction_total_us / 1000.0
+					/ stats.reactions : 0.0, stats.reaction_worst_us / 1000.0);
+}
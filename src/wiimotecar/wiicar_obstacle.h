@@ -0,0 +1,87 @@
+/*!
+ \file
+
+ \brief Obstacle avoidance: caps the speed of a car towards an object its range sensors see.
+
+ */
+
+#ifndef WIICAR_OBSTACLE_H_
+#define WIICAR_OBSTACLE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <controlboard/control_board.h>
+
+#include "wiicar.h"
+
+/// \brief Default period at which the range sensors are read.
+#define WIICAR_SENSOR_DEFAULT_PERIOD_MS 20
+
+/// \brief Oldest reading the guard drives on, an older one stops the car in both directions.
+#define WIICAR_SENSOR_MAX_AGE_MS 250
+
+/// \brief Longest period that can be set, half WIICAR_SENSOR_MAX_AGE_MS so a reading is not stale before the next.
+#define WIICAR_SENSOR_MAX_PERIOD_MS (WIICAR_SENSOR_MAX_AGE_MS / 2)
+
+/// \brief Wait after a failed read, so a board that does not answer does not hold up the motor commands.
+#define WIICAR_SENSOR_RETRY_MS 1000
+
+/// \brief One reading of the range sensors, levels 0 to MAX_SENSOR_LEVEL, rising as an object nears.
+typedef struct WiicarSensorSample_t
+{
+	uint32_t sequence; ///< number of the reading, from 1
+	uint64_t time_us; ///< get_tick_count_us() when the reply of the board was received
+	int32_t fwd;
+	int32_t rev;
+} WiicarSensorSample_t;
+
+typedef struct WiicarObstacleStats_t
+{
+	uint32_t reads; ///< by the poller
+	uint32_t read_errors; ///< by the poller
+	uint32_t limited; ///< commands whose speed was capped
+	uint32_t reactions; ///< capped commands sent on a reading not used before
+	uint64_t reaction_total_us;
+	uint32_t reaction_worst_us;
+} WiicarObstacleStats_t;
+
+/*!
+ \brief Range sensors of one car, read by a poller thread and checked by the control loop.
+
+ The poller owns the board round trip, the control loop only takes the newest reading and never waits
+ for the sensors.
+ */
+typedef struct WiicarObstacleGuard_t
+{
+	control_board_session_t *session;
+	pthread_t thread;
+
+	volatile int32_t sensor_cutoff_fwd; ///< level at which an object is ahead, 0 disables
+	volatile int32_t sensor_cutoff_rev; ///< level at which an object is behind, 0 disables
+
+	volatile uint32_t sequence; ///< odd while the poller writes sample
+	WiicarSensorSample_t sample;
+	uint32_t reacted; ///< sequence of the last reading a reaction was measured on, owned by the control loop
+
+	WiicarObstacleStats_t stats;
+} WiicarObstacleGuard_t;
+
+void obstacle_configure(uint32_t period_ms);
+
+void obstacle_guard_init(WiicarObstacleGuard_t *guard,
+		control_board_session_t *session);
+int32_t obstacle_guard_start(WiicarObstacleGuard_t *guard, int32_t slot);
+
+SensorStatusType obstacle_classify(WiicarObstacleGuard_t *guard,
+		uint64_t now_us, WiicarSensorSample_t *sample);
+int32_t obstacle_limit_speed(SensorStatusType status, int32_t speed_level);
+bool obstacle_guard_limit(WiicarObstacleGuard_t *guard, uint64_t now_us,
+		int32_t *speed_level, WiicarSensorSample_t *sample);
+void obstacle_record_reaction(WiicarObstacleGuard_t *guard,
+		const WiicarSensorSample_t *sample);
+
+void obstacle_get_stats(const WiicarObstacleGuard_t *guard,
+		WiicarObstacleStats_t *stats);
+void obstacle_report(const WiicarObstacleGuard_t *guard);
+
+#endif /* WIICAR_OBSTACLE_H_ */
@@ -0,0 +1,215 @@
+/*!
+ \file
+
+ \brief Creates the control threads, on SCHED_FIFO when real-time mode is enabled.
+
+ On the router the control loops share the cpu with hostapd and the bluetooth stack.  When real-time
+ mode is enabled each loop runs with a fixed priority, all memory is locked, the thread stack is faulted
+ in up front and, on multi-core hosts, the thread is pinned to one cpu.
+
+ Each control thread reports its wakeups through realtime_record_wakeup(), so the worst-case
+ scheduling latency of the session can be printed at shutdown.
+
+ */
+
+#define _GNU_SOURCE
+
+#include <config.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#if HAVE_MLOCKALL
+#include <sys/mman.h>
+#endif
+#include <wiicarutility/timestamp.h>
+#include <wiicarutility/utility.h>
+
+#include "wiicar_realtime.h"
+
+/// \brief Stack kept untouched by the prefault, covers the frames already in use.
+#define WIICAR_RT_STACK_MARGIN (16 * 1024)
+
+#define WIICAR_RT_PAGE_SIZE 4096
+
+typedef struct realtime_thread_args_t
+{
+	void *(*entry)(void *);
+	void *arg;
+	int32_t slot;
+} realtime_thread_args_t;
+
+static WiicarRealtimeConfig_t realtime_config =
+{ false, WIICAR_RT_DEFAULT_PRIORITY, WIICAR_RT_CPU_AUTO };
+
+static pthread_once_t memory_locked = PTHREAD_ONCE_INIT;
+
+void realtime_configure(int32_t priority, int32_t cpu)
+{
+	realtime_config.enabled = true;
+	realtime_config.priority = priority;
+	realtime_config.cpu = cpu;
+}
+
+bool realtime_enabled(void)
+{
+	return realtime_config.enabled;
+}
+
+/*!
+ \brief Touch every page of the stack so that no page fault occurs once the loop is running.
+ */
+static void prefault_stack(void)
+{
+	volatile uint8_t stack[WIICAR_RT_STACK_SIZE - WIICAR_RT_STACK_MARGIN];
+	uint32_t i;
+
+	for (i = 0; i < sizeof(stack); i += WIICAR_RT_PAGE_SIZE)
+		stack[i] = 0;
+}
+
+/*!
+ \brief Pin the calling thread.
+
+ With WIICAR_RT_CPU_AUTO the control threads are spread over every cpu but cpu 0, starting from the
+ last one.
+ */
+static void pin_thread(int32_t slot)
+{
+#if HAVE_PTHREAD_SETAFFINITY_NP
+	cpu_set_t cpu_set;
+	int32_t cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+	int32_t cpu = realtime_config.cpu;
+
+	if (cpu_count <= 1)
+		return;
+
+	if (cpu == WIICAR_RT_CPU_AUTO)
+		cpu = cpu_count - 1 - (slot % (cpu_count - 1));
+
+	CPU_ZERO(&cpu_set);
+	CPU_SET(cpu, &cpu_set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set))
+		fprintf(stderr, "Unable to pin control thread to cpu %d\n", cpu);
+	else
+		debug_print("Control thread pinned to cpu %d\n", cpu);
+#endif
+}
+
+static void *realtime_thread(void *arg)
+{
+	realtime_thread_args_t thread_args = *(realtime_thread_args_t *) arg;
+
+	free(arg);
+
+	pin_thread(thread_args.slot);
+	prefault_stack();
+
+	return thread_args.entry(thread_args.arg);
+}
+
+static void lock_memory(void)
+{
+#if HAVE_MLOCKALL
+	if (mlockall(MCL_CURRENT | MCL_FUTURE))
+		fprintf(stderr, "Unable to lock memory: %s\n", strerror(errno));
+#endif
+}
+
+/*!
+ \brief Start a control thread.
+
+ If real-time mode has not been enabled with realtime_configure() a plain thread is created.  Otherwise
+ the thread runs SCHED_FIFO, pinned according to slot.  If the process lacks the privileges for
+ real-time scheduling real-time mode is turned off and a plain thread is created instead.
+
+ \param thread receives the new thread, to be joined by the caller.
+ \param slot index of the control thread, used to choose its cpu.
+ \return int32_t 0 on success, otherwise the error from pthread_create.
+ */
+int32_t realtime_create_thread(pthread_t *thread, void *(*entry)(void *),
+		void *arg, int32_t slot)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	realtime_thread_args_t *thread_args;
+	int32_t ret_val;
+
+	if (!realtime_config.enabled)
+		return pthread_create(thread, NULL, entry, arg);
+
+	pthread_once(&memory_locked, lock_memory);
+
+	thread_args = malloc(sizeof(*thread_args));
+	if (NULL == thread_args)
+		return ENOMEM;
+	thread_args->entry = entry;
+	thread_args->arg = arg;
+	thread_args->slot = slot;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = realtime_config.priority;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, WIICAR_RT_STACK_SIZE);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+
+	ret_val = pthread_create(thread, &attr, realtime_thread, thread_args);
+	pthread_attr_destroy(&attr);
+
+	if (EPERM == ret_val)
+	{
+		fprintf(stderr,
+				"No permission for SCHED_FIFO, running without real-time priority\n");
+		free(thread_args);
+		realtime_config.enabled = false;
+		return pthread_create(thread, NULL, entry, arg);
+	}
+	else if (ret_val)
+	{
+		free(thread_args);
+		return ret_val;
+	}
+
+	debug_print("Control thread %d running SCHED_FIFO, priority %d\n", slot,
+			realtime_config.priority);
+
+	return 0;
+}
+
+/*!
+ \brief Record one wakeup of a control thread.
+
+ \param stats wakeup statistics of the calling thread.
+ \param expected_us tick count (get_tick_count_us()) at which the thread should have woken up.
+ */
+void realtime_record_wakeup(WiicarWakeupStats_t *stats, uint64_t expected_us)
+{
+	uint64_t now = get_tick_count_us();
+	uint32_t latency = (now > expected_us) ? (now - expected_us) : 0;
+
+	stats->count++;
+	stats->total_us += latency;
+	if (latency > stats->worst_us)
+		stats->worst_us = latency;
+}
+
+/*!
+ \brief Print the wakeup latency observed over the session.
+ */
+void realtime_report(const char *name, const WiicarWakeupStats_t *stats)
+{
+	if (0 == stats->count)
+		return;
+
+	fprintf(stderr, "%s: %u wakeups, worst latency %u us, mean %u us\n", name,
+			stats->count, stats->worst_us,
+			(uint32_t) (stats->total_us / stats->count));
+}
@@ -0,0 +1,47 @@
+/*!
+ \file
+
+ \brief Opt-in real-time execution of the control thread.
+
+ */
+
+#ifndef WIICAR_REALTIME_H_
+#define WIICAR_REALTIME_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/// \brief Default SCHED_FIFO priority of the control threads.
+#define WIICAR_RT_DEFAULT_PRIORITY 40
+
+/// \brief Spread the control threads over all cpus but cpu 0, which is left to the network and bluetooth.
+#define WIICAR_RT_CPU_AUTO (-1)
+
+/// \brief Stack size of a control thread, locked and faulted in before the loop starts.
+#define WIICAR_RT_STACK_SIZE (128 * 1024)
+
+typedef struct WiicarRealtimeConfig_t
+{
+	bool enabled;
+	int32_t priority;
+	int32_t cpu;
+} WiicarRealtimeConfig_t;
+
+typedef struct WiicarWakeupStats_t
+{
+	uint32_t count;
+	uint32_t worst_us;
+	uint64_t total_us;
+} WiicarWakeupStats_t;
+
+void realtime_configure(int32_t priority, int32_t cpu);
+bool realtime_enabled(void);
+
+int32_t realtime_create_thread(pthread_t *thread, void *(*entry)(void *),
+		void *arg, int32_t slot);
+
+void realtime_record_wakeup(WiicarWakeupStats_t *stats, uint64_t expected_us);
+void realtime_report(const char *name, const WiicarWakeupStats_t *stats);
+
+#endif /* WIICAR_REALTIME_H_ */
@@ -0,0 +1,182 @@
+/*!
+ \file
+
+ \brief Stops a car whose control loop misses its deadline.
+
+ While a mode drives the motors the car keeps its last motor levels until the next command, or until the
+ board's own motor timeout.  If the control loop stalls, in comm_readline(), in a slow GTK call or
+ waiting for a wiimote that stopped reporting, the car keeps going.
+
+ Each armed control loop beats once per iteration.  A separate thread checks every loop a few times per
+ deadline and, once a loop has missed its deadline, calls the loop's safe stop.  The safe stop is
+ expected to go ahead of any command of the stalled loop, see comm_query_priority().  Only one stop is
+ issued per stall, the next heartbeat rearms it.
+
+ The heartbeats also give the period and jitter of each control loop.
+
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <wiicarutility/timestamp.h>
+
+#include "wiicar_watchdog.h"
+
+/// \brief Number of checks per deadline.
+#define WIICAR_WATCHDOG_CHECKS_PER_DEADLINE 4
+
+static uint32_t watchdog_deadline_us = WIICAR_WATCHDOG_DEFAULT_DEADLINE_MS
+		* 1000;
+
+static WiicarWatchdog_t *watchdogs[WIICAR_WATCHDOG_MAX_LOOPS];
+static int32_t watchdog_count = 0;
+
+/*!
+ \brief Set the deadline of every control loop, 0 disables the watchdog.
+
+ Must be called before watchdog_start().
+ */
+void watchdog_configure(uint32_t deadline_ms)
+{
+	watchdog_deadline_us = deadline_ms * 1000;
+}
+
+uint32_t watchdog_get_deadline(void)
+{
+	return watchdog_deadline_us / 1000;
+}
+
+/*!
+ \brief Add a control loop to the watchdog.
+
+ Must be called before watchdog_start().
+
+ \param safe_stop called from the watchdog thread with arg when the loop misses its deadline.
+ */
+void watchdog_register(WiicarWatchdog_t *watchdog, void (*safe_stop)(void *),
+		void *arg)
+{
+	memset(watchdog, 0, sizeof(*watchdog));
+	watchdog->safe_stop = safe_stop;
+	watchdog->arg = arg;
+
+	if (watchdog_count < WIICAR_WATCHDOG_MAX_LOOPS)
+		watchdogs[watchdog_count++] = watchdog;
+}
+
+static void check_watchdog(WiicarWatchdog_t *watchdog, uint64_t now)
+{
+	uint64_t last_heartbeat = watchdog->last_heartbeat_us;
+
+	if (!watchdog->armed || watchdog->tripped)
+		return;
+	if ((now <= last_heartbeat) || (now - last_heartbeat < watchdog_deadline_us))
+		return;
+
+	watchdog->tripped = true;
+	watchdog->stats.safe_stops++;
+	fprintf(stderr, "@%u: Control loop stalled for %u ms, stopping car\n",
+			get_tick_count(), (uint32_t) ((now - last_heartbeat) / 1000));
+	watchdog->safe_stop(watchdog->arg);
+}
+
+static void *watchdog_thread(void *arg)
+{
+	int32_t i;
+
+	for (;;)
+	{
+		usleep(watchdog_deadline_us / WIICAR_WATCHDOG_CHECKS_PER_DEADLINE);
+		for (i = 0; i < watchdog_count; i++)
+			check_watchdog(watchdogs[i], get_tick_count_us());
+	}
+	return NULL;
+}
+
+/*!
+ \brief Start the watchdog thread, unless the watchdog is disabled.
+
+ \return int32_t 0 on success, otherwise the error from pthread_create.
+ */
+int32_t watchdog_start(void)
+{
+	pthread_t thread;
+	int32_t ret_val;
+
+	if (0 == watchdog_deadline_us)
+		return 0;
+
+	ret_val = pthread_create(&thread, NULL, watchdog_thread, NULL);
+	if (0 == ret_val)
+		pthread_detach(thread);
+	return ret_val;
+}
+
+/*!
+ \brief Start monitoring, called by the control loop before it drives the motors.
+ */
+void watchdog_arm(WiicarWatchdog_t *watchdog)
+{
+	watchdog->last_heartbeat_us = get_tick_count_us();
+	watchdog->period_valid = false;
+	watchdog->tripped = false;
+	watchdog->armed = true;
+}
+
+void watchdog_disarm(WiicarWatchdog_t *watchdog)
+{
+	watchdog->armed = false;
+}
+
+/*!
+ \brief Signal one iteration of the control loop.
+ */
+void watchdog_heartbeat(WiicarWatchdog_t *watchdog)
+{
+	uint64_t now = get_tick_count_us();
+	WiicarWatchdogStats_t *stats = &watchdog->stats;
+	uint32_t period;
+
+	stats->heartbeats++;
+
+	if (watchdog->armed && watchdog->period_valid)
+	{
+		period = now - watchdog->last_heartbeat_us;
+		interval_stats_add(&stats->periods, period);
+		if (watchdog_deadline_us && (period > watchdog_deadline_us))
+			stats->overruns++;
+	}
+
+	watchdog->last_heartbeat_us = now;
+	watchdog->period_valid = watchdog->armed;
+	watchdog->tripped = false;
+}
+
+void watchdog_get_stats(const WiicarWatchdog_t *watchdog,
+		WiicarWatchdogStats_t *stats)
+{
+	*stats = watchdog->stats;
+}
+
+/*!
+ \brief Print the period, jitter and overruns of a control loop.
+ */
+void watchdog_report(const WiicarWatchdog_t *watchdog)
+{
+	WiicarWatchdogStats_t stats;
+	uint32_t mean_us, jitter_us;
+
+	watchdog_get_stats(watchdog, &stats);
+	if (0 == stats.periods.count)
+		return;
+
+	interval_stats_summary(&stats.periods, &mean_us, &jitter_us);
+	fprintf(stderr,
+			"Control loop: period %.1f ms, jitter %.1f ms, worst %.1f ms, %u overruns, %u safe stops\n",
+			mean_us / 1000.0, jitter_us / 1000.0,
+			stats.periods.worst_us / 1000.0, stats.overruns, stats.safe_stops);
+}
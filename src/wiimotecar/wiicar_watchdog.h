@@ -0,0 +1,66 @@
+/*!
+ \file
+
+ \brief Watchdog stopping a car whose control loop stalls while the motors may be running.
+
+ */
+
+#ifndef WIICAR_WATCHDOG_H_
+#define WIICAR_WATCHDOG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <wiicarutility/interval_stats.h>
+
+/// \brief Longest time allowed between two heartbeats of an armed control loop.
+#define WIICAR_WATCHDOG_DEFAULT_DEADLINE_MS 200
+
+/// \brief Longest deadline that can be set, in ms.
+#define WIICAR_WATCHDOG_MAX_DEADLINE_MS 60000
+
+/// \brief Number of control loops the watchdog can monitor.
+#define WIICAR_WATCHDOG_MAX_LOOPS 8
+
+typedef struct WiicarWatchdogStats_t
+{
+	uint32_t heartbeats;
+	interval_stats_t periods; ///< measured only while armed
+	uint32_t overruns; ///< periods longer than the deadline
+	uint32_t safe_stops; ///< stops issued by the watchdog
+} WiicarWatchdogStats_t;
+
+/*!
+ \brief Heartbeat of one control loop.
+
+ The control loop arms the watchdog while it drives the motors and calls watchdog_heartbeat() once per
+ iteration.
+ */
+typedef struct WiicarWatchdog_t
+{
+	volatile bool armed;
+	volatile uint64_t last_heartbeat_us;
+	volatile bool tripped; ///< a safe stop was issued for the current stall
+	bool period_valid; ///< last_heartbeat_us starts a period, owned by the control loop
+
+	void (*safe_stop)(void *arg);
+	void *arg;
+
+	WiicarWatchdogStats_t stats;
+} WiicarWatchdog_t;
+
+void watchdog_configure(uint32_t deadline_ms);
+uint32_t watchdog_get_deadline(void);
+
+void watchdog_register(WiicarWatchdog_t *watchdog, void (*safe_stop)(void *),
+		void *arg);
+int32_t watchdog_start(void);
+
+void watchdog_arm(WiicarWatchdog_t *watchdog);
+void watchdog_disarm(WiicarWatchdog_t *watchdog);
+void watchdog_heartbeat(WiicarWatchdog_t *watchdog);
+
+void watchdog_get_stats(const WiicarWatchdog_t *watchdog,
+		WiicarWatchdogStats_t *stats);
+void watchdog_report(const WiicarWatchdog_t *watchdog);
+
+#endif /* WIICAR_WATCHDOG_H_ */
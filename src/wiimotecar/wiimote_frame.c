@@ -0,0 +1,157 @@
+/*!
+ \file
+
+ \brief Latest-wins hand-off of wiimote reports from the cwiid callback to the control loop.
+
+ The control loop can fall behind the wiimote, for instance while compute_ir_data() runs or a slow
+ comm_query() waits on the control board.  Queueing reports would make the loop act on ever older data,
+ so only the newest frame is kept.  Button state is the exception: the buttons of every skipped frame
+ are folded into the next delivered frame, so a short press is never lost.
+
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <wiicarutility/timestamp.h>
+
+#include "wiimote_frame.h"
+
+/// \brief Set in WiimoteFrameMailbox_t::middle while the middle buffer holds an untaken frame.
+#define WIIMOTE_FRAME_FRESH (1 << 2)
+#define WIIMOTE_FRAME_INDEX_MASK (0x03)
+
+/// \brief Upper edge of each frame age bucket in us, the last bucket is unbounded.
+static const uint32_t frame_age_bucket_limit[WIIMOTE_FRAME_AGE_BUCKETS - 1] =
+{ 1000, 2000, 5000, 10000, 20000, 50000, 100000 };
+
+void wiimote_frame_init(WiimoteFrameMailbox_t *mailbox)
+{
+	memset(mailbox, 0, sizeof(*mailbox));
+	mailbox->front = 0;
+	mailbox->middle = 1;
+	mailbox->back = 2;
+}
+
+/*!
+ \brief Throw away any untaken frame and the state of the frame being assembled.
+
+ Used when the wiimote reconnects, so nothing held on the old connection leaks into the new one.  Must
+ only be called while no callback is registered.  The counters are kept.
+ */
+void wiimote_frame_discard(WiimoteFrameMailbox_t *mailbox)
+{
+	mailbox->middle &= WIIMOTE_FRAME_INDEX_MASK;
+	memset(&mailbox->current, 0, sizeof(mailbox->current));
+}
+
+/*!
+ \brief The frame the callback is assembling.
+
+ Only the callback may use this.  Fields not updated by the report keep their previous values.
+ */
+WiimoteFrame_t *wiimote_frame_current(WiimoteFrameMailbox_t *mailbox)
+{
+	return &mailbox->current;
+}
+
+/*!
+ \brief Publish the current frame to the control loop.
+
+ Called by the callback once all messages of a report have been applied to the current frame.  If the
+ previously published frame was never taken it is dropped, and its buttons are carried over.
+ */
+void wiimote_frame_publish(WiimoteFrameMailbox_t *mailbox)
+{
+	WiimoteFrame_t *back = &mailbox->frames[mailbox->back];
+	uint32_t middle;
+
+	mailbox->current.sequence = mailbox->received;
+	mailbox->current.timestamp_us = get_tick_count_us();
+	*back = mailbox->current;
+
+	do
+	{
+		middle = mailbox->middle;
+		back->button_folded = back->button_data;
+		if (middle & WIIMOTE_FRAME_FRESH)
+			back->button_folded
+					|= mailbox->frames[middle & WIIMOTE_FRAME_INDEX_MASK].button_folded;
+	} while (!__sync_bool_compare_and_swap(&mailbox->middle, middle,
+			mailbox->back | WIIMOTE_FRAME_FRESH));
+
+	if (middle & WIIMOTE_FRAME_FRESH)
+		mailbox->dropped++;
+
+	mailbox->back = middle & WIIMOTE_FRAME_INDEX_MASK;
+	mailbox->received++;
+}
+
+static void record_frame_age(WiimoteFrameMailbox_t *mailbox, uint64_t age)
+{
+	uint8_t i;
+
+	for (i = 0; i < WIIMOTE_FRAME_AGE_BUCKETS - 1; i++)
+	{
+		if (age < frame_age_bucket_limit[i])
+			break;
+	}
+	mailbox->age_histogram[i]++;
+}
+
+/*!
+ \brief Take the newest frame, if one arrived since the last call.
+
+ Only the control loop may call this.
+
+ \return const WiimoteFrame_t* the newest frame, valid until the next call, or NULL if there is none.
+ */
+const WiimoteFrame_t *wiimote_frame_take(WiimoteFrameMailbox_t *mailbox)
+{
+	const WiimoteFrame_t *frame;
+	uint32_t middle;
+
+	if (!(mailbox->middle & WIIMOTE_FRAME_FRESH))
+		return NULL;
+
+	middle = __sync_lock_test_and_set(&mailbox->middle, mailbox->front);
+	mailbox->front = middle & WIIMOTE_FRAME_INDEX_MASK;
+
+	frame = &mailbox->frames[mailbox->front];
+	mailbox->processed++;
+	record_frame_age(mailbox, get_tick_count_us() - frame->timestamp_us);
+
+	return frame;
+}
+
+void wiimote_frame_get_stats(WiimoteFrameMailbox_t *mailbox,
+		WiimoteFrameStats_t *stats)
+{
+	stats->received = mailbox->received;
+	stats->processed = mailbox->processed;
+	stats->dropped = mailbox->dropped;
+	memcpy(stats->age_histogram, mailbox->age_histogram,
+			sizeof(stats->age_histogram));
+}
+
+/*!
+ \brief Print the frame counters and the frame age histogram.
+ */
+void wiimote_frame_report(WiimoteFrameMailbox_t *mailbox)
+{
+	WiimoteFrameStats_t stats;
+	uint8_t i;
+
+	wiimote_frame_get_stats(mailbox, &stats);
+	if (0 == stats.received)
+		return;
+
+	fprintf(stderr, "Wiimote frames: %u received, %u processed, %u dropped\n",
+			stats.received, stats.processed, stats.dropped);
+	fprintf(stderr, "Frame age at processing:");
+	for (i = 0; i < WIIMOTE_FRAME_AGE_BUCKETS - 1; i++)
+		fprintf(stderr, " <%ums:%u", frame_age_bucket_limit[i] / 1000,
+				stats.age_histogram[i]);
+	fprintf(stderr, " more:%u\n", stats.age_histogram[i]);
+}
@@ -0,0 +1,71 @@
+/*!
+ \file
+
+ \brief Hand-off of wiimote reports from the cwiid callback to the control loop.
+
+ */
+
+#ifndef WIIMOTE_FRAME_H_
+#define WIIMOTE_FRAME_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "wiicar.h"
+
+/// \brief Number of buckets in the frame age histogram.
+#define WIIMOTE_FRAME_AGE_BUCKETS 8
+
+/// \brief One report from the wiimote, as seen by the control loop.
+typedef struct WiimoteFrame_t
+{
+	uint32_t sequence;
+	uint64_t timestamp_us; ///< get_tick_count_us() when the report was received
+	int16_t battery_level;
+	uint16_t button_data; ///< buttons held in this report
+	uint16_t button_folded; ///< buttons held in this report or in any report skipped before it
+	uint8_t accel_raw_data[3];
+	struct WiimoteIrRawData_t ir_raw_data;
+} WiimoteFrame_t;
+
+typedef struct WiimoteFrameStats_t
+{
+	uint32_t received;
+	uint32_t processed;
+	uint32_t dropped;
+	uint32_t age_histogram[WIIMOTE_FRAME_AGE_BUCKETS];
+} WiimoteFrameStats_t;
+
+/*!
+ \brief Latest-wins mailbox holding the newest wiimote frame.
+
+ A triple buffer: the callback owns the back buffer, the control loop owns the front buffer and the
+ middle buffer is swapped between them.  Neither side ever blocks, and a frame the control loop did not
+ get to in time is replaced by the next one rather than queued behind it.
+ */
+typedef struct WiimoteFrameMailbox_t
+{
+	WiimoteFrame_t frames[3];
+	volatile uint32_t middle; ///< index of the middle buffer, flagged fresh until the loop takes it
+	uint32_t back; ///< owned by the callback
+	uint32_t front; ///< owned by the control loop
+	WiimoteFrame_t current; ///< frame being assembled by the callback
+
+	volatile uint32_t received;
+	volatile uint32_t dropped;
+	uint32_t processed;
+	uint32_t age_histogram[WIIMOTE_FRAME_AGE_BUCKETS];
+} WiimoteFrameMailbox_t;
+
+void wiimote_frame_init(WiimoteFrameMailbox_t *mailbox);
+void wiimote_frame_discard(WiimoteFrameMailbox_t *mailbox);
+
+WiimoteFrame_t *wiimote_frame_current(WiimoteFrameMailbox_t *mailbox);
+void wiimote_frame_publish(WiimoteFrameMailbox_t *mailbox);
+
+const WiimoteFrame_t *wiimote_frame_take(WiimoteFrameMailbox_t *mailbox);
+
+void wiimote_frame_get_stats(WiimoteFrameMailbox_t *mailbox,
+		WiimoteFrameStats_t *stats);
+void wiimote_frame_report(WiimoteFrameMailbox_t *mailbox);
+
+#endif /* WIIMOTE_FRAME_H_ */
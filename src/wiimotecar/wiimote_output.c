@@ -0,0 +1,223 @@
+/*!
+ \file
+
+ \brief Sends rumble, LED and report mode changes to the wiimote only when they change.
+
+ Each cwiid_set_rumble(), cwiid_set_led() or cwiid_set_rpt_mode() call is an output report on the same
+ bluetooth link that carries the input reports the control loop is waiting for.  The modes request
+ their outputs on every frame, so the value last sent is kept here and a write is only passed on when it
+ changes the wiimote.
+
+ Rumble and LED changes are further limited to one report per WIIMOTE_OUTPUT_MIN_INTERVAL_US.  A change
+ requested sooner is held back and sent by wiimote_output_flush(), so the wiimote always ends up with the
+ last value requested.  Report mode changes are sent at once, since a mode waits on the new reports.
+
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <cwiid.h>
+#include <wiicarutility/timestamp.h>
+
+#include "wiimote_output.h"
+
+/*!
+ \brief Start tracking a newly connected wiimote.
+
+ The state of a new connection is unknown, so the first write to each output is always sent.  The
+ counters are kept across reconnects.
+ */
+void wiimote_output_init(WiimoteOutput_t *output, cwiid_wiimote_t *wiimote)
+{
+	output->wiimote = wiimote;
+	output->rumble_known = false;
+	output->led_known = false;
+	output->rpt_mode_known = false;
+	output->continuous_known = false;
+	output->rumble_requested = false;
+	output->led_requested = false;
+	output->last_send_us = 0;
+}
+
+static bool interval_elapsed(WiimoteOutput_t *output)
+{
+	return (get_tick_count_us() - output->last_send_us)
+			>= WIIMOTE_OUTPUT_MIN_INTERVAL_US;
+}
+
+static void record_send(WiimoteOutput_t *output)
+{
+	output->last_send_us = get_tick_count_us();
+	output->stats.sent++;
+}
+
+/*!
+ \brief Send every held back change, regardless of the minimum interval.
+
+ Used when leaving a mode, so the wiimote is not left rumbling until the next frame.
+
+ \return int32_t 0 on success, otherwise the error from cwiid.
+ */
+int32_t wiimote_output_sync(WiimoteOutput_t *output)
+{
+	int32_t ret_val;
+
+	if (output->rumble_requested)
+	{
+		ret_val = cwiid_set_rumble(output->wiimote, output->rumble_pending);
+		if (0 > ret_val)
+			return ret_val;
+		output->rumble = output->rumble_pending;
+		output->rumble_known = true;
+		output->rumble_requested = false;
+		record_send(output);
+	}
+
+	if (output->led_requested)
+	{
+		ret_val = cwiid_set_led(output->wiimote, output->led_pending);
+		if (0 > ret_val)
+			return ret_val;
+		output->led = output->led_pending;
+		output->led_known = true;
+		output->led_requested = false;
+		record_send(output);
+	}
+
+	return 0;
+}
+
+/*!
+ \brief Send the held back changes once the minimum interval has passed.
+
+ Called by the control loop once per frame.
+ */
+int32_t wiimote_output_flush(WiimoteOutput_t *output)
+{
+	if (!output->rumble_requested && !output->led_requested)
+		return 0;
+	if (!interval_elapsed(output))
+		return 0;
+	return wiimote_output_sync(output);
+}
+
+static int32_t request_output(WiimoteOutput_t *output)
+{
+	if (interval_elapsed(output))
+		return wiimote_output_sync(output);
+
+	output->stats.deferred++;
+	return 0;
+}
+
+int32_t wiimote_output_set_rumble(WiimoteOutput_t *output, bool rumble)
+{
+	if (output->rumble_requested ?
+			(output->rumble_pending == rumble) :
+			(output->rumble_known && (output->rumble == rumble)))
+	{
+		output->stats.suppressed++;
+		return 0;
+	}
+
+	if (output->rumble_known && (output->rumble == rumble))
+	{
+		// changed back before the held back change was sent
+		output->rumble_requested = false;
+		output->stats.suppressed++;
+		return 0;
+	}
+
+	output->rumble_pending = rumble;
+	output->rumble_requested = true;
+	return request_output(output);
+}
+
+int32_t wiimote_output_set_led(WiimoteOutput_t *output, uint8_t led)
+{
+	if (output->led_requested ?
+			(output->led_pending == led) :
+			(output->led_known && (output->led == led)))
+	{
+		output->stats.suppressed++;
+		return 0;
+	}
+
+	if (output->led_known && (output->led == led))
+	{
+		// changed back before the held back change was sent
+		output->led_requested = false;
+		output->stats.suppressed++;
+		return 0;
+	}
+
+	output->led_pending = led;
+	output->led_requested = true;
+	return request_output(output);
+}
+
+/*!
+ \brief Change the report mode, sent at once if it differs from the current mode.
+ */
+int32_t wiimote_output_set_rpt_mode(WiimoteOutput_t *output, uint8_t rpt_mode)
+{
+	int32_t ret_val;
+
+	if (output->rpt_mode_known && (output->rpt_mode == rpt_mode))
+	{
+		output->stats.suppressed++;
+		return 0;
+	}
+
+	ret_val = cwiid_set_rpt_mode(output->wiimote, rpt_mode);
+	if (0 > ret_val)
+		return ret_val;
+
+	output->rpt_mode = rpt_mode;
+	output->rpt_mode_known = true;
+	record_send(output);
+	return 0;
+}
+
+/*!
+ \brief Turn continuous reporting on or off, sent at once if it differs from the current setting.
+
+ With continuous reporting the wiimote sends a report every 10 ms even if nothing changed, otherwise only
+ on a change.
+ */
+int32_t wiimote_output_set_continuous(WiimoteOutput_t *output, bool continuous)
+{
+	int32_t ret_val;
+
+	if (output->continuous_known && (output->continuous == continuous))
+	{
+		output->stats.suppressed++;
+		return 0;
+	}
+
+	if (continuous)
+		ret_val = cwiid_enable(output->wiimote, CWIID_FLAG_CONTINUOUS);
+	else
+		ret_val = cwiid_disable(output->wiimote, CWIID_FLAG_CONTINUOUS);
+	if (0 > ret_val)
+		return ret_val;
+
+	output->continuous = continuous;
+	output->continuous_known = true;
+	record_send(output);
+	return 0;
+}
+
+/*!
+ \brief Print the output report counters.
+ */
+void wiimote_output_report(const WiimoteOutput_t *output)
+{
+	if ((0 == output->stats.sent) && (0 == output->stats.suppressed))
+		return;
+
+	fprintf(stderr, "Wiimote outputs: %u sent, %u suppressed, %u deferred\n",
+			output->stats.sent, output->stats.suppressed,
+			output->stats.deferred);
+}
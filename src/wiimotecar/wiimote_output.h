@@ -0,0 +1,64 @@
+/*!
+ \file
+
+ \brief Shadow state of the wiimote outputs: rumble, LEDs, report mode and continuous reporting.
+
+ */
+
+#ifndef WIIMOTE_OUTPUT_H_
+#define WIIMOTE_OUTPUT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <cwiid.h>
+
+/// \brief Minimum time between two rumble or LED reports sent to the wiimote.
+#define WIIMOTE_OUTPUT_MIN_INTERVAL_US (50 * 1000)
+
+typedef struct WiimoteOutputStats_t
+{
+	uint32_t sent; ///< output reports sent to the wiimote
+	uint32_t suppressed; ///< writes dropped because the wiimote already had the value
+	uint32_t deferred; ///< writes held back by the minimum interval
+} WiimoteOutputStats_t;
+
+/*!
+ \brief Last value sent to each wiimote output, and the value waiting to be sent.
+
+ Only the car thread may use this.
+ */
+typedef struct WiimoteOutput_t
+{
+	cwiid_wiimote_t *wiimote;
+
+	bool rumble;
+	uint8_t led;
+	uint8_t rpt_mode;
+	bool continuous; ///< CWIID_FLAG_CONTINUOUS
+	bool rumble_known; ///< rumble holds the state of the wiimote
+	bool led_known;
+	bool rpt_mode_known;
+	bool continuous_known;
+
+	bool rumble_pending; ///< requested rumble, valid while rumble_requested is set
+	uint8_t led_pending;
+	bool rumble_requested;
+	bool led_requested;
+
+	uint64_t last_send_us;
+	WiimoteOutputStats_t stats;
+} WiimoteOutput_t;
+
+void wiimote_output_init(WiimoteOutput_t *output, cwiid_wiimote_t *wiimote);
+
+int32_t wiimote_output_set_rumble(WiimoteOutput_t *output, bool rumble);
+int32_t wiimote_output_set_led(WiimoteOutput_t *output, uint8_t led);
+int32_t wiimote_output_set_rpt_mode(WiimoteOutput_t *output, uint8_t rpt_mode);
+int32_t wiimote_output_set_continuous(WiimoteOutput_t *output, bool continuous);
+
+int32_t wiimote_output_flush(WiimoteOutput_t *output);
+int32_t wiimote_output_sync(WiimoteOutput_t *output);
+
+void wiimote_output_report(const WiimoteOutput_t *output);
+
+#endif /* WIIMOTE_OUTPUT_H_ */
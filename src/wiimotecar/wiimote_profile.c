@@ -0,0 +1,135 @@
+/*!
+ \file
+
+ \brief Picks the smallest wiimote report that carries what each control mode uses.
+
+ cwiid derives the report format from the requested report flags.  Without an extension:
+ - buttons only gives the 2 byte button report,
+ - accelerometer gives the 5 byte button and accelerometer report,
+ - IR gives the 17 byte report with extended IR.  Extended IR carries the spot size used to pair the
+ car's LEDs, basic IR is only available together with an extension and would need the larger 21 byte
+ report, so extended IR is the better mode here.
+
+ The accelerometer data of the IR report is not asked for, so cwiid does not parse it.  Extensions are
+ never asked for.
+
+ The IR and accelerometer modes steer the car from every frame and have the wiimote report continuously,
+ so a frame arrives every 10 ms even while the wiimote is held still, instead of only on a change.  The
+ button profile keeps report-on-change, since button mode ramps the speed once per frame or timeout.
+
+ The callback records the arrival of every report against the selected profile, giving the reports per
+ second and the inter-arrival jitter each profile achieves.
+
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <cwiid.h>
+#include <wiicarutility/timestamp.h>
+
+#include "wiimote_profile.h"
+
+static const WiimoteProfile_t wiimote_profiles[WIIMOTE_PROFILE_COUNT] =
+{
+{ "buttons", CWIID_RPT_BTN, false }, //
+		{ "infrared", CWIID_RPT_IR | CWIID_RPT_BTN, true }, //
+		{ "accelerometer", CWIID_RPT_ACC | CWIID_RPT_BTN, true }, //
+		};
+
+void wiimote_profile_init(WiimoteProfileState_t *state)
+{
+	memset(state, 0, sizeof(*state));
+	state->selected = -1;
+	state->last_profile = -1;
+}
+
+/*!
+ \brief Switch the wiimote to the reports of a profile.
+
+ Only what differs from the current wiimote settings is sent, see wiimote_output.c.
+
+ \return int32_t 0 on success, otherwise the error from cwiid.
+ */
+int32_t wiimote_profile_select(WiimoteProfileState_t *state,
+		WiimoteOutput_t *output, WiimoteProfileID_t profile)
+{
+	const WiimoteProfile_t *settings = &wiimote_profiles[profile];
+	uint64_t now = get_tick_count_us();
+	int32_t ret_val;
+
+	ret_val = wiimote_output_set_continuous(output, settings->continuous);
+	if (0 > ret_val)
+		return ret_val;
+	ret_val = wiimote_output_set_rpt_mode(output, settings->rpt_mode);
+	if (0 > ret_val)
+		return ret_val;
+
+	if (state->selected != profile)
+	{
+		if (0 <= state->selected)
+			state->stats[state->selected].active_us += now
+					- state->selected_since_us;
+		state->selected_since_us = now;
+		state->selected = profile;
+	}
+	return 0;
+}
+
+/*!
+ \brief Record the arrival of one report.
+
+ Called by the callback.  The first report after a change of profile is counted but does not start an
+ interval, it may still be in the format of the previous profile.
+ */
+void wiimote_profile_record_report(WiimoteProfileState_t *state)
+{
+	int32_t profile = state->selected;
+	uint64_t now = get_tick_count_us();
+	WiimoteProfileStats_t *stats;
+	uint32_t interval;
+
+	if (0 > profile)
+		return;
+
+	stats = &state->stats[profile];
+	stats->reports++;
+
+	if (profile == state->last_profile)
+	{
+		interval = now - state->last_report_us;
+		interval_stats_add(&stats->intervals, interval);
+	}
+
+	state->last_profile = profile;
+	state->last_report_us = now;
+}
+
+/*!
+ \brief Print the report rate and inter-arrival jitter of each profile used.
+ */
+void wiimote_profile_report(const WiimoteProfileState_t *state)
+{
+	const WiimoteProfileStats_t *stats;
+	uint64_t active_us;
+	uint32_t mean_us, jitter_us;
+	int32_t i;
+
+	for (i = 0; i < WIIMOTE_PROFILE_COUNT; i++)
+	{
+		stats = &state->stats[i];
+		active_us = stats->active_us;
+		if (i == state->selected)
+			active_us += get_tick_count_us() - state->selected_since_us;
+		if ((0 == stats->intervals.count) || (0 == active_us))
+			continue;
+
+		interval_stats_summary(&stats->intervals, &mean_us, &jitter_us);
+		fprintf(stderr,
+				"Profile %s: %u reports, %.1f/s, interval %.1f ms, jitter %.1f ms, worst %.1f ms\n",
+				wiimote_profiles[i].name, stats->reports,
+				stats->reports * 1e6 / active_us, mean_us / 1000.0,
+				jitter_us / 1000.0, stats->intervals.worst_us / 1000.0);
+	}
+}
@@ -0,0 +1,62 @@
+/*!
+ \file
+
+ \brief Report profiles: the wiimote reports each control mode asks for.
+
+ */
+
+#ifndef WIIMOTE_PROFILE_H_
+#define WIIMOTE_PROFILE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <wiicarutility/interval_stats.h>
+
+#include "wiimote_output.h"
+
+typedef enum WiimoteProfileID_t
+{
+	WIIMOTE_PROFILE_BUTTONS, ///< menu and button mode
+	WIIMOTE_PROFILE_INFRARED,
+	WIIMOTE_PROFILE_ACCEL,
+	WIIMOTE_PROFILE_COUNT
+} WiimoteProfileID_t;
+
+typedef struct WiimoteProfile_t
+{
+	const char *name;
+	uint8_t rpt_mode;
+	bool continuous;
+} WiimoteProfile_t;
+
+/// \brief Reports received while one profile was selected.
+typedef struct WiimoteProfileStats_t
+{
+	uint32_t reports;
+	interval_stats_t intervals; ///< inter-arrival times
+	uint64_t active_us; ///< time the profile was selected, up to the last change of profile
+} WiimoteProfileStats_t;
+
+/*!
+ \brief Selected profile of one car, and the report statistics of each profile.
+
+ The car thread selects the profile, the callback records the reports.
+ */
+typedef struct WiimoteProfileState_t
+{
+	volatile int32_t selected; ///< a WiimoteProfileID_t, -1 before the first selection
+	uint64_t selected_since_us;
+
+	int32_t last_profile; ///< owned by the callback
+	uint64_t last_report_us; ///< owned by the callback
+
+	WiimoteProfileStats_t stats[WIIMOTE_PROFILE_COUNT];
+} WiimoteProfileState_t;
+
+void wiimote_profile_init(WiimoteProfileState_t *state);
+int32_t wiimote_profile_select(WiimoteProfileState_t *state,
+		WiimoteOutput_t *output, WiimoteProfileID_t profile);
+void wiimote_profile_record_report(WiimoteProfileState_t *state);
+void wiimote_profile_report(const WiimoteProfileState_t *state);
+
+#endif /* WIIMOTE_PROFILE_H_ */